@@ -0,0 +1,154 @@
+#include "adaptive.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+Halve the counts if they have grown too large, then rebuild the code (and, for a decoder, the
+lookup table) and schedule the next rebuild.
+*/
+static void adaptive_rebuild(AdaptiveModel *model) {
+    while (model->total > ADAPTIVE_SCALE) {
+        model->total = 0;
+        for (int s = 0; s < ADAPTIVE_SYMBOLS; s++) {
+            model->counts[s] = (model->counts[s] + 1) / 2;
+            model->total += model->counts[s];
+        }
+    }
+
+    canonical_lengths(model->counts, ADAPTIVE_SYMBOLS, ADAPTIVE_MAX_LENGTH, model->lengths);
+    canonical_codes(model->lengths, ADAPTIVE_SYMBOLS, model->codes);
+    if (model->table != NULL) {
+        canonical_table_build(model->table, model->lengths);
+    }
+
+    model->until_rebuild = model->interval;
+    if (model->interval < ADAPTIVE_INTERVAL) {
+        model->interval *= 2;
+    }
+}
+
+/*
+Allocate a model in its starting state. A decoder also gets a lookup table. Return NULL on error.
+*/
+AdaptiveModel *adaptive_create(bool decoder) {
+    AdaptiveModel *model = (AdaptiveModel *) malloc(sizeof(AdaptiveModel));
+    if (model == NULL) {
+        return NULL;
+    }
+
+    model->table = NULL;
+    if (decoder) {
+        model->table = canonical_table_create(ADAPTIVE_SYMBOLS);
+        if (model->table == NULL) {
+            free(model);
+            return NULL;
+        }
+    }
+
+    for (int s = 0; s < ADAPTIVE_SYMBOLS; s++) {
+        model->counts[s] = 1;
+    }
+    model->total = ADAPTIVE_SYMBOLS;
+    model->interval = 32;
+    adaptive_rebuild(model);
+
+    return model;
+}
+
+void adaptive_free(AdaptiveModel **pmodel) {
+    if (*pmodel != NULL) {
+        canonical_table_free(&(*pmodel)->table);
+        free(*pmodel);
+        *pmodel = NULL;
+    }
+}
+
+/*
+Code n bytes. The code only changes at a rebuild, so each run up to the next one goes through the
+sink with a single reservation.
+*/
+void adaptive_encode(AdaptiveModel *model, BitSink *sink, const uint8_t *in, size_t n) {
+    while (n > 0) {
+        size_t k = n < model->until_rebuild ? n : model->until_rebuild;
+        bit_sink_reserve(sink, k * ADAPTIVE_MAX_LENGTH / 8 + 1);
+        for (size_t i = 0; i < k; i++) {
+            uint8_t s = in[i];
+            bit_sink_append(sink, model->codes[s], model->lengths[s]);
+            model->counts[s]++;
+        }
+
+        in += k;
+        n -= k;
+        model->total += (uint32_t) k;
+        model->until_rebuild -= (uint32_t) k;
+        if (model->until_rebuild == 0) {
+            adaptive_rebuild(model);
+        }
+    }
+}
+
+/*
+Code the end symbol. The caller still has to flush the sink.
+*/
+void adaptive_finish(AdaptiveModel *model, BitSink *sink) {
+    bit_sink_put(sink, model->codes[ADAPTIVE_END], model->lengths[ADAPTIVE_END]);
+}
+
+/*
+Take bytes already read into src's window, without reading the stream, and report whether there
+are now enough bits for any code.
+*/
+static bool adaptive_ready(BitSource *src, uint32_t need) {
+    if (src->nbits >= need) {
+        return true;
+    }
+    if (src->stream == NULL || src->end - src->ptr >= 8) {
+        bit_source_refill(src);
+        return src->nbits >= need;
+    }
+    while (src->nbits <= 56 && src->ptr < src->end) {
+        src->acc |= (uint64_t) *src->ptr++ << src->nbits;
+        src->nbits += 8;
+    }
+    return src->nbits >= need;
+}
+
+/*
+Decode up to cap bytes into out and set *produced to how many. Decoding stops early at the end
+symbol, and also when the input on hand runs out after at least one byte: the bits of the next
+symbol may not have been written yet, so the caller should pass on what it has before calling
+again, which then waits for input.
+*/
+AdaptiveStatus adaptive_decode(
+    AdaptiveModel *model, BitSource *src, uint8_t *out, size_t cap, size_t *produced) {
+    AdaptiveStatus status = ADAPTIVE_MORE;
+    size_t i = 0;
+
+    while (i < cap) {
+        uint32_t s;
+        if (adaptive_ready(src, model->table->max_length)) {
+            s = canonical_decode(src, model->table);
+        } else if (i > 0) {
+            break;
+        } else {
+            s = canonical_decode_slow(src, model->table);
+        }
+
+        if (s == ADAPTIVE_END || s == CANONICAL_INVALID || bit_source_overrun(src)) {
+            status = (s == ADAPTIVE_END && !bit_source_overrun(src)) ? ADAPTIVE_DONE
+                                                                      : ADAPTIVE_ERROR;
+            break;
+        }
+        out[i++] = (uint8_t) s;
+
+        model->counts[s]++;
+        model->total++;
+        if (--model->until_rebuild == 0) {
+            adaptive_rebuild(model);
+        }
+    }
+
+    *produced = i;
+    return status;
+}
@@ -0,0 +1,55 @@
+#ifndef _ADAPTIVE_H
+#define _ADAPTIVE_H
+
+/*
+* File:     adaptive.h
+* Purpose:  Header file for adaptive.c, a one-pass Huffman coder whose code
+*           is rebuilt from the running symbol counts as data goes through.
+*
+* Encoder and decoder start from the same flat counts and rebuild their
+* codes after the same symbols, so no table is ever sent.  Rebuilds come
+* after 32 symbols and then at doubling intervals up to every
+* ADAPTIVE_INTERVAL symbols.  Counts are halved whenever their total passes
+* ADAPTIVE_SCALE, which keeps codes short and lets the model follow data
+* that changes.  The alphabet has an end symbol after the 256 byte values,
+* so a stream needs no length up front.
+*/
+
+#include "canonical.h"
+#include "decode.h"
+#include "encode.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define ADAPTIVE_SYMBOLS    257
+#define ADAPTIVE_END        256
+#define ADAPTIVE_MAX_LENGTH 24
+#define ADAPTIVE_INTERVAL   8192
+#define ADAPTIVE_SCALE      (1u << 16)
+
+typedef struct AdaptiveModel {
+    uint32_t counts[ADAPTIVE_SYMBOLS];
+    uint32_t total;
+    uint32_t interval;
+    uint32_t until_rebuild;
+    uint8_t lengths[ADAPTIVE_SYMBOLS];
+    uint32_t codes[ADAPTIVE_SYMBOLS];
+    CanonicalTable *table;
+} AdaptiveModel;
+
+/*
+* What adaptive_decode() stopped at.
+*/
+typedef enum AdaptiveStatus { ADAPTIVE_MORE, ADAPTIVE_DONE, ADAPTIVE_ERROR } AdaptiveStatus;
+
+AdaptiveModel *adaptive_create(bool decoder);
+void adaptive_free(AdaptiveModel **pmodel);
+
+void adaptive_encode(AdaptiveModel *model, BitSink *sink, const uint8_t *in, size_t n);
+void adaptive_finish(AdaptiveModel *model, BitSink *sink);
+AdaptiveStatus adaptive_decode(
+    AdaptiveModel *model, BitSource *src, uint8_t *out, size_t cap, size_t *produced);
+
+#endif
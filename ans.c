@@ -0,0 +1,424 @@
+#include "ans.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+* Symbols decoded per refill, an even number so that both states take
+* their turns: a refill leaves at least 56 bits and no state sheds more
+* than ANS_TABLE_LOG of them.
+*/
+#define ANS_PER_REFILL ((56 / ANS_TABLE_LOG) & ~1)
+
+static inline uint32_t ans_highbit(uint32_t x) {
+    return 31 - (uint32_t) __builtin_clz(x);
+}
+
+/*
+Scale counts to norm so that every symbol that occurs keeps at least 1 and the whole adds up to
+ANS_TABLE_SIZE. The rounding error lands on the largest count in one step when it can take it
+without losing half its size, and otherwise a step at a time. Return false, with norm all 0, if
+there are no counts to scale.
+*/
+bool ans_normalize(const uint32_t *counts, uint16_t *norm) {
+    uint64_t total = 0;
+    for (int i = 0; i < 256; i++) {
+        total += counts[i];
+    }
+    memset(norm, 0, 256 * sizeof(uint16_t));
+    if (total == 0) {
+        return false;
+    }
+
+    int64_t sum = 0;
+    for (int i = 0; i < 256; i++) {
+        if (counts[i] != 0) {
+            uint64_t q = ((uint64_t) counts[i] * ANS_TABLE_SIZE + total / 2) / total;
+            norm[i] = (uint16_t) (q == 0 ? 1 : q);
+            sum += norm[i];
+        }
+    }
+
+    while (sum != ANS_TABLE_SIZE) {
+        int largest = 0;
+        for (int i = 1; i < 256; i++) {
+            if (norm[i] > norm[largest]) {
+                largest = i;
+            }
+        }
+        int64_t error = sum - ANS_TABLE_SIZE;
+        int64_t step = error > 0 ? 1 : -1;
+        if (2 * error < norm[largest] && -2 * error < norm[largest]) {
+            step = error;
+        }
+        norm[largest] = (uint16_t) (norm[largest] - step);
+        sum -= step;
+    }
+    return true;
+}
+
+/*
+Return the bits the table takes as the layout in ans.h describes, padding included.
+*/
+uint64_t ans_table_bits(const uint16_t *norm) {
+    uint64_t symbols = 0;
+    uint64_t bits = 8;
+    int last = 0;
+    for (int i = 0; i < 256; i++) {
+        if (norm[i] != 0) {
+            symbols++;
+            bits += 4 + ans_highbit(norm[i]);
+            last = i;
+        }
+    }
+    bits -= 4 + ans_highbit(norm[last]);
+    bits += symbols < 32 ? 8 * symbols : 256;
+    return (bits + 7) & ~(uint64_t) 7;
+}
+
+/*
+Return about the bits the stream for counts takes with norm: each symbol costs the log of its
+share of the states, and the final states and the marker come on top. The exact figure depends on
+the order of the symbols; see ans_measure().
+*/
+uint64_t ans_cost(const uint32_t *counts, const uint16_t *norm) {
+    double bits = 0.0;
+    for (int i = 0; i < 256; i++) {
+        if (counts[i] != 0) {
+            bits += (double) counts[i] * (ANS_TABLE_LOG - log2((double) norm[i]));
+        }
+    }
+    return (uint64_t) ceil(bits) + ANS_STATES * ANS_TABLE_LOG + 1;
+}
+
+/*
+Spread the symbols over the states as FSE does, stepping by a stride coprime to the table size so
+that each symbol's states are scattered across it.
+*/
+static void ans_spread(const uint16_t *norm, uint8_t *symbol_at) {
+    const uint32_t step = (ANS_TABLE_SIZE >> 1) + (ANS_TABLE_SIZE >> 3) + 3;
+    uint32_t pos = 0;
+    for (int i = 0; i < 256; i++) {
+        for (uint32_t k = 0; k < norm[i]; k++) {
+            symbol_at[pos] = (uint8_t) i;
+            pos = (pos + step) & (ANS_TABLE_SIZE - 1);
+        }
+    }
+}
+
+/*
+Allocate an AnsEncoder. Return NULL on error.
+*/
+AnsEncoder *ans_encoder_create(void) {
+    return (AnsEncoder *) calloc(1, sizeof(AnsEncoder));
+}
+
+void ans_encoder_free(AnsEncoder **penc) {
+    if (*penc != NULL) {
+        free((*penc)->scratch);
+        free(*penc);
+        *penc = NULL;
+    }
+}
+
+/*
+Build the encoder's tables for norm. A state x in [ANS_TABLE_SIZE, 2 * ANS_TABLE_SIZE) sheds
+(x + delta_bits[s]) >> 16 bits to code s, and what is left indexes state[] from delta_state[s].
+*/
+static void ans_encoder_build(AnsEncoder *enc, const uint16_t *norm) {
+    uint8_t symbol_at[ANS_TABLE_SIZE];
+    ans_spread(norm, symbol_at);
+
+    uint32_t next[256];
+    uint32_t total = 0;
+    for (int i = 0; i < 256; i++) {
+        next[i] = total;
+        uint32_t q = norm[i];
+        if (q == 0) {
+            continue;
+        }
+        uint32_t max_out = ANS_TABLE_LOG - (q == 1 ? 0 : ans_highbit(q - 1));
+        enc->delta_bits[i] = (max_out << 16) - (q << max_out);
+        enc->delta_state[i] = (int32_t) total - (int32_t) q;
+        total += q;
+    }
+    for (uint32_t u = 0; u < ANS_TABLE_SIZE; u++) {
+        enc->state[next[symbol_at[u]]++] = (uint16_t) (ANS_TABLE_SIZE + u);
+    }
+}
+
+/*
+Code symbol s from state x, adding the bits it sheds to acc, and return the next state.
+*/
+static inline uint32_t ans_encode_step(const AnsEncoder *enc, uint32_t x, uint8_t s, uint64_t *acc,
+    uint32_t *nbits) {
+    uint32_t nb = (x + enc->delta_bits[s]) >> 16;
+    *acc = *acc << nb | (x & ((1u << nb) - 1));
+    *nbits += nb;
+    return enc->state[(x >> nb) + (uint32_t) enc->delta_state[s]];
+}
+
+/*
+Write the table for norm to sink, padded to a byte boundary.
+*/
+void ans_write_table(BitSink *sink, const uint16_t *norm) {
+    uint32_t symbols = 0;
+    int last = 0;
+    for (int i = 0; i < 256; i++) {
+        if (norm[i] != 0) {
+            symbols++;
+            last = i;
+        }
+    }
+    bit_sink_put(sink, symbols - 1, 8);
+    if (symbols < 32) {
+        for (int i = 0; i < 256; i++) {
+            if (norm[i] != 0) {
+                bit_sink_put(sink, (uint64_t) i, 8);
+            }
+        }
+    } else {
+        for (int i = 0; i < 256; i++) {
+            bit_sink_put(sink, norm[i] != 0, 1);
+        }
+    }
+    for (int i = 0; i < last; i++) {
+        if (norm[i] != 0) {
+            uint8_t top = (uint8_t) ans_highbit(norm[i]);
+            bit_sink_put(sink, top, 4);
+            bit_sink_put(sink, norm[i] & ((1u << top) - 1), top);
+        }
+    }
+    bit_sink_put(sink, 0, (uint8_t) ((8 - sink->nbits) & 7));
+}
+
+/*
+Write the stream for n bytes of data with norm to sink, which must be on a byte boundary, as
+ans_write_table() leaves it. The symbols are coded last to first into scratch, whose bytes fill
+from the end down, so that the decoder meets them first to last. A pair of symbols adds at most
+2 * ANS_TABLE_LOG bits, so acc is stored once a pair.
+*/
+void ans_encode(AnsEncoder *enc, BitSink *sink, const uint16_t *norm, const uint8_t *data,
+    size_t n) {
+    ans_encoder_build(enc, norm);
+    size_t cap = n / 8 * ANS_TABLE_LOG + 16;
+    if (cap > enc->scratch_cap) {
+        uint8_t *scratch = (uint8_t *) realloc(enc->scratch, cap);
+        if (scratch == NULL) {
+            fprintf(stderr, "huff:  unable to allocate memory\n");
+            exit(1);
+        }
+        enc->scratch = scratch;
+        enc->scratch_cap = cap;
+    }
+
+    uint8_t *buf = enc->scratch;
+    size_t pos = cap;
+    uint64_t acc = 0;
+    uint32_t nbits = 0;
+    uint32_t x[ANS_STATES] = { ANS_TABLE_SIZE, ANS_TABLE_SIZE };
+    size_t i = n;
+    if (i & 1) {
+        i--;
+        x[0] = ans_encode_step(enc, x[0], data[i], &acc, &nbits);
+    }
+    while (i > 0) {
+        i -= 2;
+        x[1] = ans_encode_step(enc, x[1], data[i + 1], &acc, &nbits);
+        x[0] = ans_encode_step(enc, x[0], data[i], &acc, &nbits);
+        if (nbits >= 32) {
+            uint32_t top = (uint32_t) (acc >> (nbits - 32));
+            buf[pos - 4] = (uint8_t) top;
+            buf[pos - 3] = (uint8_t) (top >> 8);
+            buf[pos - 2] = (uint8_t) (top >> 16);
+            buf[pos - 1] = (uint8_t) (top >> 24);
+            pos -= 4;
+            nbits -= 32;
+        }
+    }
+    for (int k = ANS_STATES; k-- > 0;) {
+        acc = acc << ANS_TABLE_LOG | (x[k] - ANS_TABLE_SIZE);
+        nbits += ANS_TABLE_LOG;
+        while (nbits >= 8) {
+            buf[--pos] = (uint8_t) (acc >> (nbits - 8));
+            nbits -= 8;
+        }
+    }
+    acc = acc << 1 | 1;
+    nbits += 1;
+    while (nbits >= 8) {
+        buf[--pos] = (uint8_t) (acc >> (nbits - 8));
+        nbits -= 8;
+    }
+    if (nbits > 0) {
+        buf[--pos] = (uint8_t) ((acc & ((1u << nbits) - 1)) << (8 - nbits));
+    }
+    bit_sink_write(sink, buf + pos, cap - pos);
+}
+
+/*
+Return the bytes of the stream ans_encode() would write for n bytes of data with norm, table not
+included, by stepping through the states without storing their bits.
+*/
+uint64_t ans_measure(AnsEncoder *enc, const uint16_t *norm, const uint8_t *data, size_t n) {
+    ans_encoder_build(enc, norm);
+    uint64_t bits = ANS_STATES * ANS_TABLE_LOG + 1;
+    uint32_t x[ANS_STATES] = { ANS_TABLE_SIZE, ANS_TABLE_SIZE };
+    for (size_t i = n; i-- > 0;) {
+        uint8_t s = data[i];
+        uint32_t *state = &x[i & 1];
+        uint32_t nb = (*state + enc->delta_bits[s]) >> 16;
+        bits += nb;
+        *state = enc->state[(*state >> nb) + (uint32_t) enc->delta_state[s]];
+    }
+    return (bits + 7) / 8;
+}
+
+/*
+Read a table written by ans_write_table() into norm and skip to the byte boundary after it. Return
+false if it is damaged: the counts must leave at least 1 for the last symbol.
+*/
+bool ans_read_table(BitSource *src, uint16_t *norm) {
+    memset(norm, 0, 256 * sizeof(uint16_t));
+    uint32_t symbols = (uint32_t) bit_source_get(src, 8) + 1;
+    uint8_t values[256];
+    if (symbols < 32) {
+        for (uint32_t k = 0; k < symbols; k++) {
+            values[k] = (uint8_t) bit_source_get(src, 8);
+            if (k > 0 && values[k] <= values[k - 1]) {
+                return false;
+            }
+        }
+    } else {
+        uint32_t found = 0;
+        for (int i = 0; i < 256; i++) {
+            if (bit_source_get(src, 1)) {
+                values[found++ & 0xff] = (uint8_t) i;
+            }
+        }
+        if (found != symbols) {
+            return false;
+        }
+    }
+
+    uint32_t sum = 0;
+    for (uint32_t k = 0; k + 1 < symbols; k++) {
+        uint8_t top = (uint8_t) bit_source_get(src, 4);
+        if (top >= ANS_TABLE_LOG) {
+            return false;
+        }
+        uint32_t q = (1u << top) | (uint32_t) bit_source_get(src, top);
+        sum += q;
+        norm[values[k]] = (uint16_t) q;
+    }
+    if (sum >= ANS_TABLE_SIZE) {
+        return false;
+    }
+    norm[values[symbols - 1]] = (uint16_t) (ANS_TABLE_SIZE - sum);
+    bit_source_align(src);
+    return !bit_source_overrun(src);
+}
+
+/*
+Build the decoding table for norm, which ans_read_table() has checked: a state's entry names its
+symbol, and the bits read after it are added to the entry's base to give the next state.
+*/
+void ans_table_build(AnsTable *table, const uint16_t *norm) {
+    uint8_t symbol_at[ANS_TABLE_SIZE];
+    ans_spread(norm, symbol_at);
+
+    uint32_t next[256];
+    for (int i = 0; i < 256; i++) {
+        next[i] = norm[i];
+    }
+    for (uint32_t u = 0; u < ANS_TABLE_SIZE; u++) {
+        uint8_t s = symbol_at[u];
+        uint32_t x = next[s]++;
+        uint32_t nb = ANS_TABLE_LOG - ans_highbit(x);
+        uint32_t base = (x << nb) - ANS_TABLE_SIZE;
+        table->entry[u] = s | nb << 8 | base << 16;
+    }
+}
+
+/*
+Find the start of a stream at the byte boundary src is on, past the zero bits and the one before
+it, and read its first states. Return false if the stream is damaged or cut short.
+*/
+bool ans_decode_start(BitSource *src, uint32_t *state) {
+    while (src->nbits < 8) {
+        bit_source_refill(src);
+    }
+    uint32_t first = (uint32_t) (src->acc & 0xff);
+    if (first == 0) {
+        return false;
+    }
+    uint32_t skip = (uint32_t) __builtin_ctz(first) + 1;
+    src->acc >>= skip;
+    src->nbits -= skip;
+    for (int k = 0; k < ANS_STATES; k++) {
+        state[k] = (uint32_t) bit_source_get(src, ANS_TABLE_LOG);
+    }
+    return !bit_source_overrun(src);
+}
+
+/*
+Decode one symbol into *out from state x, taking its bits from acc, and return the next state.
+*/
+static inline uint32_t ans_step(const uint32_t *entry, uint32_t x, uint64_t *acc, uint32_t *nbits,
+    uint8_t *out) {
+    uint32_t e = entry[x];
+    uint32_t nb = (e >> 8) & 0xff;
+    *out = (uint8_t) e;
+    x = (e >> 16) + (uint32_t) (*acc & ((1u << nb) - 1));
+    *acc >>= nb;
+    *nbits -= nb;
+    return x;
+}
+
+/*
+Decode n symbols into out, carrying the states over from the last call so that a block can be
+decoded a piece at a time; state[0] is always the one for the next symbol. After one refill,
+ANS_PER_REFILL symbols run without checking for bits, the two states' lookups side by side.
+*/
+void ans_decode(BitSource *src, const AnsTable *table, uint32_t *state, uint8_t *out, size_t n) {
+    const uint32_t *entry = table->entry;
+    uint64_t acc = src->acc;
+    uint32_t nbits = src->nbits;
+    uint32_t x0 = state[0];
+    uint32_t x1 = state[1];
+    size_t i = 0;
+
+    for (; i + ANS_PER_REFILL <= n; i += ANS_PER_REFILL) {
+        while (nbits < ANS_PER_REFILL * ANS_TABLE_LOG) {
+            src->acc = acc;
+            src->nbits = nbits;
+            bit_source_refill(src);
+            acc = src->acc;
+            nbits = src->nbits;
+        }
+        for (size_t k = 0; k < ANS_PER_REFILL; k += 2) {
+            x0 = ans_step(entry, x0, &acc, &nbits, &out[i + k]);
+            x1 = ans_step(entry, x1, &acc, &nbits, &out[i + k + 1]);
+        }
+    }
+
+    for (; i < n; i++) {
+        while (nbits < ANS_TABLE_LOG) {
+            src->acc = acc;
+            src->nbits = nbits;
+            bit_source_refill(src);
+            acc = src->acc;
+            nbits = src->nbits;
+        }
+        uint32_t next = ans_step(entry, x0, &acc, &nbits, &out[i]);
+        x0 = x1;
+        x1 = next;
+    }
+
+    src->acc = acc;
+    src->nbits = nbits;
+    state[0] = x0;
+    state[1] = x1;
+}
@@ -0,0 +1,73 @@
+#ifndef _ANS_H
+#define _ANS_H
+
+/*
+* File:     ans.h
+* Purpose:  Header file for ans.c, a table-based asymmetric numeral system
+*           (tANS) coder for blocks so skewed that whole-bit Huffman codes
+*           waste space: a symbol with p > 0.5 still costs a Huffman code a
+*           full bit, but a fraction of one here.
+*
+* The counts are scaled to ANS_TABLE_SIZE and spread over that many states
+* as FSE does.  The encoder runs through the symbols backward and writes
+* its bits backward, so that the decoder reads them forward from a
+* BitSource like any other code.  Even and odd symbols take turns with two
+* states, so that the decoder's lookups for one do not wait on the other.
+*
+* Layout:   the number of symbols less one in 8 bits; their values, 8 bits
+*           each if there are fewer than 32 and otherwise a 256-bit map;
+*           the scaled count of each but the last, whose count is what is
+*           left of ANS_TABLE_SIZE, as a 4-bit length and the bits below
+*           its leading one; zero bits to a byte boundary.  Then the
+*           stream: zero bits and a one to find its start, the final state
+*           in ANS_TABLE_LOG bits, and each symbol's bits in order.
+*/
+
+#include "decode.h"
+#include "encode.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define ANS_TABLE_LOG  11
+#define ANS_TABLE_SIZE (1u << ANS_TABLE_LOG)
+#define ANS_STATES     2
+
+/*
+* For each symbol, the bias that gives the number of bits a state sheds
+* and where its next states start in state[], as FSE lays them out.
+*/
+typedef struct AnsEncoder {
+    uint16_t state[ANS_TABLE_SIZE];
+    uint32_t delta_bits[256];
+    int32_t delta_state[256];
+    uint8_t *scratch;
+    size_t scratch_cap;
+} AnsEncoder;
+
+/*
+* entry[] maps a state to its symbol in bits 0-7, the bits to read in bits
+* 8-15 and the base of the next state in bits 16-31.
+*/
+typedef struct AnsTable {
+    uint32_t entry[ANS_TABLE_SIZE];
+} AnsTable;
+
+bool ans_normalize(const uint32_t *counts, uint16_t *norm);
+uint64_t ans_table_bits(const uint16_t *norm);
+uint64_t ans_cost(const uint32_t *counts, const uint16_t *norm);
+
+AnsEncoder *ans_encoder_create(void);
+void ans_encoder_free(AnsEncoder **penc);
+void ans_write_table(BitSink *sink, const uint16_t *norm);
+void ans_encode(AnsEncoder *enc, BitSink *sink, const uint16_t *norm, const uint8_t *data,
+    size_t n);
+uint64_t ans_measure(AnsEncoder *enc, const uint16_t *norm, const uint8_t *data, size_t n);
+
+bool ans_read_table(BitSource *src, uint16_t *norm);
+void ans_table_build(AnsTable *table, const uint16_t *norm);
+bool ans_decode_start(BitSource *src, uint32_t *state);
+void ans_decode(BitSource *src, const AnsTable *table, uint32_t *state, uint8_t *out, size_t n);
+
+#endif
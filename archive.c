@@ -0,0 +1,327 @@
+#include "archive.h"
+
+#include "crc32.h"
+#include "frame.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ARCHIVE_TRAILER 16
+
+/*
+Bytes of a directory entry with an empty name: the name length, three 64-bit fields and the CRC.
+*/
+#define ARCHIVE_ENTRY_MIN 30
+
+static void put_le(uint8_t *p, uint64_t x, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        p[i] = (uint8_t) (x >> (8 * i));
+    }
+}
+
+static uint64_t get_le(const uint8_t *p, int bytes) {
+    uint64_t x = 0;
+    for (int i = 0; i < bytes; i++) {
+        x |= (uint64_t) p[i] << (8 * i);
+    }
+    return x;
+}
+
+static bool read_at(int fd, uint8_t *buf, size_t size, uint64_t offset) {
+    while (size > 0) {
+        ssize_t n = pread(fd, buf, size, (off_t) offset);
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        size -= (size_t) n;
+        offset += (uint64_t) n;
+    }
+    return true;
+}
+
+static void archive_free(Archive *archive) {
+    for (size_t i = 0; i < archive->count; i++) {
+        free(archive->members[i].name);
+    }
+    free(archive->members);
+    bit_sink_close(&archive->sink);
+    free(archive);
+}
+
+/*
+Start a new archive in filename. Return NULL on error.
+*/
+Archive *archive_create(const char *filename) {
+    Archive *archive = (Archive *) calloc(1, sizeof(Archive));
+    if (archive == NULL) {
+        return NULL;
+    }
+    archive->fd = -1;
+    archive->sink = bit_sink_open(NULL);
+    archive->stream = fopen(filename, "wb");
+    if (archive->sink == NULL || archive->stream == NULL) {
+        if (archive->stream != NULL) {
+            fclose(archive->stream);
+        }
+        archive_free(archive);
+        return NULL;
+    }
+
+    const uint8_t magic[4] = { 'H', 'A', 0x01, 0x00 };
+    if (fwrite(magic, 1, sizeof(magic), archive->stream) != sizeof(magic)) {
+        fclose(archive->stream);
+        archive_free(archive);
+        return NULL;
+    }
+    archive->offset = sizeof(magic);
+
+    return archive;
+}
+
+/*
+Return whether name is fit to be a member name: relative, non-empty and without a ".." component,
+so that extracting it cannot land outside the extraction directory.
+*/
+bool archive_safe_name(const char *name) {
+    if (name[0] == '\0' || name[0] == '/') {
+        return false;
+    }
+    const char *p = name;
+    while (p != NULL) {
+        if (strncmp(p, "..", 2) == 0 && (p[2] == '/' || p[2] == '\0')) {
+            return false;
+        }
+        p = strchr(p, '/');
+        if (p != NULL) {
+            p++;
+        }
+    }
+    return true;
+}
+
+/*
+Compress size bytes as a member called name and append it. Return false on error, including a
+name that archive_safe_name() refuses, since it could never be extracted.
+*/
+bool archive_add(Archive *archive, const char *name, const uint8_t *data, size_t size) {
+    if (size > UINT32_MAX || strlen(name) > UINT16_MAX || !archive_safe_name(name)) {
+        return false;
+    }
+
+    if (archive->count == archive->cap) {
+        size_t cap = archive->cap ? 2 * archive->cap : 64;
+        ArchiveMember *members
+            = (ArchiveMember *) realloc(archive->members, cap * sizeof(ArchiveMember));
+        if (members == NULL) {
+            return false;
+        }
+        archive->members = members;
+        archive->cap = cap;
+    }
+
+    bit_sink_reset(archive->sink, NULL);
+    frame_compress(archive->sink, data, (uint32_t) size, NULL);
+    bit_sink_flush(archive->sink);
+
+    size_t compressed = archive->sink->pos;
+    if (fwrite(archive->sink->buf, 1, compressed, archive->stream) != compressed) {
+        return false;
+    }
+
+    ArchiveMember *m = &archive->members[archive->count];
+    m->name = strdup(name);
+    if (m->name == NULL) {
+        return false;
+    }
+    m->size = size;
+    m->offset = archive->offset;
+    m->compressed = compressed;
+    m->crc = crc32_update(0, data, size);
+
+    archive->count++;
+    archive->offset += compressed;
+    return true;
+}
+
+/*
+Write the directory and trailer, close the file, and free the Archive. Return false on error.
+*/
+bool archive_finish(Archive **parchive) {
+    Archive *archive = *parchive;
+    *parchive = NULL;
+
+    size_t size = ARCHIVE_TRAILER;
+    for (size_t i = 0; i < archive->count; i++) {
+        size += 2 + strlen(archive->members[i].name) + 28;
+    }
+
+    uint8_t *dir = (uint8_t *) malloc(size);
+    bool ok = dir != NULL && archive->count <= UINT32_MAX;
+    if (ok) {
+        uint8_t *p = dir;
+        for (size_t i = 0; i < archive->count; i++) {
+            const ArchiveMember *m = &archive->members[i];
+            size_t len = strlen(m->name);
+            put_le(p, len, 2);
+            memcpy(p + 2, m->name, len);
+            p += 2 + len;
+            put_le(p, m->size, 8);
+            put_le(p + 8, m->offset, 8);
+            put_le(p + 16, m->compressed, 8);
+            put_le(p + 24, m->crc, 4);
+            p += 28;
+        }
+        put_le(p, archive->offset, 8);
+        put_le(p + 8, archive->count, 4);
+        p[12] = 'H';
+        p[13] = 'A';
+        p[14] = 0;
+        p[15] = 0;
+        ok = fwrite(dir, 1, size, archive->stream) == size;
+    }
+    free(dir);
+
+    ok = (fclose(archive->stream) == 0) && ok;
+    archive_free(archive);
+    return ok;
+}
+
+/*
+Open an archive for reading and load its directory, without touching any member data. Return NULL
+if the file cannot be read or is not an archive.
+*/
+Archive *archive_open(const char *filename) {
+    Archive *archive = (Archive *) calloc(1, sizeof(Archive));
+    if (archive == NULL) {
+        return NULL;
+    }
+    archive->fd = open(filename, O_RDONLY);
+
+    struct stat st;
+    uint8_t head[4];
+    uint8_t trailer[ARCHIVE_TRAILER];
+    bool ok = archive->fd >= 0 && fstat(archive->fd, &st) == 0
+              && (uint64_t) st.st_size >= sizeof(head) + ARCHIVE_TRAILER
+              && read_at(archive->fd, head, sizeof(head), 0)
+              && read_at(archive->fd, trailer, ARCHIVE_TRAILER,
+                  (uint64_t) st.st_size - ARCHIVE_TRAILER)
+              && head[0] == 'H' && head[1] == 'A' && head[2] == 0x01 && trailer[12] == 'H'
+              && trailer[13] == 'A';
+
+    uint64_t dir_offset = ok ? get_le(trailer, 8) : 0;
+    uint64_t count = ok ? get_le(trailer + 8, 4) : 0;
+    uint64_t dir_end = ok ? (uint64_t) st.st_size - ARCHIVE_TRAILER : 0;
+    ok = ok && dir_offset >= sizeof(head) && dir_offset <= dir_end
+         && count <= (dir_end - dir_offset) / ARCHIVE_ENTRY_MIN;
+
+    uint8_t *dir = NULL;
+    if (ok) {
+        dir = (uint8_t *) malloc(dir_end - dir_offset + 1);
+        archive->members = (ArchiveMember *) calloc(count + 1, sizeof(ArchiveMember));
+        ok = dir != NULL && archive->members != NULL
+             && read_at(archive->fd, dir, dir_end - dir_offset, dir_offset);
+    }
+
+    const uint8_t *p = dir;
+    const uint8_t *end = ok ? dir + (dir_end - dir_offset) : dir;
+    for (uint64_t i = 0; ok && i < count; i++) {
+        ok = end - p >= 2;
+        size_t len = ok ? (size_t) get_le(p, 2) : 0;
+        ok = ok && (size_t) (end - p) >= 2 + len + 28;
+        if (!ok) {
+            break;
+        }
+
+        ArchiveMember *m = &archive->members[i];
+        m->name = (char *) malloc(len + 1);
+        ok = m->name != NULL;
+        if (ok) {
+            memcpy(m->name, p + 2, len);
+            m->name[len] = '\0';
+            p += 2 + len;
+            m->size = get_le(p, 8);
+            m->offset = get_le(p + 8, 8);
+            m->compressed = get_le(p + 16, 8);
+            m->crc = (uint32_t) get_le(p + 24, 4);
+            p += 28;
+            archive->count++;
+            ok = m->offset >= sizeof(head) && m->offset <= dir_offset
+                 && m->compressed <= dir_offset - m->offset;
+        }
+    }
+    free(dir);
+
+    if (!ok) {
+        archive_close(&archive);
+    }
+    return archive;
+}
+
+void archive_close(Archive **parchive) {
+    if (*parchive != NULL) {
+        if ((*parchive)->fd >= 0) {
+            close((*parchive)->fd);
+        }
+        archive_free(*parchive);
+        *parchive = NULL;
+    }
+}
+
+/*
+Return the index of the member called name, or archive->count if there is none.
+*/
+size_t archive_find(const Archive *archive, const char *name) {
+    for (size_t i = 0; i < archive->count; i++) {
+        if (strcmp(archive->members[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return archive->count;
+}
+
+/*
+Decode one member into worker->out, reading only that member's bytes. Several threads may extract
+from the same Archive at once, each with its own worker. The compressed bytes fit in the file, as
+archive_open() checked, but the size comes from the directory, so nothing is reserved for the
+output until the member's own header agrees with it. Return NULL on success or a description of
+what is wrong with the member.
+*/
+const char *archive_extract(const Archive *archive, size_t index, BatchWorker *worker) {
+    const ArchiveMember *m = &archive->members[index];
+
+    if (!batch_reserve(&worker->data, &worker->data_cap, m->compressed)) {
+        return "unable to allocate memory";
+    }
+    if (!read_at(archive->fd, worker->data, m->compressed, m->offset)) {
+        return "unable to read member";
+    }
+
+    BitSource src;
+    bit_source_init(&src, worker->data, m->compressed);
+    const char *error = frame_read_header(&src, NULL, &worker->header);
+    if (error != NULL) {
+        return error;
+    }
+    if (worker->header.type != 'C') {
+        return "member is not a tree frame";
+    }
+    if (worker->header.filesize != m->size) {
+        return "member size does not match the directory";
+    }
+    if (!batch_reserve(&worker->out, &worker->out_cap, m->size)) {
+        return "unable to allocate memory";
+    }
+
+    decode_symbols(&src, worker->header.table, worker->out, m->size);
+    if (bit_source_overrun(&src)) {
+        return "member is truncated";
+    }
+    if (crc32_update(0, worker->out, m->size) != m->crc) {
+        return "member fails its CRC check";
+    }
+    return NULL;
+}
@@ -0,0 +1,59 @@
+#ifndef _ARCHIVE_H
+#define _ARCHIVE_H
+
+/*
+* File:     archive.h
+* Purpose:  Header file for archive.c, a container of many compressed
+*           files with a central directory at the end.
+*
+* Layout:   'H' 'A' 0x01 0x00
+*           member frames, each a complete 'HC' frame, back to back
+*           directory: per member a 16-bit name length, the name, then the
+*                      64-bit size, offset and compressed length and the
+*                      32-bit CRC of the original bytes
+*           trailer:   64-bit directory offset, 32-bit member count, 'H' 'A'
+*                      and two zero bytes
+*
+*           All integers are little-endian.  The fixed-size trailer lets a
+*           reader find the directory with one seek, and each member's
+*           offset lets it decode one member without reading the others.
+*/
+
+#include "batch.h"
+#include "encode.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+typedef struct ArchiveMember {
+    char *name;
+    uint64_t size;
+    uint64_t offset;
+    uint64_t compressed;
+    uint32_t crc;
+} ArchiveMember;
+
+typedef struct Archive {
+    int fd;
+    FILE *stream;
+    size_t count;
+    size_t cap;
+    ArchiveMember *members;
+    uint64_t offset;
+    BitSink *sink;
+} Archive;
+
+bool archive_safe_name(const char *name);
+
+Archive *archive_create(const char *filename);
+bool archive_add(Archive *archive, const char *name, const uint8_t *data, size_t size);
+bool archive_finish(Archive **parchive);
+
+Archive *archive_open(const char *filename);
+void archive_close(Archive **parchive);
+size_t archive_find(const Archive *archive, const char *name);
+const char *archive_extract(const Archive *archive, size_t index, BatchWorker *worker);
+
+#endif
@@ -0,0 +1,259 @@
+#include "batch.h"
+
+#include "budget.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+Read a whole file descriptor into a NUL-terminated string. Return NULL on error.
+*/
+static char *read_text(int fd) {
+    size_t cap = 1 << 12;
+    size_t size = 0;
+    char *text = (char *) malloc(cap);
+    while (text != NULL) {
+        if (size + 1 == cap) {
+            char *bigger = (char *) realloc(text, 2 * cap);
+            if (bigger == NULL) {
+                break;
+            }
+            text = bigger;
+            cap *= 2;
+        }
+        ssize_t n = read(fd, text + size, cap - size - 1);
+        if (n < 0) {
+            break;
+        }
+        if (n == 0) {
+            text[size] = '\0';
+            return text;
+        }
+        size += (size_t) n;
+    }
+    free(text);
+    return NULL;
+}
+
+static bool manifest_add(Manifest *m, size_t *cap, char *input, char *output) {
+    if (m->count == *cap) {
+        size_t bigger = *cap ? 2 * *cap : 64;
+        char **inputs = (char **) realloc(m->inputs, bigger * sizeof(char *));
+        if (inputs == NULL) {
+            return false;
+        }
+        m->inputs = inputs;
+        char **outputs = (char **) realloc(m->outputs, bigger * sizeof(char *));
+        if (outputs == NULL) {
+            return false;
+        }
+        m->outputs = outputs;
+        *cap = bigger;
+    }
+    m->inputs[m->count] = input;
+    m->outputs[m->count] = output;
+    m->count++;
+    return true;
+}
+
+/*
+Read a manifest from filename, or from stdin if filename is "-". Return NULL if it cannot be read or
+has a line without two names.
+*/
+Manifest *manifest_read(const char *filename) {
+    int fd = strcmp(filename, "-") == 0 ? STDIN_FILENO : open(filename, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    char *text = read_text(fd);
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+
+    Manifest *m = (Manifest *) calloc(1, sizeof(Manifest));
+    if (text == NULL || m == NULL) {
+        free(text);
+        free(m);
+        return NULL;
+    }
+    m->text = text;
+
+    size_t cap = 0;
+    char *line = text;
+    while (*line != '\0') {
+        char *end = strchr(line, '\n');
+        char *next = end ? end + 1 : line + strlen(line);
+        if (end != NULL) {
+            *end = '\0';
+            if (end > line && end[-1] == '\r') {
+                end[-1] = '\0';
+            }
+        }
+
+        if (line[0] != '\0' && line[0] != '#') {
+            char *sep = strchr(line, '\t');
+            if (sep == NULL) {
+                sep = strchr(line, ' ');
+            }
+            char *output = sep;
+            if (output != NULL) {
+                *output++ = '\0';
+                output += strspn(output, " \t");
+            }
+            if (output == NULL || *output == '\0' || line[0] == '\0'
+                || !manifest_add(m, &cap, line, output)) {
+                manifest_free(&m);
+                return NULL;
+            }
+        }
+        line = next;
+    }
+
+    return m;
+}
+
+void manifest_free(Manifest **pmanifest) {
+    if (*pmanifest != NULL) {
+        free((*pmanifest)->inputs);
+        free((*pmanifest)->outputs);
+        free((*pmanifest)->text);
+        free(*pmanifest);
+        *pmanifest = NULL;
+    }
+}
+
+/*
+Return the size of the largest input file in m, for sizing workers; files that cannot be examined
+count as empty.
+*/
+size_t manifest_largest_input(const Manifest *m) {
+    size_t largest = 0;
+    for (size_t i = 0; i < m->count; i++) {
+        struct stat st;
+        if (stat(m->inputs[i], &st) == 0 && (size_t) st.st_size > largest) {
+            largest = (size_t) st.st_size;
+        }
+    }
+    return largest;
+}
+
+/*
+Allocate the scratch of num_workers workers. pool_for() always runs worker 0 on the calling thread,
+so there must be at least one: return NULL for none, as on error.
+*/
+BatchWorker *batch_workers_create(unsigned num_workers) {
+    if (num_workers == 0) {
+        return NULL;
+    }
+    BatchWorker *workers = (BatchWorker *) calloc(num_workers, sizeof(BatchWorker));
+    if (workers == NULL) {
+        return NULL;
+    }
+    for (unsigned w = 0; w < num_workers; w++) {
+        workers[w].sink = bit_sink_open(NULL);
+        if (workers[w].sink == NULL) {
+            batch_workers_free(&workers, num_workers);
+            return NULL;
+        }
+    }
+    return workers;
+}
+
+void batch_workers_free(BatchWorker **pworkers, unsigned num_workers) {
+    if (*pworkers != NULL) {
+        for (unsigned w = 0; w < num_workers; w++) {
+            free((*pworkers)[w].data);
+            free((*pworkers)[w].out);
+            budget_give((*pworkers)[w].data_cap + (*pworkers)[w].out_cap);
+            bit_sink_close(&(*pworkers)[w].sink);
+            frame_header_free(&(*pworkers)[w].header);
+        }
+        free(*pworkers);
+        *pworkers = NULL;
+    }
+}
+
+/*
+Grow *pbuf to hold at least size bytes, counting the growth against the memory budget. Buffers
+only grow, so a worker settles on the size of the largest file it has seen.
+*/
+bool batch_reserve(uint8_t **pbuf, size_t *pcap, size_t size) {
+    if (*pcap >= size && *pbuf != NULL) {
+        return true;
+    }
+    size_t cap = *pcap ? *pcap : 1 << 12;
+    while (cap < size) {
+        cap *= 2;
+    }
+    if (!budget_take(cap - *pcap)) {
+        return false;
+    }
+    uint8_t *buf = (uint8_t *) realloc(*pbuf, cap);
+    if (buf == NULL) {
+        budget_give(cap - *pcap);
+        return false;
+    }
+    *pbuf = buf;
+    *pcap = cap;
+    return true;
+}
+
+/*
+Read all of filename into *pbuf, growing it as needed, and store the byte count in *psize. Return
+false on error.
+*/
+bool read_whole_file(const char *filename, uint8_t **pbuf, size_t *pcap, size_t *psize) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    size_t expect = (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) ? (size_t) st.st_size : 0;
+    size_t size = 0;
+    bool ok = batch_reserve(pbuf, pcap, expect + 1);
+    while (ok) {
+        if (size == *pcap && !batch_reserve(pbuf, pcap, 2 * size)) {
+            ok = false;
+            break;
+        }
+        ssize_t n = read(fd, *pbuf + size, *pcap - size);
+        if (n < 0) {
+            ok = false;
+        } else if (n == 0) {
+            break;
+        } else {
+            size += (size_t) n;
+        }
+    }
+
+    close(fd);
+    *psize = size;
+    return ok;
+}
+
+/*
+Create filename holding size bytes of data. Return false on error.
+*/
+bool write_whole_file(const char *filename, const uint8_t *data, size_t size) {
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        return false;
+    }
+
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = write(fd, data + done, size - done);
+        if (n < 0) {
+            close(fd);
+            return false;
+        }
+        done += (size_t) n;
+    }
+
+    return close(fd) == 0;
+}
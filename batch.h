@@ -0,0 +1,52 @@
+#ifndef _BATCH_H
+#define _BATCH_H
+
+/*
+* File:     batch.h
+* Purpose:  Header file for batch.c, the manifest and per-worker buffers
+*           behind the batch modes of huff and dehuff.
+*/
+
+#include "encode.h"
+#include "frame.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+* A manifest lists one input and one output file per line, separated by a
+* tab (or, if the line has no tab, by spaces).  Blank lines and lines that
+* start with '#' are skipped.  The names point into text.
+*/
+typedef struct Manifest {
+    size_t count;
+    char **inputs;
+    char **outputs;
+    char *text;
+} Manifest;
+
+/*
+* Scratch space that one worker reuses for every file it handles.
+*/
+typedef struct BatchWorker {
+    uint8_t *data;
+    size_t data_cap;
+    uint8_t *out;
+    size_t out_cap;
+    BitSink *sink;
+    FrameHeader header;
+} BatchWorker;
+
+Manifest *manifest_read(const char *filename);
+void manifest_free(Manifest **pmanifest);
+size_t manifest_largest_input(const Manifest *m);
+
+BatchWorker *batch_workers_create(unsigned num_workers);
+void batch_workers_free(BatchWorker **pworkers, unsigned num_workers);
+bool batch_reserve(uint8_t **pbuf, size_t *pcap, size_t size);
+
+bool read_whole_file(const char *filename, uint8_t **pbuf, size_t *pcap, size_t *psize);
+bool write_whole_file(const char *filename, const uint8_t *data, size_t size);
+
+#endif
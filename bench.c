@@ -0,0 +1,231 @@
+#include "adaptive.h"
+#include "batch.h"
+#include "cpu.h"
+#include "decode.h"
+#include "encode.h"
+#include "frame.h"
+#include "lz77.h"
+#include "perf.h"
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+* One way of coding a buffer.  encode() leaves the compressed bytes in sink;
+* decode() reproduces the original size bytes in out and returns false if
+* the compressed bytes do not decode.
+*/
+typedef struct BenchCodec {
+    const char *name;
+    void (*encode)(BitSink *sink, const uint8_t *data, size_t size);
+    bool (*decode)(const uint8_t *data, size_t size, uint8_t *out, size_t out_size);
+} BenchCodec;
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double) t.tv_sec + (double) t.tv_nsec / 1e9;
+}
+
+static void two_pass_encode(BitSink *sink, const uint8_t *data, size_t size) {
+    frame_compress(sink, data, (uint32_t) size, NULL);
+}
+
+static bool two_pass_decode(const uint8_t *data, size_t size, uint8_t *out, size_t out_size) {
+    BitSource src;
+    FrameHeader header = { 0 };
+    bit_source_init(&src, data, size);
+    bool ok = frame_read_header(&src, NULL, &header) == NULL && header.filesize == out_size;
+    if (ok) {
+        decode_symbols(&src, header.table, out, out_size);
+        ok = !bit_source_overrun(&src);
+    }
+    frame_header_free(&header);
+    return ok;
+}
+
+static void adaptive_encode_buffer(BitSink *sink, const uint8_t *data, size_t size) {
+    AdaptiveModel *model = adaptive_create(false);
+    frame_write_adaptive_header(sink);
+    adaptive_encode(model, sink, data, size);
+    adaptive_finish(model, sink);
+    adaptive_free(&model);
+}
+
+static bool adaptive_decode_buffer(const uint8_t *data, size_t size, uint8_t *out, size_t out_size) {
+    BitSource src;
+    FrameHeader header = { 0 };
+    bit_source_init(&src, data, size);
+    if (frame_read_header(&src, NULL, &header) != NULL || header.type != 'V') {
+        return false;
+    }
+
+    AdaptiveModel *model = adaptive_create(true);
+    size_t done = 0;
+    AdaptiveStatus status = ADAPTIVE_MORE;
+    while (status == ADAPTIVE_MORE) {
+        size_t n;
+        status = adaptive_decode(model, &src, out + done, out_size + 1 - done, &n);
+        done += n;
+    }
+    adaptive_free(&model);
+    return status == ADAPTIVE_DONE && done == out_size;
+}
+
+static void lz_encode_buffer(BitSink *sink, const uint8_t *data, size_t size) {
+    frame_compress_lz(sink, data, (uint32_t) size, LZ_DEFAULT_WINDOW);
+}
+
+static bool lz_decode_buffer(const uint8_t *data, size_t size, uint8_t *out, size_t out_size) {
+    BitSource src;
+    FrameHeader header = { 0 };
+    bit_source_init(&src, data, size);
+    if (frame_read_header(&src, NULL, &header) != NULL || header.type != 'L'
+        || header.filesize != out_size) {
+        return false;
+    }
+    return lz_decompress(&src, out, out_size) == NULL;
+}
+
+static const BenchCodec codecs[] = {
+    { "two-pass", two_pass_encode, two_pass_decode },
+    { "adaptive", adaptive_encode_buffer, adaptive_decode_buffer },
+    { "lz77", lz_encode_buffer, lz_decode_buffer },
+};
+
+/*
+Time each codec on one buffer, best of reps runs, and print a line per codec. With counters,
+each codec is followed by its counts per byte over all the runs, for encode and decode apart.
+*/
+static bool bench_buffer(
+    const char *name, const uint8_t *data, size_t size, int reps, PerfCounters *counters) {
+    BitSink *sink = bit_sink_open(NULL);
+    uint8_t *out = (uint8_t *) malloc(size + 1);
+    if (sink == NULL || out == NULL) {
+        bit_sink_close(&sink);
+        free(out);
+        return false;
+    }
+
+    bool ok = true;
+    double mb = (double) size / 1e6;
+    for (size_t c = 0; c < sizeof(codecs) / sizeof(codecs[0]); c++) {
+        double encode_time = 1e30;
+        double decode_time = 1e30;
+        PerfSample encode_counts = { { 0 } };
+        PerfSample decode_counts = { { 0 } };
+        for (int r = 0; r < reps; r++) {
+            PerfSample sample;
+            bit_sink_reset(sink, NULL);
+            if (counters != NULL) {
+                perf_start(counters);
+            }
+            double start = now();
+            codecs[c].encode(sink, data, size);
+            bit_sink_flush(sink);
+            double t = now() - start;
+            encode_time = t < encode_time ? t : encode_time;
+            if (counters != NULL) {
+                perf_stop(counters, &sample);
+                perf_add(&encode_counts, &sample);
+                perf_start(counters);
+            }
+
+            start = now();
+            bool decoded = codecs[c].decode(sink->buf, sink->pos, out, size);
+            t = now() - start;
+            decode_time = t < decode_time ? t : decode_time;
+            if (counters != NULL) {
+                perf_stop(counters, &sample);
+                perf_add(&decode_counts, &sample);
+            }
+
+            if (!decoded || memcmp(out, data, size) != 0) {
+                fprintf(stderr, "bench:  %s: %s does not round-trip\n", name, codecs[c].name);
+                ok = false;
+                break;
+            }
+        }
+
+        printf("%-24s %-10s %12zu %12zu %7.3f %9.1f %9.1f\n", name, codecs[c].name, size,
+            sink->pos, size ? (double) sink->pos / (double) size : 0.0, mb / encode_time,
+            mb / decode_time);
+        if (counters != NULL) {
+            uint64_t bytes = (uint64_t) size * (uint64_t) reps;
+            perf_print(stdout, "    ", "encode", counters, &encode_counts, bytes);
+            perf_print(stdout, "    ", "decode", counters, &decode_counts, bytes);
+        }
+    }
+
+    bit_sink_close(&sink);
+    free(out);
+    return ok;
+}
+
+void print_help(void) {
+    printf("Usage: bench [-n reps] [-p] file...\n");
+    printf("       bench -h\n");
+}
+
+int main(int argc, char **argv) {
+    int opt = 0;
+    int reps = 5;
+    bool use_counters = false;
+
+    while ((opt = getopt(argc, argv, "hpn:")) != -1) {
+        switch (opt) {
+        case 'p': use_counters = true; break;
+        case 'n':
+            reps = (int) strtol(optarg, NULL, 10);
+            if (reps < 1) {
+                printf("bench:  -n must be at least 1\n");
+                return 1;
+            }
+            break;
+        case 'h':
+        default: print_help(); return 1;
+        }
+    }
+
+    if (optind == argc) {
+        print_help();
+        return 1;
+    }
+
+    char features[64];
+    cpu_format(cpu_features(), features, sizeof(features));
+    printf("kernels: %s\n", features);
+    printf("%-24s %-10s %12s %12s %7s %9s %9s\n", "file", "codec", "bytes", "compressed",
+        "ratio", "enc MB/s", "dec MB/s");
+
+    PerfCounters counters;
+    if (use_counters) {
+        perf_open(&counters);
+    }
+
+    uint8_t *data = NULL;
+    size_t cap = 0;
+    int status = 0;
+    for (int i = optind; i < argc; i++) {
+        size_t size;
+        if (!read_whole_file(argv[i], &data, &cap, &size) || size > UINT32_MAX) {
+            fprintf(stderr, "bench:  error reading %s\n", argv[i]);
+            status = 1;
+            continue;
+        }
+        if (!bench_buffer(argv[i], data, size, reps, use_counters ? &counters : NULL)) {
+            status = 1;
+        }
+    }
+    free(data);
+    if (use_counters) {
+        perf_close(&counters);
+    }
+
+    return status;
+}
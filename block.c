@@ -0,0 +1,301 @@
+#include "block.h"
+
+#include "canonical.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+Allocate a BlockEncoder with no table yet. Return NULL on error.
+*/
+BlockEncoder *block_encoder_create(void) {
+    BlockEncoder *enc = (BlockEncoder *) calloc(1, sizeof(BlockEncoder));
+    if (enc == NULL) {
+        return NULL;
+    }
+    enc->payload = bit_sink_open(NULL);
+    enc->ans_encoder = ans_encoder_create();
+    if (enc->payload == NULL || enc->ans_encoder == NULL) {
+        block_encoder_free(&enc);
+        return NULL;
+    }
+    return enc;
+}
+
+void block_encoder_free(BlockEncoder **penc) {
+    if (*penc != NULL) {
+        bit_sink_close(&(*penc)->payload);
+        ans_encoder_free(&(*penc)->ans_encoder);
+        free(*penc);
+        *penc = NULL;
+    }
+}
+
+/*
+Return the bits a fresh table for this histogram takes: the number of leaves and the tree.
+*/
+static uint64_t block_tree_bits(const uint32_t *histogram) {
+    uint64_t leaves = 0;
+    for (int i = 0; i < 256; i++) {
+        leaves += histogram[i] != 0;
+    }
+    return 16 + 10 * leaves - 1;
+}
+
+/*
+Decide whether a block is cheaper with the previous table than with its own, and set *bits to
+what the cheaper one's codes cost. The previous table's cost is exact. A fresh table costs the
+bits of its tree plus at least the entropy of the block, so a previous table within that is taken
+at once; otherwise the fresh code lengths settle it, which is still much cheaper than building the
+tree. A symbol the previous table has no code for rules it out. The histogram counts 0x00 and 0xff
+once more than they occur, so their codes come off *bits.
+*/
+static bool block_reuse(const BlockEncoder *enc, const uint32_t *histogram, uint64_t *bits) {
+    uint64_t reuse = UINT64_MAX;
+    if (enc->have_table) {
+        reuse = huff_cost(histogram, enc->codes);
+    }
+    uint64_t tree_bits = block_tree_bits(histogram);
+    if (reuse != UINT64_MAX && reuse <= huff_entropy(histogram) + tree_bits) {
+        *bits = reuse - enc->codes[0x00].code_length - enc->codes[0xff].code_length;
+        return true;
+    }
+
+    uint8_t lengths[256];
+    canonical_lengths(histogram, 256, CANONICAL_MAX_LENGTH, lengths);
+    uint64_t fresh = tree_bits;
+    for (int i = 0; i < 256; i++) {
+        fresh += (uint64_t) histogram[i] * lengths[i];
+    }
+    if (reuse <= fresh) {
+        *bits = reuse - enc->codes[0x00].code_length - enc->codes[0xff].code_length;
+        return true;
+    }
+    *bits = fresh - tree_bits - lengths[0x00] - lengths[0xff];
+    return false;
+}
+
+/*
+Return whether norm gives a share of the states to every byte that occurs in counts, so that it
+can code them.
+*/
+static bool block_ans_covers(const uint16_t *norm, const uint32_t *counts) {
+    for (int i = 0; i < 256; i++) {
+        if (counts[i] != 0 && norm[i] == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+Settle how a block with this histogram is coded and return its type. The Huffman side costs what
+block_reuse() settles on, the tree included when that is a fresh one; the ANS side costs its
+estimated stream, with its table unless the last ANS table can code the block as well. The
+cheapest of the four is taken, Huffman on a tie. A fresh table of either kind becomes the one
+later blocks of that kind may reuse and is written to payload, unless that is NULL; norm is left
+holding the ANS counts for an ANS block.
+*/
+static uint8_t block_table(BlockEncoder *enc, uint32_t *histogram, BitSink *payload,
+    uint16_t *norm) {
+    uint64_t huff_bits;
+    bool reuse = block_reuse(enc, histogram, &huff_bits);
+    if (!reuse) {
+        huff_bits += block_tree_bits(histogram);
+    }
+
+    uint32_t counts[256];
+    memcpy(counts, histogram, sizeof(counts));
+    counts[0x00]--;
+    counts[0xff]--;
+    uint64_t ans_reuse = UINT64_MAX;
+    if (enc->have_norm && block_ans_covers(enc->norm, counts)) {
+        ans_reuse = ans_cost(counts, enc->norm);
+    }
+    uint64_t ans_fresh = UINT64_MAX;
+    if (ans_normalize(counts, norm)) {
+        ans_fresh = ans_table_bits(norm) + ans_cost(counts, norm);
+    }
+
+    if (ans_reuse < huff_bits && ans_reuse <= ans_fresh) {
+        memcpy(norm, enc->norm, sizeof(enc->norm));
+        enc->ans++;
+        enc->reused++;
+        return BLOCK_ANS_REUSE;
+    }
+    if (ans_fresh < huff_bits) {
+        memcpy(enc->norm, norm, sizeof(enc->norm));
+        enc->have_norm = true;
+        if (payload != NULL) {
+            ans_write_table(payload, norm);
+        }
+        enc->ans++;
+        enc->fresh++;
+        return BLOCK_ANS;
+    }
+
+    if (reuse) {
+        enc->reused++;
+        return BLOCK_REUSE;
+    }
+
+    uint16_t num_leaves = 0;
+    Node *tree = create_tree(histogram, &num_leaves);
+    memset(enc->codes, 0, sizeof(enc->codes));
+    fill_code_table(enc->codes, tree, 0, 0);
+    if (payload != NULL) {
+        bit_sink_put(payload, num_leaves, 16);
+        huff_write_tree(payload, tree);
+    }
+    node_free(&tree);
+    enc->have_table = true;
+    enc->fresh++;
+    return BLOCK_FRESH;
+}
+
+/*
+Code size bytes as one block. A fresh table is built only when the previous one would cost more
+than a new one, so on steady data most blocks skip building a tree altogether.
+*/
+void block_encode(BlockEncoder *enc, BitSink *out, const uint8_t *data, uint32_t size) {
+    uint32_t histogram[256];
+    fill_histogram_buffer(data, size, histogram);
+
+    BitSink *payload = enc->payload;
+    bit_sink_reset(payload, NULL);
+    uint16_t norm[256];
+    uint8_t type = block_table(enc, histogram, payload, norm);
+
+    if (block_is_ans(type)) {
+        ans_encode(enc->ans_encoder, payload, norm, data, size);
+    } else {
+        EncodeTable table;
+        encode_table_init(&table, enc->codes);
+        encode_symbols(payload, &table, data, size);
+        bit_sink_flush(payload);
+    }
+
+    bit_sink_put(out, type, 8);
+    bit_sink_put(out, size, 32);
+    bit_sink_put(out, payload->pos, 32);
+    bit_sink_write(out, payload->buf, payload->pos);
+}
+
+/*
+Return the bytes block_encode() would write for size bytes of data, header included, settling the
+table the same way but coding nothing. The histogram counts 0x00 and 0xff once more than they
+occur, so their codes come off the cost. An ANS stream's length depends on the order of the
+symbols, so its states are stepped through to get it exactly.
+*/
+uint64_t block_estimate(BlockEncoder *enc, const uint8_t *data, uint32_t size) {
+    uint32_t histogram[256];
+    fill_histogram_buffer(data, size, histogram);
+
+    uint16_t norm[256];
+    uint8_t type = block_table(enc, histogram, NULL, norm);
+    if (block_is_ans(type)) {
+        uint64_t table = type == BLOCK_ANS ? ans_table_bits(norm) / 8 : 0;
+        return 9 + table + ans_measure(enc->ans_encoder, norm, data, size);
+    }
+
+    uint64_t bits = type == BLOCK_FRESH ? block_tree_bits(histogram) : 0;
+    bits += huff_cost(histogram, enc->codes) - enc->codes[0x00].code_length
+            - enc->codes[0xff].code_length;
+    return 9 + (bits + 7) / 8;
+}
+
+/*
+Write the block that ends the stream.
+*/
+void block_finish(BitSink *out) {
+    bit_sink_put(out, BLOCK_END, 8);
+}
+
+/*
+Skip to the next byte boundary and read the fields of a block header, leaving src at the start of
+its payload. Return NULL on success or a description of what is wrong.
+*/
+const char *block_read_fields(BitSource *src, BlockHeader *header) {
+    bit_source_align(src);
+    header->type = (uint8_t) bit_source_get(src, 8);
+    header->size = 0;
+    header->payload = 0;
+    if (header->type == BLOCK_END) {
+        return bit_source_overrun(src) ? "input is truncated" : NULL;
+    }
+    if (header->type != BLOCK_FRESH && header->type != BLOCK_REUSE && !block_is_ans(header->type)) {
+        return "input has a damaged block header";
+    }
+
+    header->size = (uint32_t) bit_source_get(src, 32);
+    header->payload = (uint32_t) bit_source_get(src, 32);
+    return bit_source_overrun(src) ? "input is truncated" : NULL;
+}
+
+/*
+Read the tree at the start of a fresh block's payload into *ptable, which is allocated on first
+use. Return NULL on success or a description of what is wrong.
+*/
+const char *block_read_table(BitSource *src, DecodeTable **ptable) {
+    uint16_t num_leaves = (uint16_t) bit_source_get(src, 16);
+    if (*ptable == NULL) {
+        *ptable = (DecodeTable *) malloc(sizeof(DecodeTable));
+        if (*ptable == NULL) {
+            return "unable to allocate memory";
+        }
+    }
+    if (!decode_table_read(*ptable, src, num_leaves)) {
+        return "input has a damaged code tree";
+    }
+    return bit_source_overrun(src) ? "input is truncated" : NULL;
+}
+
+/*
+Skip to the next byte boundary and read a block header. For a fresh block the tree is read into
+*ptable, which is allocated on first use; a reused block leaves *ptable as it is. Either way the
+block's codes follow in src. An ANS block of either sort leaves *ptable as it is too, and the rest
+is for block_read_ans(). Return NULL on success or a description of what is wrong.
+*/
+const char *block_read_header(BitSource *src, DecodeTable **ptable, BlockHeader *header) {
+    const char *error = block_read_fields(src, header);
+    if (error != NULL || header->type == BLOCK_END) {
+        return error;
+    }
+    if (header->type == BLOCK_FRESH) {
+        return block_read_table(src, ptable);
+    }
+    if (block_is_ans(header->type)) {
+        return NULL;
+    }
+    return *ptable == NULL ? "input reuses a table before sending one" : NULL;
+}
+
+/*
+Read the table at the start of an ANS block's payload into *ptable, which is allocated on first
+use, and the stream's first ANS_STATES states into state, so that ans_decode() can take it from
+there. A reused ANS block has no table and decodes with *ptable as it is. Return NULL on success or
+a description of what is wrong.
+*/
+const char *block_read_ans(BitSource *src, uint8_t type, AnsTable **ptable, uint32_t *state) {
+    if (type == BLOCK_ANS_REUSE) {
+        if (*ptable == NULL) {
+            return "input reuses an ANS table before sending one";
+        }
+    } else {
+        uint16_t norm[256];
+        if (!ans_read_table(src, norm)) {
+            return bit_source_overrun(src) ? "input is truncated" : "input has a damaged ANS table";
+        }
+        if (*ptable == NULL) {
+            *ptable = (AnsTable *) malloc(sizeof(AnsTable));
+            if (*ptable == NULL) {
+                return "unable to allocate memory";
+            }
+        }
+        ans_table_build(*ptable, norm);
+    }
+    if (!ans_decode_start(src, state)) {
+        return bit_source_overrun(src) ? "input is truncated" : "input has a damaged ANS stream";
+    }
+    return NULL;
+}
@@ -0,0 +1,84 @@
+#ifndef _BLOCK_H
+#define _BLOCK_H
+
+/*
+* File:     block.h
+* Purpose:  Header file for block.c, which splits a stream into blocks that
+*           are coded with Huffman codes or with ANS, whichever comes out
+*           smaller, and either carry a fresh table or reuse the last one.
+*
+* Layout:   'H' 'B', then blocks, each starting on a byte boundary:
+*           8-bit type, 32-bit size and 32-bit payload length in bytes,
+*           then the payload: for a fresh block the number of leaves and
+*           the tree as in an 'HC' frame, then the codes, padded to a whole
+*           byte; for an ANS block the table and stream as in ans.h, and
+*           for a reused ANS block the stream alone.  A block of type
+*           BLOCK_END, with no other fields, ends the stream.
+*
+*           The two kinds of table are kept apart: a reused block takes
+*           the table of the last fresh block, and a reused ANS block that
+*           of the last ANS block, whatever came in between.
+*
+*           The payload length lets a reader skip or hand out blocks
+*           without decoding them.
+*/
+
+#include "ans.h"
+#include "decode.h"
+#include "encode.h"
+#include "huffman.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define BLOCK_END       0
+#define BLOCK_FRESH     1
+#define BLOCK_REUSE     2
+#define BLOCK_ANS       3
+#define BLOCK_ANS_REUSE 4
+
+#define BLOCK_DEFAULT_SIZE (1u << 16)
+
+/*
+* codes and norm are the last Huffman and ANS tables sent.  fresh counts
+* the blocks that sent a table of either kind and reused those that did
+* not; ans counts the blocks coded with ANS, of both sorts.
+*/
+typedef struct BlockEncoder {
+    BitSink *payload;
+    AnsEncoder *ans_encoder;
+    Code codes[256];
+    bool have_table;
+    uint16_t norm[256];
+    bool have_norm;
+    uint64_t fresh;
+    uint64_t reused;
+    uint64_t ans;
+} BlockEncoder;
+
+typedef struct BlockHeader {
+    uint8_t type;
+    uint32_t size;
+    uint32_t payload;
+} BlockHeader;
+
+BlockEncoder *block_encoder_create(void);
+void block_encoder_free(BlockEncoder **penc);
+void block_encode(BlockEncoder *enc, BitSink *out, const uint8_t *data, uint32_t size);
+uint64_t block_estimate(BlockEncoder *enc, const uint8_t *data, uint32_t size);
+void block_finish(BitSink *out);
+
+const char *block_read_fields(BitSource *src, BlockHeader *header);
+const char *block_read_table(BitSource *src, DecodeTable **ptable);
+const char *block_read_header(BitSource *src, DecodeTable **ptable, BlockHeader *header);
+const char *block_read_ans(BitSource *src, uint8_t type, AnsTable **ptable, uint32_t *state);
+
+/*
+* Whether a block of this type is coded with ANS.
+*/
+static inline bool block_is_ans(uint8_t type) {
+    return type == BLOCK_ANS || type == BLOCK_ANS_REUSE;
+}
+
+#endif
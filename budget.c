@@ -0,0 +1,197 @@
+#include "budget.h"
+
+#include <ctype.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+static size_t limit = SIZE_MAX;
+static atomic_size_t used;
+static atomic_size_t peak;
+
+/*
+Parse a byte count with an optional K, M or G suffix (powers of 1024). Return false if text is not
+one.
+*/
+bool budget_parse(const char *text, size_t *bytes) {
+    char *end;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (end == text) {
+        return false;
+    }
+    unsigned shift = 0;
+    switch (toupper((unsigned char) *end)) {
+    case 'K': shift = 10; break;
+    case 'M': shift = 20; break;
+    case 'G': shift = 30; break;
+    case '\0': break;
+    default: return false;
+    }
+    if (shift > 0 && *++end != '\0') {
+        return false;
+    }
+    if (value > (SIZE_MAX >> shift)) {
+        return false;
+    }
+    *bytes = (size_t) value << shift;
+    return true;
+}
+
+/*
+Cap the counted buffers at limit bytes less BUDGET_RESERVE. Return false if limit does not even
+cover the reserve.
+*/
+bool budget_set(size_t bytes) {
+    if (bytes <= BUDGET_RESERVE) {
+        return false;
+    }
+    limit = bytes - BUDGET_RESERVE;
+    return true;
+}
+
+bool budget_limited(void) {
+    return limit != SIZE_MAX;
+}
+
+/*
+Return the bytes that can still be taken, which is SIZE_MAX less what is in use with no limit.
+*/
+size_t budget_available(void) {
+    size_t now = atomic_load(&used);
+    return now < limit ? limit - now : 0;
+}
+
+/*
+Count bytes more as in use if that stays within the limit. Return false, counting nothing, if not.
+*/
+bool budget_take(size_t bytes) {
+    size_t now = atomic_load(&used);
+    do {
+        if (bytes > limit || now > limit - bytes) {
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak(&used, &now, now + bytes));
+
+    size_t high = atomic_load(&peak);
+    while (now + bytes > high && !atomic_compare_exchange_weak(&peak, &high, now + bytes)) {
+    }
+    return true;
+}
+
+void budget_give(size_t bytes) {
+    atomic_fetch_sub(&used, bytes);
+}
+
+/*
+Return the most bytes counted as in use at once.
+*/
+size_t budget_peak(void) {
+    return atomic_load(&peak);
+}
+
+/*
+Return the peak resident set size of the process in bytes, or 0 if it is not known.
+*/
+size_t budget_peak_rss(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0 || usage.ru_maxrss < 0) {
+        return 0;
+    }
+    return (size_t) usage.ru_maxrss * 1024;
+}
+
+/*
+Scale a buffer of wanted bytes, of which shares are needed at once, down to fit what is left of
+the budget, halving it but not below minimum. Nothing is taken.
+*/
+size_t budget_fit(size_t wanted, size_t minimum, unsigned shares) {
+    size_t share = budget_available() / (shares ? shares : 1);
+    while (wanted > share && wanted / 2 >= minimum) {
+        wanted /= 2;
+    }
+    return wanted;
+}
+
+/*
+Return how many of wanted workers, each needing per_worker bytes, fit in the budget; at least one.
+*/
+unsigned budget_workers(unsigned wanted, size_t per_worker) {
+    if (per_worker == 0) {
+        return wanted;
+    }
+    size_t fit = budget_available() / per_worker;
+    if (fit < wanted) {
+        wanted = fit > 0 ? (unsigned) fit : 1;
+    }
+    return wanted;
+}
+
+/*
+Allocate count buffers of size bytes, all taken from the budget at once. Return NULL if they do
+not fit or cannot be allocated.
+*/
+BufferPool *buffer_pool_create(size_t size, unsigned count) {
+    if (count == 0 || size > SIZE_MAX / count || !budget_take(size * count)) {
+        return NULL;
+    }
+    BufferPool *pool = (BufferPool *) calloc(1, sizeof(BufferPool));
+    if (pool != NULL) {
+        pool->memory = (uint8_t *) malloc(size * count);
+        pool->free = (uint8_t **) malloc(count * sizeof(uint8_t *));
+    }
+    if (pool == NULL || pool->memory == NULL || pool->free == NULL) {
+        if (pool != NULL) {
+            free(pool->memory);
+            free(pool->free);
+            free(pool);
+        }
+        budget_give(size * count);
+        return NULL;
+    }
+
+    pool->size = size;
+    pool->count = count;
+    pool->num_free = count;
+    for (unsigned i = 0; i < count; i++) {
+        pool->free[i] = pool->memory + (size_t) i * size;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->returned, NULL);
+    return pool;
+}
+
+/*
+Free the pool and return its memory to the budget. Every buffer should have been put back.
+*/
+void buffer_pool_free(BufferPool **ppool) {
+    BufferPool *pool = *ppool;
+    if (pool != NULL) {
+        budget_give(pool->size * pool->count);
+        pthread_mutex_destroy(&pool->lock);
+        pthread_cond_destroy(&pool->returned);
+        free(pool->memory);
+        free(pool->free);
+        free(pool);
+        *ppool = NULL;
+    }
+}
+
+/*
+Take a buffer of pool->size bytes, waiting for one to be put back if none is free.
+*/
+uint8_t *buffer_pool_get(BufferPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->num_free == 0) {
+        pthread_cond_wait(&pool->returned, &pool->lock);
+    }
+    uint8_t *buffer = pool->free[--pool->num_free];
+    pthread_mutex_unlock(&pool->lock);
+    return buffer;
+}
+
+void buffer_pool_put(BufferPool *pool, uint8_t *buffer) {
+    pthread_mutex_lock(&pool->lock);
+    pool->free[pool->num_free++] = buffer;
+    pthread_cond_signal(&pool->returned);
+    pthread_mutex_unlock(&pool->lock);
+}
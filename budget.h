@@ -0,0 +1,53 @@
+#ifndef _BUDGET_H
+#define _BUDGET_H
+
+/*
+* File:     budget.h
+* Purpose:  Header file for budget.c, the --max-memory ceiling.
+*
+* The budget counts the large buffers a process holds: input and output
+* buffers, blocks, batch files and mapped output.  Code that sizes such a
+* buffer asks the budget first and scales down (smaller blocks, fewer
+* workers, a shallower buffer) rather than exceed it.  BUDGET_RESERVE of
+* the limit is set aside for what is not counted: the program itself,
+* stacks, stdio and the fixed 64 KiB sink and source buffers.
+*
+* A BufferPool is a fixed set of equal buffers taken from the budget once,
+* at startup; get() waits for one to be put back rather than allocate.
+*/
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define BUDGET_RESERVE (1u << 20)
+
+typedef struct BufferPool {
+    uint8_t *memory;
+    size_t size;
+    unsigned count;
+    unsigned num_free;
+    uint8_t **free;
+    pthread_mutex_t lock;
+    pthread_cond_t returned;
+} BufferPool;
+
+bool budget_parse(const char *text, size_t *bytes);
+bool budget_set(size_t limit);
+bool budget_limited(void);
+size_t budget_available(void);
+bool budget_take(size_t bytes);
+void budget_give(size_t bytes);
+size_t budget_peak(void);
+size_t budget_peak_rss(void);
+
+size_t budget_fit(size_t wanted, size_t minimum, unsigned shares);
+unsigned budget_workers(unsigned wanted, size_t per_worker);
+
+BufferPool *buffer_pool_create(size_t size, unsigned count);
+void buffer_pool_free(BufferPool **ppool);
+uint8_t *buffer_pool_get(BufferPool *pool);
+void buffer_pool_put(BufferPool *pool, uint8_t *buffer);
+
+#endif
@@ -0,0 +1,275 @@
+#include "canonical.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct CanonicalLeaf {
+    uint32_t freq;
+    uint32_t symbol;
+} CanonicalLeaf;
+
+static int leaf_compare(const void *a, const void *b) {
+    const CanonicalLeaf *x = (const CanonicalLeaf *) a;
+    const CanonicalLeaf *y = (const CanonicalLeaf *) b;
+    if (x->freq != y->freq) {
+        return x->freq < y->freq ? -1 : 1;
+    }
+    return x->symbol < y->symbol ? -1 : (x->symbol > y->symbol);
+}
+
+static uint32_t reverse_bits(uint32_t code, uint32_t length) {
+    uint32_t r = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        r = (r << 1) | (code & 1);
+        code >>= 1;
+    }
+    return r;
+}
+
+/*
+Shorten the longest codes until none exceeds max_length, keeping the Kraft sum at exactly one.
+count[] holds the number of codes of each length; the codes over the limit are first clamped to
+it, and then a code at the limit is traded for turning a shorter leaf into an internal node until
+the sum balances again.
+*/
+static void limit_lengths(uint32_t *count, uint32_t longest, uint32_t max_length) {
+    for (uint32_t len = max_length + 1; len <= longest; len++) {
+        count[max_length] += count[len];
+        count[len] = 0;
+    }
+
+    uint64_t total = 0;
+    for (uint32_t len = 1; len <= max_length; len++) {
+        total += (uint64_t) count[len] << (max_length - len);
+    }
+    while (total > ((uint64_t) 1 << max_length)) {
+        count[max_length]--;
+        for (uint32_t len = max_length - 1; len > 0; len--) {
+            if (count[len] > 0) {
+                count[len]--;
+                count[len + 1] += 2;
+                break;
+            }
+        }
+        total--;
+    }
+}
+
+/*
+Set lengths[] to Huffman code lengths for freq[], none longer than max_length. Symbols with zero
+frequency get length 0. A single used symbol gets a 1-bit code, so that every stream holds at
+least one bit per symbol. max_length must leave room for all the used symbols.
+*/
+void canonical_lengths(
+    const uint32_t *freq, uint32_t num_symbols, uint8_t max_length, uint8_t *lengths) {
+    memset(lengths, 0, num_symbols);
+
+    CanonicalLeaf *leaves = (CanonicalLeaf *) malloc(num_symbols * sizeof(CanonicalLeaf));
+    uint64_t *weight = (uint64_t *) malloc(2 * num_symbols * sizeof(uint64_t));
+    uint32_t *parent = (uint32_t *) malloc(2 * num_symbols * sizeof(uint32_t));
+    if (leaves == NULL || weight == NULL || parent == NULL) {
+        fprintf(stderr, "canonical:  out of memory\n");
+        exit(1);
+    }
+
+    uint32_t n = 0;
+    for (uint32_t s = 0; s < num_symbols; s++) {
+        if (freq[s] > 0) {
+            leaves[n].freq = freq[s];
+            leaves[n].symbol = s;
+            n++;
+        }
+    }
+
+    if (n == 1) {
+        lengths[leaves[0].symbol] = 1;
+    } else if (n > 1) {
+        qsort(leaves, n, sizeof(CanonicalLeaf), leaf_compare);
+
+        /*
+        The leaves are sorted and internal nodes are made in order of weight, so the two lightest
+        nodes are always at the front of one queue or the other.
+        */
+        for (uint32_t i = 0; i < n; i++) {
+            weight[i] = leaves[i].freq;
+        }
+        uint32_t leaf = 0;
+        uint32_t node = n;
+        for (uint32_t next = n; next < 2 * n - 1; next++) {
+            uint32_t pick[2];
+            for (int k = 0; k < 2; k++) {
+                if (leaf < n && (node == next || weight[leaf] <= weight[node])) {
+                    pick[k] = leaf++;
+                } else {
+                    pick[k] = node++;
+                }
+            }
+            weight[next] = weight[pick[0]] + weight[pick[1]];
+            parent[pick[0]] = next;
+            parent[pick[1]] = next;
+        }
+
+        /* Depths reuse weight[], walking down from the root. */
+        uint32_t count[CANONICAL_MAX_LENGTH + 64] = { 0 };
+        uint32_t longest = 0;
+        weight[2 * n - 2] = 0;
+        for (uint32_t i = 2 * n - 2; i-- > 0;) {
+            weight[i] = weight[parent[i]] + 1;
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            uint32_t depth = (uint32_t) weight[i];
+            if (depth >= CANONICAL_MAX_LENGTH + 64) {
+                depth = CANONICAL_MAX_LENGTH + 63;
+            }
+            count[depth]++;
+            if (depth > longest) {
+                longest = depth;
+            }
+        }
+
+        if (longest > max_length) {
+            limit_lengths(count, longest, max_length);
+            longest = max_length;
+        }
+
+        /* Hand out the lengths again, longest to the least frequent. */
+        uint32_t i = 0;
+        for (uint32_t len = longest; len > 0; len--) {
+            for (uint32_t k = 0; k < count[len]; k++) {
+                lengths[leaves[i++].symbol] = (uint8_t) len;
+            }
+        }
+    }
+
+    free(leaves);
+    free(weight);
+    free(parent);
+}
+
+/*
+Assign canonical codes to lengths[], in order of (length, symbol), and store each one bit-reversed
+for LSB-first output.
+*/
+void canonical_codes(const uint8_t *lengths, uint32_t num_symbols, uint32_t *codes) {
+    uint32_t count[CANONICAL_MAX_LENGTH + 1] = { 0 };
+    uint32_t next[CANONICAL_MAX_LENGTH + 1];
+
+    for (uint32_t s = 0; s < num_symbols; s++) {
+        count[lengths[s]]++;
+    }
+    count[0] = 0;
+
+    uint32_t code = 0;
+    for (uint32_t len = 1; len <= CANONICAL_MAX_LENGTH; len++) {
+        code = (code + count[len - 1]) << 1;
+        next[len] = code;
+    }
+
+    for (uint32_t s = 0; s < num_symbols; s++) {
+        uint32_t len = lengths[s];
+        codes[s] = len ? reverse_bits(next[len]++, len) : 0;
+    }
+}
+
+/*
+Allocate a decoding table for an alphabet of num_symbols symbols. Return NULL on error.
+*/
+CanonicalTable *canonical_table_create(uint32_t num_symbols) {
+    if (num_symbols == 0 || num_symbols > 0x10000) {
+        return NULL;
+    }
+    CanonicalTable *table = (CanonicalTable *) malloc(sizeof(CanonicalTable));
+    if (table == NULL) {
+        return NULL;
+    }
+    table->sorted = (uint32_t *) malloc(num_symbols * sizeof(uint32_t));
+    if (table->sorted == NULL) {
+        free(table);
+        return NULL;
+    }
+    table->num_symbols = num_symbols;
+    table->max_length = 0;
+    return table;
+}
+
+void canonical_table_free(CanonicalTable **ptable) {
+    if (*ptable != NULL) {
+        free((*ptable)->sorted);
+        free(*ptable);
+        *ptable = NULL;
+    }
+}
+
+/*
+Fill in table for the code with the given lengths. Return false if the lengths are too long or
+describe more codes than fit; a code with room left over is accepted, and the unused bit patterns
+decode as CANONICAL_INVALID.
+*/
+bool canonical_table_build(CanonicalTable *table, const uint8_t *lengths) {
+    uint32_t n = table->num_symbols;
+
+    memset(table->count, 0, sizeof(table->count));
+    table->max_length = 0;
+    for (uint32_t s = 0; s < n; s++) {
+        if (lengths[s] > CANONICAL_MAX_LENGTH) {
+            return false;
+        }
+        table->count[lengths[s]]++;
+        if (lengths[s] > table->max_length) {
+            table->max_length = lengths[s];
+        }
+    }
+    table->count[0] = 0;
+
+    uint64_t space = (uint64_t) 1 << CANONICAL_MAX_LENGTH;
+    uint32_t code = 0;
+    uint32_t index = 0;
+    for (uint32_t len = 1; len <= CANONICAL_MAX_LENGTH; len++) {
+        uint64_t used = (uint64_t) table->count[len] << (CANONICAL_MAX_LENGTH - len);
+        if (used > space) {
+            return false;
+        }
+        space -= used;
+        table->first[len] = code;
+        table->offset[len] = index;
+        code = (code + table->count[len]) << 1;
+        index += table->count[len];
+    }
+
+    uint32_t next[CANONICAL_MAX_LENGTH + 1];
+    memcpy(next, table->offset, sizeof(next));
+    for (uint32_t s = 0; s < n; s++) {
+        if (lengths[s] > 0) {
+            table->sorted[next[lengths[s]]++] = s;
+        }
+    }
+
+    memset(table->entry, 0, sizeof(table->entry));
+    for (uint32_t len = 1; len <= CANONICAL_BITS; len++) {
+        for (uint32_t i = 0; i < table->count[len]; i++) {
+            uint32_t symbol = table->sorted[table->offset[len] + i];
+            uint32_t entry = len << 16 | symbol;
+            uint32_t r = reverse_bits(table->first[len] + i, len);
+            for (uint32_t k = r; k < (1u << CANONICAL_BITS); k += 1u << len) {
+                table->entry[k] = entry;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+Decode one symbol a bit at a time, for codes longer than CANONICAL_BITS or when src may be short
+of bits. Return CANONICAL_INVALID for a bit pattern that is not a code.
+*/
+uint32_t canonical_decode_slow(BitSource *src, const CanonicalTable *table) {
+    uint32_t code = 0;
+    for (uint32_t len = 1; len <= table->max_length; len++) {
+        code = (code << 1) | (uint32_t) bit_source_get(src, 1);
+        uint32_t index = code - table->first[len];
+        if (code >= table->first[len] && index < table->count[len]) {
+            return table->sorted[table->offset[len] + index];
+        }
+    }
+    return CANONICAL_INVALID;
+}
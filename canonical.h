@@ -0,0 +1,63 @@
+#ifndef _CANONICAL_H
+#define _CANONICAL_H
+
+/*
+* File:     canonical.h
+* Purpose:  Header file for canonical.c, Huffman codes described only by
+*           their code lengths, for alphabets of any size.
+*
+* Codes are assigned in order of (length, symbol) as in DEFLATE and stored
+* bit-reversed, so that they can be written LSB first with bit_sink_put()
+* and looked up from the low bits of a BitSource.
+*/
+
+#include "decode.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#define CANONICAL_BITS       11
+#define CANONICAL_MAX_LENGTH 32
+#define CANONICAL_INVALID    UINT32_MAX
+
+/*
+* entry[] resolves any code of up to CANONICAL_BITS bits to (length << 16
+* | symbol); an entry of length 0 means the code is longer, and it is
+* finished one bit at a time from first[], count[] and offset[] into
+* sorted[], the symbols in code order.
+*/
+typedef struct CanonicalTable {
+    uint32_t num_symbols;
+    uint8_t max_length;
+    uint32_t entry[1 << CANONICAL_BITS];
+    uint32_t first[CANONICAL_MAX_LENGTH + 1];
+    uint32_t count[CANONICAL_MAX_LENGTH + 1];
+    uint32_t offset[CANONICAL_MAX_LENGTH + 1];
+    uint32_t *sorted;
+} CanonicalTable;
+
+void canonical_lengths(
+    const uint32_t *freq, uint32_t num_symbols, uint8_t max_length, uint8_t *lengths);
+void canonical_codes(const uint8_t *lengths, uint32_t num_symbols, uint32_t *codes);
+
+CanonicalTable *canonical_table_create(uint32_t num_symbols);
+void canonical_table_free(CanonicalTable **ptable);
+bool canonical_table_build(CanonicalTable *table, const uint8_t *lengths);
+uint32_t canonical_decode_slow(BitSource *src, const CanonicalTable *table);
+
+/*
+Decode one symbol. The caller must have at least table->max_length bits in src, or use
+canonical_decode_slow(), which takes them one at a time.
+*/
+static inline uint32_t canonical_decode(BitSource *src, const CanonicalTable *table) {
+    uint32_t entry = table->entry[src->acc & ((1u << CANONICAL_BITS) - 1)];
+    uint32_t length = entry >> 16;
+    if (length == 0) {
+        return canonical_decode_slow(src, table);
+    }
+    src->acc >>= length;
+    src->nbits -= length;
+    return entry & 0xffff;
+}
+
+#endif
@@ -0,0 +1,247 @@
+#include "compact.h"
+
+#include "canonical.h"
+
+#include <string.h>
+
+#define TOKENS       19
+#define TOKEN_REPEAT 16
+#define TOKEN_ZEROS  17
+#define TOKEN_LONG   18
+
+static const uint8_t COMPACT_ORDER[TOKENS]
+    = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+static const uint8_t TOKEN_EXTRA[TOKENS] = { [TOKEN_REPEAT] = 2, [TOKEN_ZEROS] = 3, [TOKEN_LONG] = 7 };
+static const uint8_t TOKEN_BASE[TOKENS] = { [TOKEN_REPEAT] = 3, [TOKEN_ZEROS] = 3, [TOKEN_LONG] = 11 };
+
+typedef struct Token {
+    uint8_t symbol;
+    uint8_t extra;
+} Token;
+
+/*
+Set lengths[] to a code for histogram of at most COMPACT_MAX_LENGTH bits. Unlike create_tree() no
+symbols are added, so unused bytes cost nothing in the header.
+*/
+void compact_lengths(const uint32_t *histogram, uint8_t *lengths) {
+    canonical_lengths(histogram, 256, COMPACT_MAX_LENGTH, lengths);
+}
+
+/*
+Fill a code table with the canonical codes for lengths[], ready for encode_table_init().
+*/
+void compact_codes(const uint8_t *lengths, Code *codes) {
+    uint32_t canonical[256];
+    canonical_codes(lengths, 256, canonical);
+    for (int i = 0; i < 256; i++) {
+        codes[i].code = canonical[i];
+        codes[i].code_length = lengths[i];
+    }
+}
+
+/*
+Run-length code lengths[0..count) into tokens. Return the number of tokens.
+*/
+static uint32_t compact_tokens(const uint8_t *lengths, uint32_t count, Token *tokens) {
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < count;) {
+        uint8_t len = lengths[i];
+        uint32_t run = 1;
+        while (i + run < count && lengths[i + run] == len) {
+            run++;
+        }
+        i += run;
+
+        if (len == 0) {
+            while (run >= 11) {
+                uint32_t k = run < 138 ? run : 138;
+                tokens[n++] = (Token) { TOKEN_LONG, (uint8_t) (k - 11) };
+                run -= k;
+            }
+            if (run >= 3) {
+                tokens[n++] = (Token) { TOKEN_ZEROS, (uint8_t) (run - 3) };
+                run = 0;
+            }
+        } else {
+            tokens[n++] = (Token) { len, 0 };
+            run--;
+            while (run >= 3) {
+                uint32_t k = run < 6 ? run : 6;
+                tokens[n++] = (Token) { TOKEN_REPEAT, (uint8_t) (k - 3) };
+                run -= k;
+            }
+        }
+        while (run-- > 0) {
+            tokens[n++] = (Token) { len, 0 };
+        }
+    }
+    return n;
+}
+
+/*
+Return the bits needed to write a symbol index or count below n.
+*/
+static uint8_t compact_index_bits(uint32_t n) {
+    uint8_t bits = 1;
+    while ((1u << bits) < n) {
+        bits++;
+    }
+    return bits;
+}
+
+void compact_write_lengths(BitSink *sink, const uint8_t *lengths) {
+    compact_write_lengths_n(sink, lengths, 256);
+}
+
+bool compact_read_lengths(BitSource *src, uint8_t *lengths) {
+    return compact_read_lengths_n(src, lengths, 256);
+}
+
+/*
+Write the lengths of an n-symbol alphabet in whichever of the two forms is shorter. Indexes and
+counts take as many bits as n - 1 needs, which for 256 symbols is the 8 of an 'HK' frame.
+*/
+void compact_write_lengths_n(BitSink *sink, const uint8_t *lengths, uint32_t n) {
+    const uint8_t index_bits = compact_index_bits(n);
+    uint32_t used = 0;
+    uint32_t last = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (lengths[i] > 0) {
+            used++;
+            last = i;
+        }
+    }
+
+    Token tokens[COMPACT_MAX_SYMBOLS];
+    uint32_t num_tokens = compact_tokens(lengths, last + 1, tokens);
+    uint32_t freq[TOKENS] = { 0 };
+    for (uint32_t i = 0; i < num_tokens; i++) {
+        freq[tokens[i].symbol]++;
+    }
+    uint8_t token_lengths[TOKENS];
+    uint32_t token_codes[TOKENS];
+    canonical_lengths(freq, TOKENS, 7, token_lengths);
+    canonical_codes(token_lengths, TOKENS, token_codes);
+
+    uint32_t order_count = TOKENS;
+    while (order_count > 4 && token_lengths[COMPACT_ORDER[order_count - 1]] == 0) {
+        order_count--;
+    }
+    uint64_t coded_bits = index_bits + 4 + 3 * order_count;
+    for (uint32_t i = 0; i < num_tokens; i++) {
+        coded_bits += token_lengths[tokens[i].symbol] + TOKEN_EXTRA[tokens[i].symbol];
+    }
+    uint64_t sparse_bits = index_bits + (index_bits + 4) * (uint64_t) used;
+
+    if (used > 0 && sparse_bits <= coded_bits) {
+        bit_sink_put(sink, 0, 1);
+        bit_sink_put(sink, used - 1, index_bits);
+        for (uint32_t i = 0; i <= last; i++) {
+            if (lengths[i] > 0) {
+                bit_sink_put(sink, i, index_bits);
+                bit_sink_put(sink, lengths[i], 4);
+            }
+        }
+        return;
+    }
+
+    bit_sink_put(sink, 1, 1);
+    bit_sink_put(sink, last, index_bits);
+    bit_sink_put(sink, order_count - 4, 4);
+    for (uint32_t i = 0; i < order_count; i++) {
+        bit_sink_put(sink, token_lengths[COMPACT_ORDER[i]], 3);
+    }
+    for (uint32_t i = 0; i < num_tokens; i++) {
+        uint8_t s = tokens[i].symbol;
+        bit_sink_put(sink, token_codes[s], token_lengths[s]);
+        if (TOKEN_EXTRA[s] > 0) {
+            bit_sink_put(sink, tokens[i].extra, TOKEN_EXTRA[s]);
+        }
+    }
+}
+
+/*
+Read the lengths of an n-symbol alphabet written by compact_write_lengths_n(). Return false if they
+are damaged; whether they form a usable code is left to the table they are built into.
+*/
+bool compact_read_lengths_n(BitSource *src, uint8_t *lengths, uint32_t n) {
+    const uint8_t index_bits = compact_index_bits(n);
+    memset(lengths, 0, n);
+
+    if (bit_source_get(src, 1) == 0) {
+        uint32_t used = (uint32_t) bit_source_get(src, index_bits) + 1;
+        for (uint32_t i = 0; i < used; i++) {
+            uint32_t symbol = (uint32_t) bit_source_get(src, index_bits);
+            uint8_t length = (uint8_t) bit_source_get(src, 4);
+            if (symbol >= n) {
+                return false;
+            }
+            lengths[symbol] = length;
+        }
+        return !bit_source_overrun(src);
+    }
+
+    uint32_t count = (uint32_t) bit_source_get(src, index_bits) + 1;
+    if (count > n) {
+        return false;
+    }
+    uint32_t order_count = (uint32_t) bit_source_get(src, 4) + 4;
+    uint8_t token_lengths[TOKENS] = { 0 };
+    for (uint32_t i = 0; i < order_count; i++) {
+        token_lengths[COMPACT_ORDER[i]] = (uint8_t) bit_source_get(src, 3);
+    }
+
+    CanonicalTable *table = canonical_table_create(TOKENS);
+    if (table == NULL) {
+        return false;
+    }
+    bool ok = canonical_table_build(table, token_lengths);
+
+    uint32_t i = 0;
+    while (ok && i < count) {
+        uint32_t s = canonical_decode_slow(src, table);
+        if (s < TOKEN_REPEAT) {
+            lengths[i++] = (uint8_t) s;
+            continue;
+        }
+        if (s == CANONICAL_INVALID || (s == TOKEN_REPEAT && i == 0)) {
+            ok = false;
+            break;
+        }
+        uint32_t run = TOKEN_BASE[s] + (uint32_t) bit_source_get(src, TOKEN_EXTRA[s]);
+        uint8_t len = s == TOKEN_REPEAT ? lengths[i - 1] : 0;
+        if (run > count - i) {
+            ok = false;
+            break;
+        }
+        memset(lengths + i, len, run);
+        i += run;
+    }
+
+    canonical_table_free(&table);
+    return ok && !bit_source_overrun(src);
+}
+
+void compact_write_varint(BitSink *sink, uint64_t value) {
+    while (value >= 0x80) {
+        bit_sink_put(sink, (value & 0x7f) | 0x80, 8);
+        value >>= 7;
+    }
+    bit_sink_put(sink, value, 8);
+}
+
+/*
+Read a varint of at most 64 bits. Return false if it is longer or the input ends.
+*/
+bool compact_read_varint(BitSource *src, uint64_t *value) {
+    *value = 0;
+    for (uint32_t shift = 0; shift < 64; shift += 7) {
+        uint64_t byte = bit_source_get(src, 8);
+        *value |= (byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return !bit_source_overrun(src);
+        }
+    }
+    return false;
+}
@@ -0,0 +1,50 @@
+#ifndef _COMPACT_H
+#define _COMPACT_H
+
+/*
+* File:     compact.h
+* Purpose:  Header file for compact.c, the small code-table encoding used
+*           by 'HK' frames.
+*
+* A table is sent as the code lengths of a canonical code, limited to
+* COMPACT_MAX_LENGTH bits, in one of two forms after a 1-bit selector:
+*
+*   0  sparse: 8-bit count of used symbols less one, then for each used
+*      symbol its 8-bit value and 4-bit length.  Cheapest for a handful of
+*      symbols.
+*   1  coded: the 8-bit index of the last used symbol, then the lengths of
+*      all symbols up to it, run-length coded and Huffman coded as in
+*      DEFLATE: tokens 0-15 are lengths, 16 repeats the last length 3-6
+*      times (2 extra bits), 17 and 18 are runs of 3-10 and 11-138 zeros
+*      (3 and 7 extra bits).  The token code is sent first as a 4-bit count
+*      less 4 of 3-bit lengths, in COMPACT_ORDER.
+*
+* The _n functions do the same for alphabets of other sizes, up to
+* COMPACT_MAX_SYMBOLS, with counts and indexes as wide as the alphabet
+* needs instead of 8 bits.
+*
+* Sizes are sent as varints: 7 bits at a time, low bits first, each group
+* followed by a continuation bit.
+*/
+
+#include "decode.h"
+#include "encode.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#define COMPACT_MAX_LENGTH  15
+#define COMPACT_MAX_SYMBOLS 512
+
+void compact_lengths(const uint32_t *histogram, uint8_t *lengths);
+void compact_codes(const uint8_t *lengths, Code *codes);
+
+void compact_write_lengths(BitSink *sink, const uint8_t *lengths);
+bool compact_read_lengths(BitSource *src, uint8_t *lengths);
+void compact_write_lengths_n(BitSink *sink, const uint8_t *lengths, uint32_t n);
+bool compact_read_lengths_n(BitSource *src, uint8_t *lengths, uint32_t n);
+
+void compact_write_varint(BitSink *sink, uint64_t value);
+bool compact_read_varint(BitSource *src, uint64_t *value);
+
+#endif
@@ -0,0 +1,102 @@
+#include "cpu.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+* Names as HUFF_CPU spells them, in the order cpu_format() lists them.
+*/
+static const struct {
+    const char *name;
+    unsigned feature;
+} cpu_names[] = {
+    { "bmi2", CPU_BMI2 },
+};
+
+#define CPU_NUM_NAMES (sizeof(cpu_names) / sizeof(cpu_names[0]))
+
+static unsigned cpu_selected;
+static pthread_once_t cpu_once = PTHREAD_ONCE_INIT;
+
+/*
+Return what the CPU supports of the features the kernels know about.
+*/
+static unsigned cpu_detect(void) {
+    unsigned features = 0;
+#if defined(__GNUC__) && defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("bmi2")) {
+        features |= CPU_BMI2;
+    }
+#endif
+    return features;
+}
+
+static void cpu_init(void) {
+    cpu_selected = cpu_detect();
+    const char *spec = getenv("HUFF_CPU");
+    if (spec != NULL && *spec != '\0') {
+        cpu_selected = cpu_parse(spec, cpu_selected);
+    }
+}
+
+/*
+Return the features the kernels may use: those the CPU supports, narrowed by HUFF_CPU. They are
+settled on the first call, from any thread.
+*/
+unsigned cpu_features(void) {
+    pthread_once(&cpu_once, cpu_init);
+    return cpu_selected;
+}
+
+/*
+Return the features of supported that spec, as HUFF_CPU is written, allows. Each name that is not
+known or not in supported is reported on stderr and left out.
+*/
+unsigned cpu_parse(const char *spec, unsigned supported) {
+    unsigned features = 0;
+    while (*spec != '\0') {
+        size_t length = strcspn(spec, ",");
+        bool known = length == strlen("generic") && strncmp(spec, "generic", length) == 0;
+        for (size_t i = 0; i < CPU_NUM_NAMES && !known; i++) {
+            if (length == strlen(cpu_names[i].name)
+                && strncmp(spec, cpu_names[i].name, length) == 0) {
+                known = true;
+                if (supported & cpu_names[i].feature) {
+                    features |= cpu_names[i].feature;
+                } else {
+                    fprintf(stderr, "huff:  HUFF_CPU: this CPU has no %s\n", cpu_names[i].name);
+                }
+            }
+        }
+        if (!known) {
+            fprintf(stderr, "huff:  HUFF_CPU: unknown feature '%.*s'\n", (int) length, spec);
+        }
+        spec += length;
+        spec += *spec == ',';
+    }
+    return features;
+}
+
+/*
+Write the names of features to buf, comma-separated, or "generic" if there are none.
+*/
+void cpu_format(unsigned features, char *buf, size_t size) {
+    size_t pos = 0;
+    if (size == 0) {
+        return;
+    }
+    buf[0] = '\0';
+    for (size_t i = 0; i < CPU_NUM_NAMES; i++) {
+        if (features & cpu_names[i].feature) {
+            int n = snprintf(buf + pos, size - pos, "%s%s", pos ? "," : "", cpu_names[i].name);
+            pos = n < 0 || (size_t) n >= size - pos ? size - 1 : pos + (size_t) n;
+        }
+    }
+    if (pos == 0) {
+        snprintf(buf, size, "generic");
+    }
+}
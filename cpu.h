@@ -0,0 +1,30 @@
+#ifndef _CPU_H
+#define _CPU_H
+
+/*
+* File:     cpu.h
+* Purpose:  Header file for cpu.c, which finds out once which instruction
+*           set extensions the kernels in encode.c and decode.c may use, so
+*           that one binary takes the best path on each host.
+*
+* Only those kernels dispatch.  Their bit I/O is inlined, so their BMI2
+* copies already shift with shlx/shrx.  The other coders keep the portable
+* bit reader and writer: the ANS decoder, the next busiest, ran no faster
+* built for BMI2, nor did histogram_add() built for AVX2.
+*
+* HUFF_CPU, if set and not empty, narrows them, to compare paths on one
+* machine: either "generic" for the portable kernels alone or a comma-
+* separated list of features, of which there is so far only bmi2.  A name
+* that is not known, or that this CPU does not support, is dropped with a
+* warning.
+*/
+
+#include <stddef.h>
+
+#define CPU_BMI2 0x1u
+
+unsigned cpu_features(void);
+unsigned cpu_parse(const char *spec, unsigned supported);
+void cpu_format(unsigned features, char *buf, size_t size);
+
+#endif
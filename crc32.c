@@ -0,0 +1,46 @@
+#include "crc32.h"
+
+#include <pthread.h>
+
+static uint32_t crc32_table[8][256];
+static pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
+
+static void crc32_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        }
+        crc32_table[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++) {
+            uint32_t c = crc32_table[t - 1][i];
+            crc32_table[t][i] = crc32_table[0][c & 0xff] ^ (c >> 8);
+        }
+    }
+}
+
+/*
+Continue a CRC over size more bytes. Start with a crc of 0. Eight bytes are folded in per step
+using eight tables ("slicing by 8").
+*/
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t size) {
+    pthread_once(&crc32_once, crc32_init);
+
+    crc = ~crc;
+    while (size >= 8) {
+        uint32_t lo = crc ^ ((uint32_t) data[0] | (uint32_t) data[1] << 8
+                                | (uint32_t) data[2] << 16 | (uint32_t) data[3] << 24);
+        crc = crc32_table[7][lo & 0xff] ^ crc32_table[6][(lo >> 8) & 0xff]
+              ^ crc32_table[5][(lo >> 16) & 0xff] ^ crc32_table[4][lo >> 24]
+              ^ crc32_table[3][data[4]] ^ crc32_table[2][data[5]] ^ crc32_table[1][data[6]]
+              ^ crc32_table[0][data[7]];
+        data += 8;
+        size -= 8;
+    }
+    while (size-- > 0) {
+        crc = crc32_table[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
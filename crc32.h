@@ -0,0 +1,14 @@
+#ifndef _CRC32_H
+#define _CRC32_H
+
+/*
+* File:     crc32.h
+* Purpose:  Header file for crc32.c, the CRC-32 used by zip and gzip.
+*/
+
+#include <inttypes.h>
+#include <stddef.h>
+
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t size);
+
+#endif
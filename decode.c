@@ -0,0 +1,537 @@
+#include "decode.h"
+
+#include "canonical.h"
+#include "cpu.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define DECODE_X86 1
+#endif
+
+#define SOURCE_SIZE (1 << 16)
+
+typedef void (*DecodeKernel)(BitSource *, const DecodeTable *, uint8_t *, size_t);
+
+static inline uint64_t load_le64(const uint8_t *p) {
+    uint64_t x;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(&x, p, sizeof(x));
+#else
+    x = 0;
+    for (int i = 0; i < 8; i++) {
+        x |= (uint64_t) p[i] << (8 * i);
+    }
+#endif
+    return x;
+}
+
+/*
+Allocate a BitSource that reads stream through a private buffer. Return NULL on error.
+*/
+BitSource *bit_source_open(FILE *stream) {
+    BitSource *src = (BitSource *) malloc(sizeof(BitSource));
+    if (src == NULL) {
+        return NULL;
+    }
+
+    src->buf = (uint8_t *) malloc(SOURCE_SIZE);
+    if (src->buf == NULL) {
+        free(src);
+        return NULL;
+    }
+
+    src->stream = stream;
+    src->cap = SOURCE_SIZE;
+    src->ptr = src->buf;
+    src->end = src->buf;
+    src->acc = 0;
+    src->nbits = 0;
+    src->pad = 0;
+
+    return src;
+}
+
+/*
+Free the buffer and the BitSource, and set *psrc to NULL. The stream is left open.
+*/
+void bit_source_close(BitSource **psrc) {
+    if (*psrc != NULL) {
+        free((*psrc)->buf);
+        free(*psrc);
+        *psrc = NULL;
+    }
+}
+
+/*
+Point src at size bytes of memory. Such a source owns nothing and needs no closing.
+*/
+void bit_source_init(BitSource *src, const uint8_t *data, size_t size) {
+    src->stream = NULL;
+    src->buf = NULL;
+    src->cap = 0;
+    src->ptr = data;
+    src->end = data + size;
+    src->acc = 0;
+    src->nbits = 0;
+    src->pad = 0;
+}
+
+/*
+Refill the window with a single read(), so that a pipe or socket hands over whatever has arrived
+instead of blocking until the whole buffer is full.
+*/
+static bool bit_source_fill(BitSource *src) {
+    if (src->stream == NULL) {
+        return false;
+    }
+    ssize_t n;
+    do {
+        n = read(fileno(src->stream), src->buf, src->cap);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        n = 0;
+    }
+    src->ptr = src->buf;
+    src->end = src->buf + n;
+    return n > 0;
+}
+
+/*
+Top acc up to 56 bits or more. With 8 bytes in the window this is one unaligned load; near the end
+of the window the bytes go in one at a time, and past the end of the input zero bytes are counted
+in pad instead. At most one read is made from the stream, so a short read from a pipe can leave
+fewer bits than that: callers that need a certain number loop until they have them.
+*/
+void bit_source_refill(BitSource *src) {
+    if (src->end - src->ptr >= 8) {
+        src->acc |= load_le64(src->ptr) << src->nbits;
+        src->ptr += (63 - src->nbits) >> 3;
+        src->nbits |= 56;
+        return;
+    }
+
+    bool filled = false;
+    while (src->nbits <= 56) {
+        if (src->ptr == src->end) {
+            if (filled) {
+                return;
+            }
+            if (!bit_source_fill(src)) {
+                uint32_t pad = (63 - src->nbits) & ~7u;
+                src->pad += pad;
+                src->nbits += pad;
+                return;
+            }
+            filled = true;
+        }
+        src->acc |= (uint64_t) *src->ptr++ << src->nbits;
+        src->nbits += 8;
+    }
+}
+
+/*
+Read length bits, LSB first. length must not exceed 56.
+*/
+uint64_t bit_source_get(BitSource *src, uint8_t length) {
+    while (src->nbits < length) {
+        bit_source_refill(src);
+    }
+    uint64_t bits = src->acc & (((uint64_t) 1 << length) - 1);
+    src->acc >>= length;
+    src->nbits -= length;
+    return bits;
+}
+
+/*
+Skip to the next byte boundary of the input. Whole bytes go into acc, so the bits left over from
+the last byte started are the ones below a multiple of 8.
+*/
+void bit_source_align(BitSource *src) {
+    uint32_t skip = src->nbits & 7;
+    src->acc >>= skip;
+    src->nbits -= skip;
+}
+
+/*
+Skip to the next byte boundary and return whether the input ends there, as it does after the
+last frame of a file.
+*/
+bool bit_source_at_end(BitSource *src) {
+    bit_source_align(src);
+    bit_source_refill(src);
+    return src->nbits <= src->pad;
+}
+
+/*
+Skip to the next byte boundary and copy the next n bytes of input to out, straight from the stream
+once the bytes already buffered are used up. Return the number copied, less than n only at the end
+of the input.
+*/
+size_t bit_source_read(BitSource *src, uint8_t *out, size_t n) {
+    bit_source_align(src);
+    size_t done = 0;
+    while (done < n && src->nbits >= 8 && src->nbits > src->pad) {
+        out[done++] = (uint8_t) src->acc;
+        src->acc >>= 8;
+        src->nbits -= 8;
+    }
+    if (done == n || src->nbits > 0) {
+        return done;
+    }
+
+    /* The bits above nbits are bytes at ptr that a refill would load again. */
+    src->acc = 0;
+    while (done < n) {
+        size_t k = (size_t) (src->end - src->ptr);
+        if (k == 0 && n - done >= src->cap && src->stream != NULL) {
+            ssize_t got = read(fileno(src->stream), out + done, n - done);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got <= 0) {
+                break;
+            }
+            done += (size_t) got;
+            continue;
+        }
+        if (k == 0 && !bit_source_fill(src)) {
+            break;
+        }
+        k = (size_t) (src->end - src->ptr);
+        k = k < n - done ? k : n - done;
+        memcpy(out + done, src->ptr, k);
+        src->ptr += k;
+        done += k;
+    }
+    return done;
+}
+
+/*
+Return true if more bits have been consumed than the input holds.
+*/
+bool bit_source_overrun(const BitSource *src) {
+    return src->pad > src->nbits;
+}
+
+static uint16_t decode_flatten(DecodeTable *table, const Node *node, uint8_t depth) {
+    if (node->left == NULL && node->right == NULL) {
+        if (depth > table->max_length) {
+            table->max_length = depth;
+        }
+        return (uint16_t) (DECODE_LEAF | node->symbol);
+    }
+
+    uint16_t index = table->num_nodes++;
+    uint16_t left = decode_flatten(table, node->left, (uint8_t) (depth + 1));
+    uint16_t right = decode_flatten(table, node->right, (uint8_t) (depth + 1));
+    table->child[index][0] = left;
+    table->child[index][1] = right;
+    return index;
+}
+
+static void decode_fill(DecodeTable *table, uint16_t ref, uint32_t code, uint32_t depth) {
+    if ((ref & DECODE_LEAF) || depth == DECODE_BITS) {
+        uint32_t entry = depth << 16 | ref;
+        for (uint32_t k = code; k < (1u << DECODE_BITS); k += 1u << depth) {
+            table->entry[k] = entry;
+        }
+        return;
+    }
+    decode_fill(table, table->child[ref][0], code, depth + 1);
+    decode_fill(table, table->child[ref][1], code | 1u << depth, depth + 1);
+}
+
+/*
+Fill the multi entries from the single ones. The entry for a code is repeated for every value of
+the bits above it, so the code after the first is found by looking up the bits left over, and is
+taken if it is a symbol whose length fits in them. Every index is as likely as the code it starts
+with, so the average count over all of them is the symbols an average lookup yields.
+*/
+static void decode_fill_multi(DecodeTable *table) {
+    uint32_t total = 0;
+    for (uint32_t k = 0; k < (1u << DECODE_BITS); k++) {
+        uint32_t symbols = 0;
+        uint32_t length = 0;
+        uint32_t count = 0;
+        while (count < DECODE_MULTI) {
+            uint32_t entry = table->entry[k >> length];
+            uint32_t l = entry >> 16;
+            if (!(entry & DECODE_LEAF) || length + l > DECODE_BITS) {
+                break;
+            }
+            symbols |= (entry & 0xff) << (8 * count);
+            length += l;
+            count++;
+        }
+        table->multi[k] = count << 28 | length << 24 | symbols;
+        total += count;
+    }
+    table->use_multi = total >= DECODE_MULTI_GAIN * (1u << DECODE_BITS);
+}
+
+/*
+Build the lookup table for a code tree. Return NULL on error.
+*/
+DecodeTable *decode_table_create(const Node *tree) {
+    DecodeTable *table = (DecodeTable *) malloc(sizeof(DecodeTable));
+    if (table == NULL) {
+        return NULL;
+    }
+
+    table->num_nodes = 0;
+    table->max_length = 0;
+    uint16_t root = decode_flatten(table, tree, 0);
+    decode_fill(table, root, 0, 0);
+    decode_fill_multi(table);
+
+    return table;
+}
+
+static void decode_depth(DecodeTable *table, uint16_t ref, uint8_t depth) {
+    if (ref & DECODE_LEAF) {
+        if (depth > table->max_length) {
+            table->max_length = depth;
+        }
+        return;
+    }
+    decode_depth(table, table->child[ref][0], (uint8_t) (depth + 1));
+    decode_depth(table, table->child[ref][1], (uint8_t) (depth + 1));
+}
+
+/*
+Read a tree in the huff_write_tree() format straight into table, without building Nodes, and fill
+in its lookup entries. Return false if the bits do not describe a tree of num_leaves leaves.
+*/
+bool decode_table_read(DecodeTable *table, BitSource *src, uint16_t num_leaves) {
+    uint16_t stack[64];
+    int top = -1;
+
+    if (num_leaves == 0 || num_leaves > 256) {
+        return false;
+    }
+
+    table->num_nodes = 0;
+    table->max_length = 0;
+    for (uint32_t i = 0; i < 2 * (uint32_t) num_leaves - 1; i++) {
+        if (bit_source_get(src, 1) == 1) {
+            if (top == 63) {
+                return false;
+            }
+            stack[++top] = (uint16_t) (DECODE_LEAF | bit_source_get(src, 8));
+        } else {
+            if (top < 1) {
+                return false;
+            }
+            uint16_t index = table->num_nodes++;
+            table->child[index][1] = stack[top--];
+            table->child[index][0] = stack[top];
+            stack[top] = index;
+        }
+    }
+    if (top != 0 || bit_source_overrun(src)) {
+        return false;
+    }
+
+    decode_depth(table, stack[0], 0);
+    if (table->max_length > 56) {
+        return false;
+    }
+    decode_fill(table, stack[0], 0, 0);
+    decode_fill_multi(table);
+    return true;
+}
+
+/*
+Build the table for the canonical code with the given lengths, as canonical_codes() assigns them,
+by threading each code into the flattened tree. Return false if a length is over
+CANONICAL_MAX_LENGTH or the codes collide. A code with room to spare is accepted, so a lone symbol
+can have a 1-bit code; the unused bit patterns decode as the first symbol.
+*/
+bool decode_table_lengths(DecodeTable *table, const uint8_t *lengths) {
+    const uint16_t empty = 0x7fff;
+    uint32_t codes[256];
+    uint16_t first = DECODE_LEAF;
+
+    for (int s = 0; s < 256; s++) {
+        if (lengths[s] > CANONICAL_MAX_LENGTH) {
+            return false;
+        }
+    }
+    canonical_codes(lengths, 256, codes);
+
+    table->num_nodes = 1;
+    table->max_length = 0;
+    table->child[0][0] = empty;
+    table->child[0][1] = empty;
+    for (int s = 0; s < 256; s++) {
+        uint32_t len = lengths[s];
+        if (len == 0) {
+            continue;
+        }
+        if (first == DECODE_LEAF) {
+            first = (uint16_t) (DECODE_LEAF | s);
+        }
+        if (len > table->max_length) {
+            table->max_length = (uint8_t) len;
+        }
+
+        uint16_t node = 0;
+        for (uint32_t d = 0; d + 1 < len; d++) {
+            uint16_t *next = &table->child[node][(codes[s] >> d) & 1];
+            if (*next == empty) {
+                if (table->num_nodes == 511) {
+                    return false;
+                }
+                *next = table->num_nodes++;
+                table->child[*next][0] = empty;
+                table->child[*next][1] = empty;
+            } else if (*next & DECODE_LEAF) {
+                return false;
+            }
+            node = *next;
+        }
+        uint16_t *leaf = &table->child[node][(codes[s] >> (len - 1)) & 1];
+        if (*leaf != empty) {
+            return false;
+        }
+        *leaf = (uint16_t) (DECODE_LEAF | s);
+    }
+
+    for (uint16_t i = 0; i < table->num_nodes; i++) {
+        for (int b = 0; b < 2; b++) {
+            if (table->child[i][b] == empty) {
+                table->child[i][b] = first;
+            }
+        }
+    }
+    decode_fill(table, 0, 0, 0);
+    decode_fill_multi(table);
+    return true;
+}
+
+void decode_table_free(DecodeTable **ptable) {
+    if (*ptable != NULL) {
+        free(*ptable);
+        *ptable = NULL;
+    }
+}
+
+/*
+Decode n symbols into out. If the table is worth it and there is room for DECODE_MULTI more
+symbols, one lookup in the multi entries resolves as many short codes as fit in DECODE_BITS bits;
+the rest, and any code longer than that, go through the single entries, finishing with a walk down
+the flattened tree. Inlined into each decode kernel, so that each is compiled for its own
+instruction set.
+*/
+static inline __attribute__((always_inline)) void decode_symbols_body(
+    BitSource *src, const DecodeTable *table, uint8_t *out, size_t n) {
+    const uint64_t mask = (1u << DECODE_BITS) - 1;
+    const uint32_t need = table->max_length > DECODE_BITS ? table->max_length : DECODE_BITS;
+    const size_t multi_end = table->use_multi && n >= DECODE_MULTI ? n - DECODE_MULTI + 1 : 0;
+    uint64_t acc = src->acc;
+    uint32_t nbits = src->nbits;
+    size_t i = 0;
+
+    while (i < multi_end) {
+        while (nbits < need) {
+            src->acc = acc;
+            src->nbits = nbits;
+            bit_source_refill(src);
+            acc = src->acc;
+            nbits = src->nbits;
+        }
+
+        uint32_t multi = table->multi[acc & mask];
+        uint32_t count = multi >> 28;
+        if (count > 0) {
+            uint32_t length = (multi >> 24) & 0xf;
+            out[i] = (uint8_t) multi;
+            out[i + 1] = (uint8_t) (multi >> 8);
+            out[i + 2] = (uint8_t) (multi >> 16);
+            acc >>= length;
+            nbits -= length;
+            i += count;
+            continue;
+        }
+
+        uint32_t entry = table->entry[acc & mask];
+        uint16_t ref = (uint16_t) entry;
+        acc >>= entry >> 16;
+        nbits -= entry >> 16;
+        while (!(ref & DECODE_LEAF)) {
+            ref = table->child[ref][acc & 1];
+            acc >>= 1;
+            nbits -= 1;
+        }
+        out[i++] = (uint8_t) ref;
+    }
+
+    for (; i < n; i++) {
+        while (nbits < table->max_length) {
+            src->acc = acc;
+            src->nbits = nbits;
+            bit_source_refill(src);
+            acc = src->acc;
+            nbits = src->nbits;
+        }
+
+        uint32_t entry = table->entry[acc & mask];
+        uint32_t length = entry >> 16;
+        uint16_t ref = (uint16_t) entry;
+        acc >>= length;
+        nbits -= length;
+
+        while (!(ref & DECODE_LEAF)) {
+            ref = table->child[ref][acc & 1];
+            acc >>= 1;
+            nbits -= 1;
+        }
+        out[i] = (uint8_t) ref;
+    }
+
+    src->acc = acc;
+    src->nbits = nbits;
+}
+
+void decode_symbols_generic(BitSource *src, const DecodeTable *table, uint8_t *out, size_t n) {
+    decode_symbols_body(src, table, out, n);
+}
+
+#ifdef DECODE_X86
+
+/*
+The decoder with BMI2, whose shrx shifts the accumulator by each code's length without going
+through cl.
+*/
+__attribute__((target("bmi2"))) void decode_symbols_bmi2(
+    BitSource *src, const DecodeTable *table, uint8_t *out, size_t n) {
+    decode_symbols_body(src, table, out, n);
+}
+
+static DecodeKernel decode_select_kernel(void) {
+    return (cpu_features() & CPU_BMI2) ? decode_symbols_bmi2 : decode_symbols_generic;
+}
+
+#else
+
+void decode_symbols_bmi2(BitSource *src, const DecodeTable *table, uint8_t *out, size_t n) {
+    decode_symbols_generic(src, table, out, n);
+}
+
+static DecodeKernel decode_select_kernel(void) {
+    return decode_symbols_generic;
+}
+
+#endif
+
+/*
+Decode n symbols into out with the kernel cpu_features() allows. Every kernel decodes the same
+symbols.
+*/
+void decode_symbols(BitSource *src, const DecodeTable *table, uint8_t *out, size_t n) {
+    decode_select_kernel()(src, table, out, n);
+}
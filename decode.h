@@ -0,0 +1,85 @@
+#ifndef _DECODE_H
+#define _DECODE_H
+
+/*
+* File:     decode.h
+* Purpose:  Header file for decode.c, the buffered bit source and the
+*           table-driven symbol decoder used by dehuff.
+*/
+
+#include "node.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+* Bits are consumed LSB first from acc, which is refilled a byte at a time
+* from [ptr, end).  A source opened on a stream refills that window from
+* the stream; a source initialized on a buffer stops at its end.  Reads
+* past the end return zero bits, which are counted in pad.
+*/
+typedef struct BitSource {
+    FILE *stream;
+    const uint8_t *ptr;
+    const uint8_t *end;
+    uint8_t *buf;
+    size_t cap;
+    uint64_t acc;
+    uint32_t nbits;
+    uint32_t pad;
+} BitSource;
+
+/*
+* Number of input bits resolved by one table lookup.
+*/
+#define DECODE_BITS 11
+
+/*
+* A lookup entry holds a symbol and its code length when the code fits in
+* DECODE_BITS, and otherwise the index of the tree node reached after
+* DECODE_BITS bits.  The tree is kept as a flat array of child pairs in
+* which a child with DECODE_LEAF set is a symbol.
+*/
+#define DECODE_LEAF 0x8000
+
+/*
+* A multi entry holds every code that fits whole in the same DECODE_BITS,
+* up to DECODE_MULTI of them: the symbols in bits 0-23, first in the low
+* byte, their combined length in bits 24-27 and their number in bits 28-29.
+* A number of zero means the first code is longer than DECODE_BITS.  When
+* codes are so long that a lookup would average under DECODE_MULTI_GAIN
+* symbols, use_multi is left false and the decoder skips the multi entries.
+*/
+#define DECODE_MULTI      3
+#define DECODE_MULTI_GAIN 1.25
+
+typedef struct DecodeTable {
+    uint32_t entry[1 << DECODE_BITS];
+    uint32_t multi[1 << DECODE_BITS];
+    uint16_t child[511][2];
+    uint16_t num_nodes;
+    uint8_t max_length;
+    bool use_multi;
+} DecodeTable;
+
+BitSource *bit_source_open(FILE *stream);
+void bit_source_close(BitSource **psrc);
+void bit_source_init(BitSource *src, const uint8_t *data, size_t size);
+void bit_source_refill(BitSource *src);
+uint64_t bit_source_get(BitSource *src, uint8_t length);
+void bit_source_align(BitSource *src);
+bool bit_source_overrun(const BitSource *src);
+bool bit_source_at_end(BitSource *src);
+size_t bit_source_read(BitSource *src, uint8_t *out, size_t n);
+
+DecodeTable *decode_table_create(const Node *tree);
+bool decode_table_read(DecodeTable *table, BitSource *src, uint16_t num_leaves);
+bool decode_table_lengths(DecodeTable *table, const uint8_t *lengths);
+void decode_table_free(DecodeTable **ptable);
+void decode_symbols(BitSource *src, const DecodeTable *table, uint8_t *out, size_t n);
+void decode_symbols_generic(BitSource *src, const DecodeTable *table, uint8_t *out, size_t n);
+void decode_symbols_bmi2(BitSource *src, const DecodeTable *table, uint8_t *out, size_t n);
+
+#endif
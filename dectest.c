@@ -0,0 +1,1246 @@
+/*
+* File:     dectest.c
+* Purpose:  Test decode.c, huffman.c, dict.c, canonical.c, adaptive.c,
+*           block.c, compact.c, lz77.c, filter.c, budget.c, rpc.c, walk.c,
+*           archive.c and batch.c
+*/
+
+#include "adaptive.h"
+#include "archive.h"
+#include "batch.h"
+#include "block.h"
+#include "budget.h"
+#include "canonical.h"
+#include "compact.h"
+#include "cpu.h"
+#include "decode.h"
+#include "dict.h"
+#include "encode.h"
+#include "filter.h"
+#include "frame.h"
+#include "huffman.h"
+#include "lz77.h"
+#include "rpc.h"
+#include "stream.h"
+#include "walk.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define N_SYMBOLS 200000
+
+static uint32_t rng_state = 4242;
+
+static uint32_t rng(void) {
+    rng_state = rng_state * 1103515245u + 12345u;
+    return rng_state >> 8;
+}
+
+/*
+* Encode in with a tree built from its own histogram, then decode it both
+* from memory and from a stream and compare.
+*/
+static void roundtrip(const uint8_t *in, size_t n, bool verbose) {
+    uint32_t histogram[256] = { 0 };
+    histogram[0x00] = 1;
+    histogram[0xff] = 1;
+    for (size_t i = 0; i < n; i++) {
+        ++histogram[in[i]];
+    }
+
+    uint16_t num_leaves = 0;
+    Node *tree = create_tree(histogram, &num_leaves);
+    Code codes[256] = { { 0, 0 } };
+    fill_code_table(codes, tree, 0, 0);
+
+    EncodeTable etable;
+    encode_table_init(&etable, codes);
+    BitSink *sink = bit_sink_open(NULL);
+    assert(sink);
+    bit_sink_put(sink, num_leaves, 16);
+    huff_write_tree(sink, tree);
+    encode_symbols(sink, &etable, in, n);
+    bit_sink_flush(sink);
+    assert(huff_cost(histogram, codes) >= n);
+
+    /*
+    * From memory.
+    */
+    BitSource src;
+    bit_source_init(&src, sink->buf, sink->pos);
+    uint16_t leaves = (uint16_t) bit_source_get(&src, 16);
+    assert(leaves == num_leaves);
+    Node *copy = huff_read_tree(&src, leaves);
+    DecodeTable *table = decode_table_create(copy);
+    assert(table);
+    if (verbose)
+        printf("%u leaves, max length %u, %zu -> %zu bytes\n", num_leaves, table->max_length, n,
+            sink->pos);
+
+    uint8_t *out = (uint8_t *) malloc(n);
+    assert(out);
+    decode_symbols(&src, table, out, n);
+    assert(memcmp(in, out, n) == 0);
+    assert(!bit_source_overrun(&src));
+
+    /*
+    * Each kernel the CPU allows decodes the same symbols.
+    */
+    void (*kernels[])(BitSource *, const DecodeTable *, uint8_t *, size_t) = {
+        decode_symbols_generic, decode_symbols_bmi2 };
+    for (size_t k = 0; k < 2; k++) {
+        if (k == 1 && !(cpu_features() & CPU_BMI2))
+            continue;
+        BitSource again;
+        bit_source_init(&again, sink->buf, sink->pos);
+        assert(bit_source_get(&again, 16) == num_leaves);
+        Node *skipped = huff_read_tree(&again, num_leaves);
+        memset(out, 0, n);
+        kernels[k](&again, table, out, n);
+        assert(memcmp(in, out, n) == 0);
+        assert(!bit_source_overrun(&again));
+        node_free(&skipped);
+    }
+
+    /*
+    * One symbol too many reads past the end.
+    */
+    uint8_t extra[64];
+    decode_symbols(&src, table, extra, 64);
+    assert(bit_source_overrun(&src));
+
+    /*
+    * From a stream, in uneven pieces.
+    */
+    FILE *f = tmpfile();
+    assert(f);
+    assert(fwrite(sink->buf, 1, sink->pos, f) == sink->pos);
+    rewind(f);
+    BitSource *fsrc = bit_source_open(f);
+    assert(fsrc);
+    assert(bit_source_get(fsrc, 16) == num_leaves);
+    Node *copy2 = huff_read_tree(fsrc, num_leaves);
+    memset(out, 0, n);
+    size_t done = 0;
+    size_t piece = 1;
+    while (done < n) {
+        size_t k = (n - done < piece) ? n - done : piece;
+        decode_symbols(fsrc, table, out + done, k);
+        done += k;
+        piece = piece * 5 + 3;
+    }
+    assert(memcmp(in, out, n) == 0);
+    assert(!bit_source_overrun(fsrc));
+    assert(bit_source_at_end(fsrc));
+    bit_source_close(&fsrc);
+
+    /*
+    * A byte after the frame is noticed.
+    */
+    assert(fputc(0, f) != EOF);
+    rewind(f);
+    fsrc = bit_source_open(f);
+    assert(fsrc);
+    assert(bit_source_get(fsrc, 16) == num_leaves);
+    Node *copy3 = huff_read_tree(fsrc, num_leaves);
+    decode_symbols(fsrc, table, out, n);
+    assert(memcmp(in, out, n) == 0);
+    assert(!bit_source_at_end(fsrc));
+    bit_source_close(&fsrc);
+    node_free(&copy3);
+    fclose(f);
+
+    free(out);
+    decode_table_free(&table);
+    assert(table == NULL);
+    node_free(&tree);
+    node_free(&copy);
+    node_free(&copy2);
+    bit_sink_close(&sink);
+}
+
+/*
+* Code in with the adaptive model and decode it from memory, then from a
+* pipe that at first holds only half of the stream: the decoder has to hand
+* back what the first half holds without waiting for the rest.
+*/
+static void adaptive_roundtrip(const uint8_t *in, size_t n, bool verbose) {
+    AdaptiveModel *model = adaptive_create(false);
+    assert(model);
+    BitSink *sink = bit_sink_open(NULL);
+    assert(sink);
+    adaptive_encode(model, sink, in, n / 3);
+    adaptive_encode(model, sink, in + n / 3, n - n / 3);
+    adaptive_finish(model, sink);
+    bit_sink_flush(sink);
+    adaptive_free(&model);
+    if (verbose)
+        printf("adaptive: %zu -> %zu bytes\n", n, sink->pos);
+
+    uint8_t *out = (uint8_t *) malloc(n + 1);
+    assert(out);
+    BitSource src;
+    bit_source_init(&src, sink->buf, sink->pos);
+    model = adaptive_create(true);
+    assert(model);
+    size_t done = 0;
+    AdaptiveStatus status = ADAPTIVE_MORE;
+    while (status == ADAPTIVE_MORE) {
+        size_t k;
+        status = adaptive_decode(model, &src, out + done, 1000, &k);
+        done += k;
+    }
+    assert(status == ADAPTIVE_DONE);
+    assert(done == n);
+    assert(memcmp(in, out, n) == 0);
+    adaptive_free(&model);
+
+    /*
+    * Truncated input is an error, not an early end.
+    */
+    bit_source_init(&src, sink->buf, sink->pos / 2);
+    model = adaptive_create(true);
+    done = 0;
+    do {
+        size_t k;
+        status = adaptive_decode(model, &src, out, n + 1, &k);
+        done += k;
+    } while (status == ADAPTIVE_MORE);
+    assert(status == ADAPTIVE_ERROR);
+    adaptive_free(&model);
+
+    if (n > 0 && sink->pos < 32768) {
+        int fds[2];
+        assert(pipe(fds) == 0);
+        size_t half = sink->pos / 2;
+        assert(write(fds[1], sink->buf, half) == (ssize_t) half);
+        FILE *f = fdopen(fds[0], "rb");
+        assert(f);
+        BitSource *fsrc = bit_source_open(f);
+        assert(fsrc);
+        assert(bit_source_get(fsrc, 0) == 0);
+        model = adaptive_create(true);
+        size_t k;
+        status = adaptive_decode(model, fsrc, out, n + 1, &k);
+        assert(status == ADAPTIVE_MORE);
+        assert(k > 0 && k < n);
+        assert(memcmp(in, out, k) == 0);
+
+        assert(write(fds[1], sink->buf + half, sink->pos - half) == (ssize_t) (sink->pos - half));
+        close(fds[1]);
+        done = k;
+        while (status == ADAPTIVE_MORE) {
+            status = adaptive_decode(model, fsrc, out + done, n + 1 - done, &k);
+            done += k;
+        }
+        assert(status == ADAPTIVE_DONE);
+        assert(done == n);
+        assert(memcmp(in, out, n) == 0);
+        adaptive_free(&model);
+        bit_source_close(&fsrc);
+        fclose(f);
+    }
+
+    free(out);
+    bit_sink_close(&sink);
+}
+
+/*
+* Lengths from canonical_lengths() must be a complete code within the
+* limit, and canonical codes must decode back to their symbols.
+*/
+static void canonical_check(const uint32_t *freq, uint32_t n, uint8_t max_length) {
+    uint8_t *lengths = (uint8_t *) malloc(n);
+    uint32_t *codes = (uint32_t *) malloc(n * sizeof(uint32_t));
+    assert(lengths && codes);
+    canonical_lengths(freq, n, max_length, lengths);
+    canonical_codes(lengths, n, codes);
+
+    uint64_t kraft = 0;
+    uint32_t used = 0;
+    for (uint32_t s = 0; s < n; s++) {
+        assert(lengths[s] <= max_length);
+        assert((lengths[s] == 0) == (freq[s] == 0));
+        if (lengths[s] > 0) {
+            kraft += (uint64_t) 1 << (max_length - lengths[s]);
+            used++;
+        }
+    }
+    assert(used < 2 || kraft == (uint64_t) 1 << max_length);
+
+    CanonicalTable *table = canonical_table_create(n);
+    assert(table);
+    assert(canonical_table_build(table, lengths));
+    BitSink *sink = bit_sink_open(NULL);
+    assert(sink);
+    for (uint32_t s = 0; s < n; s++) {
+        if (lengths[s] > 0) {
+            bit_sink_put(sink, codes[s], lengths[s]);
+        }
+    }
+    bit_sink_flush(sink);
+    BitSource src;
+    bit_source_init(&src, sink->buf, sink->pos);
+    for (uint32_t s = 0; s < n; s++) {
+        if (lengths[s] > 0) {
+            bit_source_refill(&src);
+            assert(canonical_decode(&src, table) == s);
+        }
+    }
+    assert(!bit_source_overrun(&src));
+
+    bit_sink_close(&sink);
+    canonical_table_free(&table);
+    free(lengths);
+    free(codes);
+}
+
+/*
+* Code in as blocks of block_size bytes and decode them again. Returns the
+* number of blocks that reused a table.
+*/
+static uint64_t block_roundtrip(const uint8_t *in, size_t n, uint32_t block_size) {
+    BlockEncoder *enc = block_encoder_create();
+    assert(enc);
+    BitSink *sink = bit_sink_open(NULL);
+    assert(sink);
+    BlockEncoder *estimator = block_encoder_create();
+    assert(estimator);
+    uint64_t estimate = 2;
+    bit_sink_put(sink, 'B', 8);
+    for (size_t i = 0; i < n; i += block_size) {
+        uint32_t k = (uint32_t) (n - i < block_size ? n - i : block_size);
+        block_encode(enc, sink, in + i, k);
+        estimate += block_estimate(estimator, in + i, k);
+    }
+    block_finish(sink);
+    bit_sink_flush(sink);
+    uint64_t reused = enc->reused;
+    assert(estimate == sink->pos && estimator->reused == reused && estimator->ans == enc->ans);
+    block_encoder_free(&enc);
+    block_encoder_free(&estimator);
+
+    uint8_t *out = (uint8_t *) malloc(n + 1);
+    assert(out);
+    BitSource src;
+    bit_source_init(&src, sink->buf, sink->pos);
+    assert(bit_source_get(&src, 8) == 'B');
+    DecodeTable *table = NULL;
+    AnsTable *ans = NULL;
+    uint32_t state[ANS_STATES];
+    BlockHeader header;
+    size_t done = 0;
+    uint64_t reuse_headers = 0;
+    while (block_read_header(&src, &table, &header) == NULL && header.type != BLOCK_END) {
+        assert(done + header.size <= n);
+        if (block_is_ans(header.type)) {
+            assert(block_read_ans(&src, header.type, &ans, state) == NULL);
+            ans_decode(&src, ans, state, out + done, header.size);
+            assert(state[0] == 0 && state[1] == 0);
+        } else {
+            decode_symbols(&src, table, out + done, header.size);
+        }
+        done += header.size;
+        reuse_headers += header.type == BLOCK_REUSE || header.type == BLOCK_ANS_REUSE;
+    }
+    assert(header.type == BLOCK_END);
+    assert(!bit_source_overrun(&src));
+    assert(done == n);
+    assert(memcmp(in, out, n) == 0);
+    assert(reuse_headers == reused);
+
+    /*
+    * Again as dehuff -j reads it: each payload copied out whole, its tree
+    * read from the copy.
+    */
+    bit_source_init(&src, sink->buf, sink->pos);
+    assert(bit_source_get(&src, 8) == 'B');
+    memset(out, 0, n);
+    done = 0;
+    uint8_t *payload = (uint8_t *) malloc(sink->pos);
+    assert(payload);
+    while (block_read_fields(&src, &header) == NULL && header.type != BLOCK_END) {
+        assert(bit_source_read(&src, payload, header.payload) == header.payload);
+        BitSource block;
+        bit_source_init(&block, payload, header.payload);
+        if (header.type == BLOCK_FRESH) {
+            assert(block_read_table(&block, &table) == NULL);
+        }
+        if (block_is_ans(header.type)) {
+            assert(block_read_ans(&block, header.type, &ans, state) == NULL);
+            ans_decode(&block, ans, state, out + done, header.size);
+        } else {
+            decode_symbols(&block, table, out + done, header.size);
+        }
+        assert(!bit_source_overrun(&block));
+        done += header.size;
+    }
+    assert(header.type == BLOCK_END);
+    assert(bit_source_at_end(&src));
+    assert(done == n);
+    assert(memcmp(in, out, n) == 0);
+    free(payload);
+
+    decode_table_free(&table);
+    free(ans);
+    free(out);
+    bit_sink_close(&sink);
+    return reused;
+}
+
+/*
+* Compress in as a compact frame and as an 'HC' frame, check that the
+* compact one decodes, and return how many bytes smaller it is.
+*/
+static long compact_roundtrip(const uint8_t *in, size_t n, bool verbose) {
+    BitSink *sink = bit_sink_open(NULL);
+    assert(sink);
+    frame_compress(sink, in, (uint32_t) n, NULL);
+    bit_sink_flush(sink);
+    long tree_size = (long) sink->pos;
+
+    /*
+    * The estimates are exact.
+    */
+    BitSink *scratch = bit_sink_open(NULL);
+    assert(scratch);
+    uint32_t histogram[256];
+    fill_histogram_buffer(in, (uint32_t) n, histogram);
+    assert(frame_estimate(histogram, NULL, (uint32_t) n, NULL, 0, scratch) == sink->pos);
+
+    bit_sink_reset(sink, NULL);
+    frame_compress_compact(sink, in, (uint32_t) n);
+    bit_sink_flush(sink);
+    assert(frame_estimate(histogram, NULL, (uint32_t) n, NULL, 1, scratch) == sink->pos);
+    bit_sink_close(&scratch);
+    if (verbose)
+        printf("compact: %zu bytes -> %zu, 'HC' %ld\n", n, sink->pos, tree_size);
+
+    BitSource src;
+    FrameHeader header = { 0 };
+    bit_source_init(&src, sink->buf, sink->pos);
+    assert(frame_read_header(&src, NULL, &header) == NULL);
+    assert(header.type == 'K');
+    assert(header.filesize == n);
+    uint8_t *out = (uint8_t *) malloc(n + 1);
+    assert(out);
+    decode_symbols(&src, header.table, out, n);
+    assert(memcmp(in, out, n) == 0);
+    assert(!bit_source_overrun(&src));
+
+    frame_header_free(&header);
+    free(out);
+    long saved = tree_size - (long) sink->pos;
+    bit_sink_close(&sink);
+    return saved;
+}
+
+/*
+* Compress in as an LZ77 frame with the given window, check that it decodes
+* and that every truncation of it is refused, and return its size.
+*/
+static size_t lz_roundtrip(const uint8_t *in, size_t n, uint8_t window_bits, bool verbose) {
+    BitSink *sink = bit_sink_open(NULL);
+    assert(sink);
+    frame_compress_lz(sink, in, (uint32_t) n, window_bits);
+    bit_sink_flush(sink);
+    if (verbose)
+        printf("lz77: %zu bytes -> %zu, window %u\n", n, sink->pos, window_bits);
+
+    uint8_t *out = (uint8_t *) malloc(n + 1);
+    assert(out);
+    BitSource src;
+    FrameHeader header = { 0 };
+    bit_source_init(&src, sink->buf, sink->pos);
+    assert(frame_read_header(&src, NULL, &header) == NULL);
+    assert(header.type == 'L' && header.filesize == n);
+    assert(lz_decompress(&src, out, n) == NULL);
+    assert(memcmp(in, out, n) == 0);
+
+    if (n > 0) {
+        bit_source_init(&src, sink->buf, sink->pos / 2);
+        assert(frame_read_header(&src, NULL, &header) == NULL);
+        assert(lz_decompress(&src, out, n) != NULL);
+    }
+
+    free(out);
+    size_t size = sink->pos;
+    bit_sink_close(&sink);
+    return size;
+}
+
+/*
+* Compress in as a filtered frame, check that it decodes, and return its
+* size.
+*/
+static size_t filter_roundtrip(const uint8_t *in, size_t n, uint8_t filters, uint8_t stride) {
+    BitSink *sink = bit_sink_open(NULL);
+    assert(sink);
+    frame_compress_filtered(sink, in, (uint32_t) n, filters, stride);
+    bit_sink_flush(sink);
+
+    uint8_t *scratch = (uint8_t *) malloc(n + 1);
+    uint8_t *out = (uint8_t *) malloc(n + 1);
+    assert(scratch && out);
+    BitSource src;
+    FrameHeader header = { 0 };
+    bit_source_init(&src, sink->buf, sink->pos);
+    assert(frame_read_header(&src, NULL, &header) == NULL);
+    assert(header.type == 'F' && header.filesize == n);
+    assert(header.filters == filters && header.stride == stride);
+    assert(frame_decompress_filtered(&src, &header, scratch, out) == NULL);
+    assert(memcmp(in, out, n) == 0);
+
+    free(scratch);
+    free(out);
+    size_t size = sink->pos;
+    bit_sink_close(&sink);
+    return size;
+}
+
+/*
+* Compress n bytes from in as a frame of 16-bit symbols and check it decodes
+* to the same bytes, and that it fails cleanly when cut short.  Return the
+* compressed size.
+*/
+static size_t wide_roundtrip(const uint8_t *in, size_t n) {
+    BitSink *sink = bit_sink_open(NULL);
+    assert(sink);
+    frame_compress_wide(sink, in, (uint32_t) n);
+    bit_sink_flush(sink);
+
+    uint8_t *out = (uint8_t *) malloc(n + 1);
+    assert(out);
+    BitSource src;
+    FrameHeader header = { 0 };
+    bit_source_init(&src, sink->buf, sink->pos);
+    assert(frame_read_header(&src, NULL, &header) == NULL);
+    assert(header.type == 'W' && header.filesize == n);
+    assert(frame_decompress_wide(&src, header.filesize, out) == NULL);
+    assert(memcmp(in, out, n) == 0);
+
+    bit_source_init(&src, sink->buf, sink->pos / 2);
+    if (frame_read_header(&src, NULL, &header) == NULL) {
+        assert(n < 2 || frame_decompress_wide(&src, header.filesize, out) != NULL);
+    }
+
+    free(out);
+    size_t size = sink->pos;
+    bit_sink_close(&sink);
+    return size;
+}
+
+/*
+* Feed frame to a stream decoder piece pieces at a time and drain it into
+* cap bytes at a time, and check it gives the n bytes of expect.
+*/
+static void stream_feed_check(const uint8_t *frame, size_t size, const uint8_t *expect, size_t n,
+    const Dictionary *dict, size_t piece, size_t cap) {
+    DehuffStream *ctx = dehuff_stream_create(dict);
+    assert(ctx);
+    uint8_t *out = (uint8_t *) malloc(n + cap);
+    assert(out);
+    size_t fed = 0;
+    size_t done = 0;
+    while (fed < size || ctx->status == DEHUFF_STREAM_MORE) {
+        size_t k = size - fed < piece ? size - fed : piece;
+        assert(dehuff_stream_feed(ctx, frame + fed, k));
+        fed += k;
+        size_t got;
+        while ((got = dehuff_stream_drain(ctx, out + done, cap)) > 0)
+            done += got;
+        assert(ctx->status != DEHUFF_STREAM_ERROR);
+        if (fed == size)
+            break;
+    }
+    assert(dehuff_stream_finish(ctx) == DEHUFF_STREAM_DONE);
+    assert(done == n && memcmp(out, expect, n) == 0);
+    assert(!dehuff_stream_feed(ctx, frame, 1));
+    assert(ctx->status == DEHUFF_STREAM_ERROR);
+    dehuff_stream_free(&ctx);
+    assert(ctx == NULL);
+    free(out);
+}
+
+/*
+* The stream decoder gives the same bytes however its input and output are
+* cut, and a frame cut short is reported as truncated.
+*/
+static void stream_check(const uint8_t *frame, size_t size, const uint8_t *expect, size_t n,
+    const Dictionary *dict) {
+    const size_t pieces[] = { 1, 3, 64, 4093, size };
+    const size_t caps[] = { 1, 777, n + 1 };
+    for (size_t p = 0; p < sizeof(pieces) / sizeof(pieces[0]); p++)
+        for (size_t c = 0; c < sizeof(caps) / sizeof(caps[0]); c++)
+            if (pieces[p] > 3 || size < 20000)
+                stream_feed_check(frame, size, expect, n, dict, pieces[p], caps[c]);
+
+    DehuffStream *ctx = dehuff_stream_create(dict);
+    assert(ctx);
+    uint8_t *out = (uint8_t *) malloc(n + 1);
+    assert(out);
+    assert(dehuff_stream_feed(ctx, frame, size - 1));
+    assert(dehuff_stream_drain(ctx, out, n + 1) <= n);
+    assert(dehuff_stream_finish(ctx) == DEHUFF_STREAM_ERROR);
+    free(out);
+    dehuff_stream_free(&ctx);
+}
+
+/*
+* Histogram a temporary file of n bytes from in, sampling sample_bytes of it,
+* and check the estimate against the exact counts.
+*/
+static void sample_check(const uint8_t *in, size_t n, uint64_t sample_bytes) {
+    FILE *f = tmpfile();
+    assert(f);
+    assert(fwrite(in, 1, n, f) == n);
+    fflush(f);
+    rewind(f);
+
+    uint32_t exact[256];
+    uint32_t sampled_hist[256];
+    uint64_t sampled;
+    assert(fill_histogram(f, exact) == n);
+    assert(fill_histogram_sampled(f, sampled_hist, sample_bytes, &sampled) == n);
+    assert(ftell(f) == 0);
+
+    if (sampled == n) {
+        assert(memcmp(exact, sampled_hist, sizeof(exact)) == 0);
+    } else {
+        assert(sampled <= sample_bytes && sampled < n);
+        for (int i = 0; i < 256; i++)
+            assert(sampled_hist[i] > 0);
+    }
+    fclose(f);
+}
+
+int main(int argc, char **argv) {
+    /*
+    * Poor man's argument checking: is "-v" the first command-line argument?
+    * Ignore all other arguments.
+    */
+    bool verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+
+    if (!verbose)
+        printf("Use \"dectest -v\" to print trace information.\n");
+
+    uint8_t *in = (uint8_t *) malloc(N_SYMBOLS);
+    assert(in);
+
+    /*
+    * Uniform bytes, a few symbols, and a geometric distribution whose rare
+    * symbols have codes much longer than DECODE_BITS.
+    */
+    for (size_t i = 0; i < N_SYMBOLS; i++)
+        in[i] = (uint8_t) rng();
+    roundtrip(in, N_SYMBOLS, verbose);
+
+    for (size_t i = 0; i < N_SYMBOLS; i++)
+        in[i] = (uint8_t) ('a' + rng() % 3);
+    roundtrip(in, N_SYMBOLS, verbose);
+
+    for (size_t i = 0; i < N_SYMBOLS; i++) {
+        uint32_t r = rng() | 0x80000000u;
+        int s = 0;
+        while ((r & 1) == 0 && s < 40) {
+            r = (r >> 1) | 0x80000000u;
+            s++;
+        }
+        uint32_t bits = rng();
+        in[i] = (uint8_t) (s < 24 ? (uint32_t) s * 9 + 1 : bits);
+        if (rng() % 2)
+            in[i] = (uint8_t) (1 + (bits % 3));
+    }
+    roundtrip(in, N_SYMBOLS, verbose);
+    roundtrip(in, 1, verbose);
+    adaptive_roundtrip(in, N_SYMBOLS, verbose);
+    adaptive_roundtrip(in, 20000, verbose);
+    adaptive_roundtrip(in, 0, verbose);
+
+    /*
+    * Steady statistics reuse tables; a change of alphabet forces new ones.
+    */
+    for (size_t i = 0; i < N_SYMBOLS; i++) {
+        uint32_t r = rng() | 0x200;
+        int s = 0;
+        while ((r & 1) == 0) {
+            r >>= 1;
+            s++;
+        }
+        in[i] = (uint8_t) ('0' + s);
+    }
+    assert(block_roundtrip(in, N_SYMBOLS, 10000) == 19);
+    for (size_t i = N_SYMBOLS / 2; i < N_SYMBOLS; i++)
+        in[i] = (uint8_t) ('a' + rng() % 26);
+    uint64_t reused = block_roundtrip(in, N_SYMBOLS, 10000);
+    assert(reused == 18);
+    assert(block_roundtrip(in, 0, 10000) == 0);
+    assert(block_roundtrip(in, 777, 100) >= 1);
+
+    /*
+    * A byte that fills most of a block costs a Huffman code a whole bit but
+    * ANS a fraction of one. Blocks that keep to the same mix reuse the first
+    * one's ANS table, just as the digits above reuse a Huffman table.
+    */
+    for (size_t i = 0; i < N_SYMBOLS; i++)
+        in[i] = (uint8_t) (rng() % 16 ? ' ' : 'a' + rng() % 4);
+    BlockEncoder *skewed = block_encoder_create();
+    BitSink *skewed_sink = bit_sink_open(NULL);
+    assert(skewed && skewed_sink);
+    block_encode(skewed, skewed_sink, in, 10000);
+    assert(skewed->ans == 1 && skewed_sink->pos < 10000 / 8);
+    block_encoder_free(&skewed);
+    bit_sink_close(&skewed_sink);
+    assert(block_roundtrip(in, N_SYMBOLS, 10000) == 19);
+    for (size_t i = 0; i < N_SYMBOLS; i++) {
+        if (i / 10000 == 3)
+            continue;
+        uint32_t r = rng() | 0x200;
+        int s = 0;
+        while ((r & 1) == 0) {
+            r >>= 1;
+            s++;
+        }
+        in[i] = (uint8_t) ('0' + s);
+    }
+    assert(block_roundtrip(in, N_SYMBOLS, 10000) == 18);
+    memset(in, 'x', 30000);
+    assert(block_roundtrip(in, 30000, 10000) == 2);
+
+    /*
+    * Small files are counted exactly; larger ones from a sample that still
+    * gives every byte a code.
+    */
+    sample_check(in, N_SYMBOLS, 2 * SAMPLE_CHUNK);
+    sample_check(in, 1000, 1);
+    sample_check(in, N_SYMBOLS, N_SYMBOLS);
+
+    /*
+    * Compact headers win most on short messages.
+    */
+    const char *message = "{\"id\":1234,\"status\":\"ok\",\"items\":[3,1,4,1,5,9,2,6]}";
+    assert(compact_roundtrip((const uint8_t *) message, strlen(message), verbose) >= 10);
+    assert(compact_roundtrip((const uint8_t *) "aaaa", 4, verbose) > 0);
+    assert(compact_roundtrip((const uint8_t *) "", 0, verbose) > 0);
+    assert(compact_roundtrip(in, N_SYMBOLS, verbose) > 0);
+    for (size_t i = 0; i < 5000; i++)
+        in[i] = (uint8_t) rng();
+    compact_roundtrip(in, 5000, verbose);
+
+    /*
+    * Repeated lines shrink far below what byte statistics alone give, runs
+    * become matches of distance one, and data without repeats costs
+    * little more than it does in an 'HC' frame.
+    */
+    size_t line_bytes = 0;
+    for (uint32_t line = 0; line_bytes + 80 < N_SYMBOLS; line++) {
+        line_bytes += (size_t) sprintf((char *) in + line_bytes,
+            "2024-05-%02u 12:%02u:%02u host-%u GET /api/v1/items/%u 200\n", 1 + line / 3000,
+            line / 60 % 60, line % 60, rng() % 8, rng() % 1000);
+    }
+    BitSink *tree_sink = bit_sink_open(NULL);
+    assert(tree_sink);
+    frame_compress(tree_sink, in, (uint32_t) line_bytes, NULL);
+    bit_sink_flush(tree_sink);
+    assert(lz_roundtrip(in, line_bytes, LZ_DEFAULT_WINDOW, verbose) * 2 < tree_sink->pos);
+    bit_sink_close(&tree_sink);
+    lz_roundtrip(in, line_bytes, LZ_MIN_WINDOW, verbose);
+    lz_roundtrip(in, line_bytes, LZ_MAX_WINDOW, verbose);
+    memset(in, 'x', 100000);
+    assert(lz_roundtrip(in, 100000, LZ_DEFAULT_WINDOW, verbose) < 1000);
+    for (size_t i = 0; i < N_SYMBOLS; i++)
+        in[i] = (uint8_t) rng();
+    assert(lz_roundtrip(in, N_SYMBOLS, LZ_DEFAULT_WINDOW, verbose) < N_SYMBOLS + N_SYMBOLS / 100);
+    lz_roundtrip(in, 1, LZ_DEFAULT_WINDOW, verbose);
+    lz_roundtrip(in, 0, LZ_DEFAULT_WINDOW, verbose);
+
+    /*
+    * Filters invert for every stride and for lengths that leave a tail,
+    * and a slowly rising 64-bit counter codes to a fraction of its 'HC'
+    * size once differenced and split into planes.
+    */
+    uint8_t parsed_filters, parsed_stride;
+    assert(filter_parse("delta+shuffle:4", &parsed_filters, &parsed_stride));
+    assert(parsed_filters == (FILTER_DELTA | FILTER_SHUFFLE) && parsed_stride == 4);
+    assert(!filter_parse("delta:3", &parsed_filters, &parsed_stride));
+    assert(!filter_parse("shuffle:", &parsed_filters, &parsed_stride));
+    uint8_t *filtered = (uint8_t *) malloc(N_SYMBOLS);
+    uint8_t *unfiltered = (uint8_t *) malloc(N_SYMBOLS);
+    assert(filtered && unfiltered);
+    for (size_t i = 0; i < N_SYMBOLS; i++)
+        in[i] = (uint8_t) rng();
+    for (uint8_t filters = 0; filters <= (FILTER_DELTA | FILTER_SHUFFLE); filters++) {
+        for (uint8_t stride = 1; stride <= FILTER_MAX_STRIDE; stride *= 2) {
+            const size_t sizes[] = { 0, 1, 7, 131, 1000, N_SYMBOLS - 5 };
+            for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+                filter_apply(filters, stride, in, filtered, sizes[k]);
+                filter_invert(filters, stride, filtered, unfiltered, sizes[k]);
+                assert(memcmp(in, unfiltered, sizes[k]) == 0);
+            }
+            filter_roundtrip(in, 1001, filters, stride);
+        }
+    }
+    free(filtered);
+    free(unfiltered);
+
+    /*
+    * A plane codes only the bytes it holds, so one that holds a single value
+    * still decodes, at one bit per byte.
+    */
+    memset(in, 'a', 8000);
+    assert(filter_roundtrip(in, 8000, FILTER_SHUFFLE, 8) < 8 * (1000 / 8 + 16));
+    assert(filter_roundtrip(in, 8000, FILTER_DELTA, 1) < 1000 + 32);
+
+    uint64_t counter = 1000000000000ull;
+    for (size_t i = 0; i + 8 <= N_SYMBOLS; i += 8) {
+        counter += rng() % 5000;
+        for (int b = 0; b < 8; b++)
+            in[i + (size_t) b] = (uint8_t) (counter >> (8 * b));
+    }
+    BitSink *counter_sink = bit_sink_open(NULL);
+    assert(counter_sink);
+    frame_compress(counter_sink, in, N_SYMBOLS, NULL);
+    bit_sink_flush(counter_sink);
+    size_t counter_filtered = filter_roundtrip(in, N_SYMBOLS, FILTER_DELTA | FILTER_SHUFFLE, 8);
+    if (verbose)
+        printf("filter: %d bytes -> %zu, 'HC' %zu\n", N_SYMBOLS, counter_filtered,
+            counter_sink->pos);
+    assert(counter_filtered * 2 < counter_sink->pos);
+    bit_sink_close(&counter_sink);
+
+    /*
+    * 16-bit symbols: any size, every value (codes longer than CANONICAL_BITS),
+    * a few values (the fast path), and samples whose high and low bytes a
+    * byte code cannot see together.
+    */
+    for (size_t i = 0; i < N_SYMBOLS; i++)
+        in[i] = (uint8_t) rng();
+    const size_t wide_sizes[] = { 0, 1, 2, 3, 1001, N_SYMBOLS };
+    for (size_t k = 0; k < sizeof(wide_sizes) / sizeof(wide_sizes[0]); k++)
+        wide_roundtrip(in, wide_sizes[k]);
+    for (size_t i = 0; i < N_SYMBOLS; i++)
+        in[i] = i % 2 ? 0 : (uint8_t) ('a' + rng() % 5);
+    wide_roundtrip(in, N_SYMBOLS - 1);
+    int32_t sample = 0;
+    for (size_t i = 0; i + 2 <= N_SYMBOLS; i += 2) {
+        sample += (int32_t) (rng() % 61) - 30;
+        in[i] = (uint8_t) sample;
+        in[i + 1] = (uint8_t) ((uint32_t) sample >> 8);
+    }
+    BitSink *sample_sink = bit_sink_open(NULL);
+    assert(sample_sink);
+    frame_compress(sample_sink, in, N_SYMBOLS, NULL);
+    bit_sink_flush(sample_sink);
+    size_t sample_wide = wide_roundtrip(in, N_SYMBOLS);
+    if (verbose)
+        printf("wide: %d bytes -> %zu, 'HC' %zu\n", N_SYMBOLS, sample_wide, sample_sink->pos);
+    assert(sample_wide < sample_sink->pos);
+    bit_sink_close(&sample_sink);
+
+    /*
+    * Streams of 'C' and 'K' frames: long codes, few symbols, one symbol.
+    */
+    BitSink *stream_sink = bit_sink_open(NULL);
+    assert(stream_sink);
+    for (size_t i = 0; i < N_SYMBOLS; i++) {
+        uint32_t r = rng() | 0x80000000u;
+        int bit = 0;
+        while ((r & 1) == 0 && bit < 30) {
+            r = (r >> 1) | 0x80000000u;
+            bit++;
+        }
+        in[i] = (uint8_t) bit;
+    }
+    for (int round = 0; round < 3; round++) {
+        size_t n = round == 2 ? 5000 : 60000;
+        if (round == 1) {
+            for (size_t i = 0; i < n; i++)
+                in[i] = (uint8_t) ('a' + rng() % 3);
+        } else if (round == 2) {
+            memset(in, 'q', n);
+        }
+        bit_sink_reset(stream_sink, NULL);
+        frame_compress(stream_sink, in, (uint32_t) n, NULL);
+        bit_sink_flush(stream_sink);
+        stream_check(stream_sink->buf, stream_sink->pos, in, n, NULL);
+        bit_sink_reset(stream_sink, NULL);
+        frame_compress_compact(stream_sink, in, (uint32_t) n);
+        bit_sink_flush(stream_sink);
+        stream_check(stream_sink->buf, stream_sink->pos, in, n, NULL);
+    }
+    bit_sink_close(&stream_sink);
+
+    /*
+    * Code lengths for alphabets other than bytes come back as they went.
+    */
+    uint8_t wide[LZ_LITLEN_SYMBOLS] = { 0 };
+    uint8_t wide_back[LZ_LITLEN_SYMBOLS];
+    wide[0] = 2;
+    wide[LZ_END] = 2;
+    wide[LZ_LITLEN_SYMBOLS - 1] = 1;
+    BitSink *wide_sink = bit_sink_open(NULL);
+    assert(wide_sink);
+    compact_write_lengths_n(wide_sink, wide, LZ_LITLEN_SYMBOLS);
+    bit_sink_flush(wide_sink);
+    BitSource wide_src;
+    bit_source_init(&wide_src, wide_sink->buf, wide_sink->pos);
+    assert(compact_read_lengths_n(&wide_src, wide_back, LZ_LITLEN_SYMBOLS));
+    assert(memcmp(wide, wide_back, sizeof(wide)) == 0);
+    bit_sink_close(&wide_sink);
+
+    /*
+    * Lengths that oversubscribe the code are refused.
+    */
+    uint8_t lengths[256] = { 0 };
+    lengths['a'] = 1;
+    lengths['b'] = 1;
+    DecodeTable *dtable = (DecodeTable *) malloc(sizeof(DecodeTable));
+    assert(dtable);
+    assert(decode_table_lengths(dtable, lengths));
+    lengths['c'] = 2;
+    assert(!decode_table_lengths(dtable, lengths));
+
+    /*
+    * Short codes share a lookup: 1-, 2- and 3-bit codes fit three to an
+    * entry, while 8-bit codes leave room for only one.
+    */
+    memset(lengths, 0, sizeof(lengths));
+    lengths['a'] = 1;
+    lengths['b'] = 2;
+    lengths['c'] = 3;
+    lengths['d'] = 3;
+    assert(decode_table_lengths(dtable, lengths));
+    assert(dtable->use_multi);
+    assert(dtable->multi[0] == (3u << 28 | 3u << 24 | 'a' << 16 | 'a' << 8 | 'a'));
+    memset(lengths, 8, sizeof(lengths));
+    assert(decode_table_lengths(dtable, lengths));
+    assert(!dtable->use_multi);
+    assert(dtable->multi[0] >> 28 == 1);
+    decode_table_free(&dtable);
+
+    /*
+    * Fibonacci frequencies make the deepest unlimited tree, which the limit
+    * has to flatten; a wide alphabet needs the slow path past
+    * CANONICAL_BITS.
+    */
+    uint32_t freq[4096] = { 0 };
+    freq[0] = freq[1] = 1;
+    for (int i = 2; i < 40; i++)
+        freq[i] = freq[i - 1] + freq[i - 2];
+    canonical_check(freq, 40, 12);
+    canonical_check(freq, 40, 32);
+    for (int i = 0; i < 4096; i++)
+        freq[i] = 1 + rng() % 1000;
+    canonical_check(freq, 4096, 20);
+    freq[7] = 0;
+    canonical_check(freq, 8, 4);
+    canonical_check(freq, 1, 4);
+
+    /*
+    * Train a dictionary on two kinds of samples, write it, and load it back.
+    */
+    uint32_t histograms[6][256] = { { 0 } };
+    for (int s = 0; s < 6; s++) {
+        for (int i = 0; i < 1000; i++) {
+            uint8_t c = (s % 2) ? (uint8_t) ('0' + rng() % 10) : (uint8_t) ('a' + rng() % 26);
+            ++histograms[s][c];
+        }
+    }
+    Dictionary *dict = dict_train(histograms, 6, 2);
+    assert(dict);
+    assert(dict->num_tables == 2);
+    assert(dict_select(dict, histograms[0]) == dict_select(dict, histograms[2]));
+    assert(dict_select(dict, histograms[1]) == dict_select(dict, histograms[3]));
+    assert(dict_select(dict, histograms[0]) != dict_select(dict, histograms[1]));
+    for (int t = 0; t < 2; t++) {
+        for (int i = 0; i < 256; i++) {
+            assert(dict->codes[t][i].code_length > 0);
+        }
+    }
+    assert(dict_write(dict, "dectest.dict"));
+
+    Dictionary *loaded = dict_load("dectest.dict");
+    assert(loaded);
+    assert(loaded->id == dict->id);
+    assert(memcmp(loaded->codes, dict->codes, sizeof(dict->codes)) == 0);
+    assert(loaded->decode[0] && loaded->decode[1]);
+
+    /*
+    * A 'D' frame streams with its dictionary and fails without one.
+    */
+    for (size_t i = 0; i < 3000; i++)
+        in[i] = (uint8_t) ('a' + rng() % 26);
+    BitSink *dict_sink = bit_sink_open(NULL);
+    assert(dict_sink);
+    frame_compress(dict_sink, in, 3000, loaded);
+    bit_sink_flush(dict_sink);
+    assert(dict_sink->buf[1] == 'D');
+    stream_check(dict_sink->buf, dict_sink->pos, in, 3000, loaded);
+    DehuffStream *no_dict = dehuff_stream_create(NULL);
+    assert(no_dict);
+    assert(dehuff_stream_feed(no_dict, dict_sink->buf, dict_sink->pos));
+    assert(dehuff_stream_drain(no_dict, in, 3000) == 0);
+    assert(no_dict->status == DEHUFF_STREAM_ERROR);
+    dehuff_stream_free(&no_dict);
+    bit_sink_close(&dict_sink);
+    dict_free(&loaded);
+    dict_free(&dict);
+    assert(dict == NULL);
+
+    /*
+    * A dictionary whose id does not match its tables is rejected.
+    */
+    FILE *f = fopen("dectest.dict", "r+b");
+    assert(f);
+    fseek(f, 3, SEEK_SET);
+    int c = fgetc(f);
+    fseek(f, 3, SEEK_SET);
+    fputc(c ^ 0x10, f);
+    fclose(f);
+    loaded = dict_load("dectest.dict");
+    assert(loaded == NULL);
+
+    remove("dectest.dict");
+    free(in);
+
+    /*
+    * The memory budget: sizes parse with suffixes, takes beyond the limit
+    * fail, and buffers and workers scale down to what is left.
+    */
+    size_t limit = 0;
+    assert(budget_parse("3M", &limit) && limit == 3 << 20);
+    assert(!budget_parse("3Q", &limit) && !budget_parse("M", &limit));
+    assert(!budget_set(1000));
+    assert(budget_set(BUDGET_RESERVE + (1 << 20)));
+    assert(budget_available() == 1 << 20);
+    assert(budget_take(1 << 19));
+    assert(!budget_take((1 << 19) + 1));
+    assert(budget_fit(1 << 20, 1 << 12, 2) == 1 << 18);
+    assert(budget_fit(1 << 20, 1 << 20, 2) == 1 << 20);
+    assert(budget_workers(8, 1 << 17) == 4);
+    assert(budget_workers(8, 1 << 30) == 1);
+    BufferPool *pool = buffer_pool_create(1 << 17, 4);
+    assert(pool && budget_available() == 0);
+    assert(buffer_pool_create(1, 1) == NULL);
+    uint8_t *b0 = buffer_pool_get(pool);
+    uint8_t *b1 = buffer_pool_get(pool);
+    assert(b0 != b1);
+    buffer_pool_put(pool, b0);
+    assert(buffer_pool_get(pool) == b0);
+    buffer_pool_put(pool, b0);
+    buffer_pool_put(pool, b1);
+    buffer_pool_free(&pool);
+    budget_give(1 << 19);
+    assert(budget_available() == 1 << 20 && budget_peak() == 1 << 20);
+
+    /*
+    * Requests and responses arrive whole and in order, and a closed
+    * connection ends the reading.
+    */
+    int pair[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0);
+    RpcRequest sent = { RPC_COMPRESS, 'F', FILTER_DELTA << 4 | 8, 5 };
+    assert(rpc_send_request(pair[0], &sent, (const uint8_t *) "hello"));
+    assert(rpc_send_response(pair[0], RPC_ERROR, (const uint8_t *) "no", 2));
+    close(pair[0]);
+    RpcRequest received;
+    uint8_t *payload = NULL;
+    size_t payload_cap = 0;
+    assert(rpc_read_request(pair[1], &received, &payload, &payload_cap));
+    assert(received.op == RPC_COMPRESS && received.mode == 'F' && received.size == 5);
+    assert(received.param == (FILTER_DELTA << 4 | 8) && memcmp(payload, "hello", 5) == 0);
+    uint8_t status;
+    uint32_t reply_size;
+    assert(rpc_read_response(pair[1], &status, &payload, &payload_cap, &reply_size));
+    assert(status == RPC_ERROR && reply_size == 2 && memcmp(payload, "no", 2) == 0);
+    assert(!rpc_read_request(pair[1], &received, &payload, &payload_cap));
+    close(pair[1]);
+    free(payload);
+    budget_give(payload_cap);
+
+    /*
+    * A walk finds the regular files at every depth, and the mirror has
+    * every directory of the tree.
+    */
+    char root[] = "/tmp/dectest.XXXXXX";
+    assert(mkdtemp(root) != NULL);
+    char *sub = walk_join(root, "a", "");
+    char *deep = walk_join(root, "a/b", "");
+    char *file = walk_join(root, "a/b/f", "");
+    assert(sub && deep && file && mkdir(sub, 0777) == 0 && mkdir(deep, 0777) == 0);
+    FILE *leaf = fopen(file, "wb");
+    assert(leaf && fwrite("abc", 1, 3, leaf) == 3 && fclose(leaf) == 0);
+    FileTree *tree = walk_tree(root);
+    assert(tree && tree->count == 1 && tree->dir_count == 2);
+    assert(strcmp(tree->paths[0], "a/b/f") == 0 && tree->sizes[0] == 3);
+    char *mirror = walk_join(root, "out", "");
+    char *mirror_sub = walk_join(root, "out/a", "");
+    char *mirrored = walk_join(root, "out/a/b", "");
+    struct stat st;
+    assert(walk_mirror(tree, mirror) && stat(mirrored, &st) == 0 && S_ISDIR(st.st_mode));
+    assert(walk_mirror(tree, mirror));
+    walk_free(&tree);
+    assert(tree == NULL && walk_tree(file) == NULL);
+    assert(remove(mirrored) == 0 && remove(mirror_sub) == 0);
+    assert(remove(mirror) == 0 && remove(file) == 0 && remove(deep) == 0 && remove(sub) == 0);
+    assert(remove(root) == 0);
+    free(sub);
+    free(deep);
+    free(file);
+    free(mirror);
+    free(mirror_sub);
+    free(mirrored);
+
+    /*
+    * An archive lists its members and extracts them all or one by name,
+    * refuses names that could not be extracted safely, and reports a
+    * damaged member or trailer.
+    */
+    assert(archive_safe_name("a") && archive_safe_name("a/b..") && archive_safe_name("..a/b"));
+    assert(!archive_safe_name("") && !archive_safe_name("/a") && !archive_safe_name(".."));
+    assert(!archive_safe_name("a/../b") && !archive_safe_name("a/.."));
+    char ar_root[] = "/tmp/dectest.XXXXXX";
+    assert(mkdtemp(ar_root) != NULL);
+    char *ar_file = walk_join(ar_root, "t.har", "");
+    char *ar_damaged = walk_join(ar_root, "d.har", "");
+    assert(ar_file && ar_damaged);
+    uint8_t *text = (uint8_t *) malloc(50000);
+    assert(text);
+    for (size_t i = 0; i < 50000; i++) {
+        text[i] = (uint8_t) ('a' + rng() % 26);
+    }
+    const char *ar_names[] = { "empty", "a.txt", "sub/b.bin" };
+    const uint8_t *ar_data[] = { text, text, text + 100 };
+    size_t ar_sizes[] = { 0, 50000, 3000 };
+    Archive *ar = archive_create(ar_file);
+    assert(ar);
+    for (int i = 0; i < 3; i++) {
+        assert(archive_add(ar, ar_names[i], ar_data[i], ar_sizes[i]));
+    }
+    assert(!archive_add(ar, "/etc/passwd", text, 10) && !archive_add(ar, "x/../../y", text, 10));
+    assert(archive_finish(&ar) && ar == NULL);
+
+    ar = archive_open(ar_file);
+    assert(ar && ar->count == 3);
+    BatchWorker *ar_worker = batch_workers_create(1);
+    assert(ar_worker);
+    for (size_t i = 0; i < 3; i++) {
+        assert(strcmp(ar->members[i].name, ar_names[i]) == 0);
+        assert(ar->members[i].size == ar_sizes[i]);
+        assert(archive_extract(ar, i, ar_worker) == NULL);
+        assert(memcmp(ar_worker->out, ar_data[i], ar_sizes[i]) == 0);
+    }
+    size_t ar_index = archive_find(ar, "sub/b.bin");
+    assert(ar_index == 2 && archive_extract(ar, ar_index, ar_worker) == NULL);
+    assert(memcmp(ar_worker->out, text + 100, 3000) == 0);
+    assert(archive_find(ar, "sub") == ar->count);
+    size_t ar_middle = (size_t) (ar->members[1].offset + ar->members[1].compressed / 2);
+    archive_close(&ar);
+    assert(ar == NULL);
+
+    /*
+    * The last 4 bytes before the trailer are the last member's CRC, after
+    * its size, offset and compressed length; the trailer is the directory
+    * offset, the member count and 'H' 'A' 0 0.
+    */
+    uint8_t *image = NULL;
+    size_t image_cap = 0;
+    size_t image_size = 0;
+    assert(read_whole_file(ar_file, &image, &image_cap, &image_size));
+    image[image_size - 20] ^= 1;
+    assert(write_whole_file(ar_damaged, image, image_size));
+    ar = archive_open(ar_damaged);
+    assert(ar && archive_extract(ar, 0, ar_worker) == NULL);
+    assert(strcmp(archive_extract(ar, 2, ar_worker), "member fails its CRC check") == 0);
+    archive_close(&ar);
+    image[image_size - 20] ^= 1;
+
+    image[image_size - 37] = 0x40;
+    assert(write_whole_file(ar_damaged, image, image_size));
+    ar = archive_open(ar_damaged);
+    const char *ar_error = ar ? archive_extract(ar, 2, ar_worker) : NULL;
+    assert(ar_error && strcmp(ar_error, "member size does not match the directory") == 0);
+    assert(ar_worker->out_cap < 1 << 20);
+    archive_close(&ar);
+    image[image_size - 37] = 0;
+
+    image[ar_middle] ^= 0x55;
+    assert(write_whole_file(ar_damaged, image, image_size));
+    ar = archive_open(ar_damaged);
+    assert(ar && archive_extract(ar, 2, ar_worker) == NULL);
+    assert(strcmp(archive_extract(ar, 1, ar_worker), "member fails its CRC check") == 0);
+    archive_close(&ar);
+    image[ar_middle] ^= 0x55;
+
+    assert(write_whole_file(ar_damaged, image, image_size - 1));
+    assert(archive_open(ar_damaged) == NULL);
+    memset(image + image_size - 8, 0xff, 4);
+    assert(write_whole_file(ar_damaged, image, image_size));
+    assert(archive_open(ar_damaged) == NULL);
+    memset(image + image_size - 8, 0, 4);
+    image[image_size - 8] = 3;
+    image[image_size - 9] ^= 0x80;
+    assert(write_whole_file(ar_damaged, image, image_size));
+    assert(archive_open(ar_damaged) == NULL);
+    image[image_size - 9] ^= 0x80;
+    assert(write_whole_file(ar_damaged, image, image_size));
+    ar = archive_open(ar_damaged);
+    assert(ar && ar->count == 3);
+    archive_close(&ar);
+
+    batch_workers_free(&ar_worker, 1);
+    free(image);
+    free(text);
+    assert(remove(ar_file) == 0 && remove(ar_damaged) == 0 && remove(ar_root) == 0);
+    free(ar_file);
+    free(ar_damaged);
+
+    /*
+    * A manifest pairs names split by a tab or spaces, skips blank and
+    * comment lines, and is refused whole for one line without two names.
+    * An input that cannot be examined counts as empty when sizing workers.
+    */
+    const char *good = "# comment\n\ndectest.c\tout one\r\nmissing.in   out2\n";
+    assert(write_whole_file("dectest.manifest", (const uint8_t *) good, strlen(good)));
+    Manifest *manifest = manifest_read("dectest.manifest");
+    assert(manifest && manifest->count == 2);
+    assert(strcmp(manifest->inputs[0], "dectest.c") == 0);
+    assert(strcmp(manifest->outputs[0], "out one") == 0);
+    assert(strcmp(manifest->inputs[1], "missing.in") == 0);
+    assert(strcmp(manifest->outputs[1], "out2") == 0);
+    assert(stat("dectest.c", &st) == 0 && manifest_largest_input(manifest) == (size_t) st.st_size);
+    manifest_free(&manifest);
+    assert(manifest == NULL);
+    const char *bad[] = { "a b\nonly-one\n", "a\t\n", "\tb\n", "a b\n   \n" };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        assert(write_whole_file("dectest.manifest", (const uint8_t *) bad[i], strlen(bad[i])));
+        assert(manifest_read("dectest.manifest") == NULL);
+    }
+    remove("dectest.manifest");
+    assert(manifest_read("dectest.manifest") == NULL);
+
+    /*
+    * HUFF_CPU narrows the features the kernels may use and never adds one.
+    */
+    unsigned all = CPU_BMI2;
+    char names[64];
+    assert(cpu_parse("generic", all) == 0 && cpu_parse("", all) == 0);
+    assert(cpu_parse("bmi2", all) == CPU_BMI2 && cpu_parse("generic,bmi2", all) == CPU_BMI2);
+    assert((cpu_features() & ~all) == 0);
+    cpu_format(CPU_BMI2, names, sizeof(names));
+    assert(strcmp(names, "bmi2") == 0);
+    cpu_format(0, names, sizeof(names));
+    assert(strcmp(names, "generic") == 0);
+    cpu_format(all, names, 3);
+    assert(strlen(names) == 2);
+
+    printf("dectest, as it is, reports no errors\n");
+    return 0;
+}
@@ -1,125 +1,819 @@
-#include "bitreader.h"
-#include "bitwriter.h"
-#include "node.h"
-#include "pq.h"
+#include "adaptive.h"
+#include "archive.h"
+#include "batch.h"
+#include "block.h"
+#include "budget.h"
+#include "decode.h"
+#include "dict.h"
+#include "frame.h"
+#include "lz77.h"
+#include "perf.h"
+#include "pool.h"
+#include "wide.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
-void stack_push(Node **stack, int *top, Node *node) {
-    if (*top == 63) {
-        fprintf(stderr, "Stack overflow\n");
-        exit(1);
+/*
+Bytes of decoded output collected before each write(), unless --max-memory leaves less.
+*/
+#define OUTPUT_BUFFER (1 << 20)
+
+/*
+* Where decoded bytes go: fd, through a buffer from buffers, or with map set
+* into a mapping of fd when it is a regular file.  An fd of -1 discards
+* them, for dehuff -t.  written counts the bytes decoded, for the -v
+* statistics and the length check of -t.  workers is the number of threads
+* a block frame is decoded on.
+*/
+typedef struct DehuffOutput {
+    int fd;
+    bool map;
+    BufferPool *buffers;
+    uint64_t written;
+    unsigned workers;
+} DehuffOutput;
+
+/*
+* One block of a block frame decoded in parallel: its payload, the table
+* its codes use, src positioned at those codes, and the bytes decoded.  A
+* fresh block's table is read into own, and an ANS block's into ans.
+*/
+typedef struct DehuffBlock {
+    uint8_t *payload;
+    size_t payload_cap;
+    uint8_t *out;
+    size_t out_cap;
+    DecodeTable *own;
+    const DecodeTable *table;
+    AnsTable *ans;
+    const AnsTable *ans_table;
+    uint32_t state[ANS_STATES];
+    uint8_t type;
+    BitSource src;
+    uint32_t size;
+    const char *error;
+} DehuffBlock;
+
+/*
+Write all of data to fd, retrying short and interrupted writes. Return false on error.
+*/
+static bool write_all(int fd, const uint8_t *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= (size_t) n;
     }
-    stack[++(*top)] = node;
+    return true;
 }
 
-Node *stack_pop(Node **stack, int *top) {
-    if (*top == -1) {
-        fprintf(stderr, "Stack underflow\n");
-        exit(1);
-    }
-    return stack[(*top)--];
+static bool output_write(DehuffOutput *output, const uint8_t *data, size_t size) {
+    output->written += size;
+    return output->fd < 0 || write_all(output->fd, data, size);
 }
 
-void decompressFile(FILE *fout, BitReader *inbuf) {
-    uint8_t type1 = bit_read_uint8(inbuf);
-    uint8_t type2 = bit_read_uint8(inbuf);
+/*
+Decode an adaptive frame up to its end symbol. Output is written whenever the input on hand runs
+out, so that a stream read from a pipe comes out as soon as its bits arrive.
+*/
+static const char *decompress_adaptive(DehuffOutput *output, BitSource *inbuf) {
+    AdaptiveModel *model = adaptive_create(true);
+    if (model == NULL) {
+        return "unable to allocate memory";
+    }
 
-    assert(type1 == 'H' && type2 == 'C');
+    uint8_t buffer[1 << 16];
+    AdaptiveStatus status;
+    do {
+        size_t n;
+        status = adaptive_decode(model, inbuf, buffer, sizeof(buffer), &n);
+        if (!output_write(output, buffer, n)) {
+            adaptive_free(&model);
+            return "error writing output";
+        }
+    } while (status == ADAPTIVE_MORE);
+    adaptive_free(&model);
 
-    uint32_t filesize = bit_read_uint32(inbuf);
-    uint16_t num_leaves = bit_read_uint16(inbuf);
+    return status == ADAPTIVE_ERROR ? "input is damaged or truncated" : NULL;
+}
 
-    uint16_t num_nodes = 2 * num_leaves - 1;
-    Node *node;
-    Node *stack[64];
-    int top = -1;
+/*
+Decode a block frame up to its end block. A fresh block replaces the table; a reused block keeps
+decoding with the one before; ANS blocks do the same with a table of their own kind. Blocks are
+gathered into one buffer and written together.
+*/
+static const char *decompress_blocks(DehuffOutput *output, BitSource *inbuf) {
+    DecodeTable *table = NULL;
+    AnsTable *ans = NULL;
+    uint32_t state[ANS_STATES];
+    uint8_t *buffer = buffer_pool_get(output->buffers);
+    size_t cap = output->buffers->size;
+    size_t pos = 0;
+    const char *error = NULL;
 
-    for (uint16_t i = 0; i < num_nodes; ++i) {
-        int bit = bit_read_bit(inbuf);
-        if (bit == 1) {
-            uint8_t symbol = bit_read_uint8(inbuf);
-            node = node_create(symbol, 0);
-        } else {
-            node = node_create(0, 0);
-            node->right = stack_pop(stack, &top);
-            node->left = stack_pop(stack, &top);
+    while (error == NULL) {
+        BlockHeader header;
+        error = block_read_header(inbuf, &table, &header);
+        if (error == NULL && block_is_ans(header.type)) {
+            error = block_read_ans(inbuf, header.type, &ans, state);
         }
-        stack_push(stack, &top, node);
+        if (error != NULL || header.type == BLOCK_END) {
+            break;
+        }
+        for (uint32_t done = 0; done < header.size && error == NULL;) {
+            if (pos == cap) {
+                error = output_write(output, buffer, pos) ? NULL : "error writing output";
+                pos = 0;
+            }
+            size_t n = header.size - done;
+            n = n < cap - pos ? n : cap - pos;
+            if (block_is_ans(header.type)) {
+                ans_decode(inbuf, ans, state, buffer + pos, n);
+            } else {
+                decode_symbols(inbuf, table, buffer + pos, n);
+            }
+            pos += n;
+            done += (uint32_t) n;
+        }
+        if (error == NULL && bit_source_overrun(inbuf)) {
+            error = "input is truncated";
+        }
+    }
+    if (error == NULL && !output_write(output, buffer, pos)) {
+        error = "error writing output";
     }
+    decode_table_free(&table);
+    free(ans);
+    buffer_pool_put(output->buffers, buffer);
+    return error;
+}
 
-    Node *code_tree = stack_pop(stack, &top);
+/*
+Read the next block's header and payload into block. Every code is at least a bit long, so a
+header claiming more than eight bytes per payload byte is damaged; an ANS block can spend less than
+a bit on a symbol, so only the budget its output is charged to limits it. A fresh block's tree is
+read here, so that *current is the table the blocks after it use, and so is an ANS block's table,
+which becomes *current_ans. Return NULL on success or a description of what is wrong.
+*/
+static const char *dehuff_read_block(BitSource *inbuf, DehuffBlock *block,
+    const DecodeTable **current, AnsTable **current_ans, BlockHeader *header) {
+    const char *error = block_read_fields(inbuf, header);
+    if (error != NULL || header->type == BLOCK_END) {
+        return error;
+    }
+    if (!block_is_ans(header->type) && header->size / 8 > header->payload) {
+        return "input has a damaged block header";
+    }
+    if (!batch_reserve(&block->payload, &block->payload_cap, header->payload)
+        || !batch_reserve(&block->out, &block->out_cap, header->size)) {
+        return "unable to allocate memory";
+    }
+    if (bit_source_read(inbuf, block->payload, header->payload) < header->payload) {
+        return "input is truncated";
+    }
 
-    for (uint32_t i = 0; i < filesize; ++i) {
-        node = code_tree;
-        while (1) {
-            int bit = bit_read_bit(inbuf);
-            if (bit == 0) {
-                node = node->left;
-            } else {
-                node = node->right;
-            }
-            if (node->left == NULL && node->right == NULL) {
-                fputc(node->symbol, fout);
+    bit_source_init(&block->src, block->payload, header->payload);
+    if (header->type == BLOCK_FRESH) {
+        error = block_read_table(&block->src, &block->own);
+        *current = block->own;
+    } else if (header->type == BLOCK_ANS) {
+        error = block_read_ans(&block->src, header->type, &block->ans, block->state);
+        *current_ans = block->ans;
+    } else if (header->type == BLOCK_ANS_REUSE) {
+        error = block_read_ans(&block->src, header->type, current_ans, block->state);
+    } else if (*current == NULL) {
+        error = "input reuses a table before sending one";
+    }
+    block->table = *current;
+    block->ans_table = *current_ans;
+    block->type = header->type;
+    block->size = header->size;
+    block->error = NULL;
+    return error;
+}
+
+static void dehuff_decode_block(void *arg, size_t index, unsigned worker) {
+    (void) worker;
+    DehuffBlock *block = &((DehuffBlock *) arg)[index];
+    if (block_is_ans(block->type)) {
+        ans_decode(&block->src, block->ans_table, block->state, block->out, block->size);
+    } else {
+        decode_symbols(&block->src, block->table, block->out, block->size);
+    }
+    if (bit_source_overrun(&block->src)) {
+        block->error = "input is truncated";
+    }
+}
+
+/*
+Decode a block frame on output->workers threads. Blocks are read a window at a time, twice as many
+as there are workers (fewer if --max-memory cannot hold them), decoded side by side, then written
+in order. A reused block needs the table of the last fresh block, which the reader has already
+read, so only that table, and the last ANS table likewise, is carried from one window to the next.
+*/
+static const char *decompress_blocks_parallel(DehuffOutput *output, BitSource *inbuf) {
+    size_t slots = 2 * (size_t) output->workers;
+    DehuffBlock *blocks = (DehuffBlock *) calloc(slots, sizeof(DehuffBlock));
+    DecodeTable *carry = (DecodeTable *) malloc(sizeof(DecodeTable));
+    const DecodeTable *current = NULL;
+    AnsTable *ans_carry = (AnsTable *) malloc(sizeof(AnsTable));
+    AnsTable *current_ans = NULL;
+    const char *error = blocks == NULL || carry == NULL || ans_carry == NULL
+        ? "unable to allocate memory"
+        : NULL;
+    bool end = false;
+
+    while (error == NULL && !end) {
+        size_t n = 0;
+        while (error == NULL && n < slots) {
+            BlockHeader header;
+            error = dehuff_read_block(inbuf, &blocks[n], &current, &current_ans, &header);
+            if (error != NULL || header.type == BLOCK_END) {
+                end = true;
                 break;
             }
+            if (budget_limited() && n == 0) {
+                size_t fit = budget_available() / ((size_t) header.size + header.payload + 1);
+                slots = fit + 1 < slots ? fit + 1 : slots;
+            }
+            n++;
+        }
+        if (error != NULL) {
+            break;
+        }
+
+        pool_for(output->workers, n, dehuff_decode_block, blocks);
+        for (size_t i = 0; i < n && error == NULL; i++) {
+            error = blocks[i].error;
+            if (error == NULL && !output_write(output, blocks[i].out, blocks[i].size)) {
+                error = "error writing output";
+            }
         }
+        if (current != NULL && current != carry) {
+            memcpy(carry, current, sizeof(DecodeTable));
+            current = carry;
+        }
+        if (current_ans != NULL && current_ans != ans_carry) {
+            memcpy(ans_carry, current_ans, sizeof(AnsTable));
+            current_ans = ans_carry;
+        }
+    }
+
+    for (size_t i = 0; blocks != NULL && i < 2 * (size_t) output->workers; i++) {
+        budget_give(blocks[i].payload_cap + blocks[i].out_cap);
+        free(blocks[i].payload);
+        free(blocks[i].out);
+        decode_table_free(&blocks[i].own);
+        free(blocks[i].ans);
+    }
+    free(blocks);
+    free(carry);
+    free(ans_carry);
+    return error;
+}
+
+/*
+Decode an LZ77 frame of filesize bytes. Matches reach back up to the whole window, so the output is
+decoded in memory, charged to the budget, and written in one piece.
+*/
+static const char *decompress_lz(DehuffOutput *output, BitSource *inbuf, uint32_t filesize) {
+    if (!budget_take(filesize)) {
+        return "unable to allocate memory";
+    }
+    uint8_t *out = (uint8_t *) malloc((size_t) filesize + 1);
+    const char *error
+        = out == NULL ? "unable to allocate memory" : lz_decompress(inbuf, out, filesize);
+    if (error == NULL && !output_write(output, out, filesize)) {
+        error = "error writing output";
+    }
+    free(out);
+    budget_give(filesize);
+    return error;
+}
+
+/*
+Decode a frame of 16-bit symbols of filesize bytes, a buffer at a time. The buffers are a whole
+number of symbols, and the odd byte, if there is one, follows the last of them.
+*/
+static const char *decompress_wide(DehuffOutput *output, BitSource *inbuf, uint32_t filesize) {
+    if (filesize == 0) {
+        return NULL;
+    }
+    if (filesize == 1) {
+        uint8_t byte = (uint8_t) bit_source_get(inbuf, 8);
+        return output_write(output, &byte, 1) ? NULL : "error writing output";
+    }
+
+    CanonicalTable *table = NULL;
+    const char *error = wide_read_table(inbuf, &table);
+    uint8_t *buffer = buffer_pool_get(output->buffers);
+    size_t cap = output->buffers->size / 2;
+    size_t count = filesize / 2;
+    for (size_t done = 0; error == NULL && done < count;) {
+        size_t n = count - done < cap ? count - done : cap;
+        if (!wide_decode(inbuf, table, buffer, n)) {
+            error = "input has a damaged code";
+        } else if (!output_write(output, buffer, 2 * n)) {
+            error = "error writing output";
+        }
+        done += n;
+    }
+    if (error == NULL && filesize % 2) {
+        uint8_t byte = (uint8_t) bit_source_get(inbuf, 8);
+        if (!output_write(output, &byte, 1)) {
+            error = "error writing output";
+        }
+    }
+    buffer_pool_put(output->buffers, buffer);
+    canonical_table_free(&table);
+    return error;
+}
+
+/*
+Decode a filtered frame into its planes and undo the filters into a second buffer, both charged to
+the budget, then write it in one piece.
+*/
+static const char *decompress_filtered(
+    DehuffOutput *output, BitSource *inbuf, const FrameHeader *header) {
+    size_t size = header->filesize;
+    if (!budget_take(2 * size)) {
+        return "unable to allocate memory";
+    }
+    uint8_t *scratch = (uint8_t *) malloc(size + 1);
+    uint8_t *out = (uint8_t *) malloc(size + 1);
+    const char *error = "unable to allocate memory";
+    if (scratch != NULL && out != NULL) {
+        error = frame_decompress_filtered(inbuf, header, scratch, out);
+    }
+    if (error == NULL && !output_write(output, out, size)) {
+        error = "error writing output";
+    }
+    free(scratch);
+    free(out);
+    budget_give(2 * size);
+    return error;
+}
+
+/*
+Decode filesize bytes straight into a shared mapping of the output file, after extending it with
+posix_fallocate() so the blocks are reserved up front. The mapped pages are resident until unmapped,
+so they count against the memory budget. Return false, having written nothing, if fd is not a
+regular file, the mapping does not fit the budget or cannot be made, so the caller can fall back
+to write(); the file may then already be filesize bytes long, which the writes fill in.
+*/
+static bool decompress_mapped(int fd, BitSource *inbuf, const FrameHeader *header) {
+    struct stat st;
+    if (header->filesize == 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+    if (!budget_take(header->filesize)) {
+        return false;
+    }
+    uint8_t *out = MAP_FAILED;
+    if (posix_fallocate(fd, 0, (off_t) header->filesize) == 0) {
+        out = (uint8_t *) mmap(NULL, header->filesize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
     }
-    node_free(&code_tree);
+    if (out != MAP_FAILED) {
+        decode_symbols(inbuf, header->table, out, header->filesize);
+        munmap(out, header->filesize);
+    }
+    budget_give(header->filesize);
+    return out != MAP_FAILED;
+}
+
+/*
+Decode one frame from inbuf to output. A 'C' frame carries its own tree; a 'D' frame names a table
+of the dictionary it was compressed with; a 'V' frame is adaptive, a 'B' frame is split into
+blocks, an 'L' frame is LZ77, an 'F' frame is filtered and a 'W' frame has 16-bit symbols. If
+output->map is set, frames of known size are decoded into a mapping of the output file when it is
+a regular file. Return NULL on success or a description of what went wrong.
+*/
+static const char *decode_frame(DehuffOutput *output, BitSource *inbuf, const Dictionary *dict) {
+    FrameHeader header = { 0 };
+    const char *error = frame_read_header(inbuf, dict, &header);
+    if (error == NULL && header.type == 'V') {
+        error = decompress_adaptive(output, inbuf);
+    } else if (error == NULL && header.type == 'B') {
+        error = output->workers > 1 ? decompress_blocks_parallel(output, inbuf)
+                                    : decompress_blocks(output, inbuf);
+    } else if (error == NULL && header.type == 'L') {
+        error = decompress_lz(output, inbuf, header.filesize);
+    } else if (error == NULL && header.type == 'F') {
+        error = decompress_filtered(output, inbuf, &header);
+    } else if (error == NULL && header.type == 'W') {
+        error = decompress_wide(output, inbuf, header.filesize);
+    } else if (error == NULL && output->map && decompress_mapped(output->fd, inbuf, &header)) {
+        output->written += header.filesize;
+    } else if (error == NULL) {
+        uint8_t *buffer = buffer_pool_get(output->buffers);
+        size_t cap = output->buffers->size;
+        for (uint32_t done = 0; error == NULL && done < header.filesize;) {
+            size_t n = header.filesize - done < cap ? header.filesize - done : cap;
+            decode_symbols(inbuf, header.table, buffer, n);
+            if (!output_write(output, buffer, n)) {
+                error = "error writing output";
+            }
+            done += (uint32_t) n;
+        }
+        buffer_pool_put(output->buffers, buffer);
+    }
+    frame_header_free(&header);
+
+    if (error == NULL && bit_source_overrun(inbuf)) {
+        error = "input is truncated";
+    }
+    return error;
+}
+
+/*
+Decode one frame from inbuf to output, as decode_frame() does. Return 0 on success and 1 on error.
+*/
+int decompressFile(DehuffOutput *output, BitSource *inbuf, const Dictionary *dict) {
+    const char *error = decode_frame(output, inbuf, dict);
+    if (error != NULL) {
+        fprintf(stderr, "dehuff:  %s\n", error);
+        return 1;
+    }
+    return 0;
+}
+
+typedef struct DehuffBatch {
+    const Manifest *manifest;
+    const Dictionary *dict;
+    BatchWorker *workers;
+    atomic_size_t failures;
+} DehuffBatch;
+
+static void dehuff_batch_file(void *arg, size_t index, unsigned worker) {
+    DehuffBatch *batch = (DehuffBatch *) arg;
+    BatchWorker *w = &batch->workers[worker];
+    const char *input = batch->manifest->inputs[index];
+    const char *output = batch->manifest->outputs[index];
+
+    size_t size;
+    if (!read_whole_file(input, &w->data, &w->data_cap, &size)) {
+        fprintf(stderr, "dehuff:  error reading input file %s\n", input);
+        atomic_fetch_add(&batch->failures, 1);
+        return;
+    }
+
+    BitSource src;
+    bit_source_init(&src, w->data, size);
+    const char *error = frame_read_header(&src, batch->dict, &w->header);
+    if (error == NULL && w->header.type != 'C' && w->header.type != 'D' && w->header.type != 'K') {
+        error = "only single-table files can be batch decoded";
+    }
+    if (error == NULL && !batch_reserve(&w->out, &w->out_cap, w->header.filesize)) {
+        error = "unable to allocate memory";
+    }
+    if (error == NULL) {
+        decode_symbols(&src, w->header.table, w->out, w->header.filesize);
+        if (bit_source_overrun(&src)) {
+            error = "input is truncated";
+        }
+    }
+    if (error != NULL) {
+        fprintf(stderr, "dehuff:  %s: %s\n", input, error);
+        atomic_fetch_add(&batch->failures, 1);
+        return;
+    }
+
+    if (!write_whole_file(output, w->out, w->header.filesize)) {
+        fprintf(stderr, "dehuff:  error writing output file %s\n", output);
+        atomic_fetch_add(&batch->failures, 1);
+    }
+}
+
+/*
+Decompress every file named in a manifest on num_workers threads. Under a memory budget there are
+only as many workers as can hold the largest input and room to decode it. Return the number of
+files that failed.
+*/
+size_t dehuff_batch(const Manifest *manifest, const Dictionary *dict, unsigned num_workers) {
+    if (budget_limited()) {
+        num_workers = budget_workers(num_workers, 4 * manifest_largest_input(manifest));
+    }
+    DehuffBatch batch = { manifest, dict, batch_workers_create(num_workers), 0 };
+    if (batch.workers == NULL) {
+        fprintf(stderr, "dehuff:  unable to allocate memory\n");
+        return manifest->count;
+    }
+
+    pool_for(num_workers, manifest->count, dehuff_batch_file, &batch);
+
+    batch_workers_free(&batch.workers, num_workers);
+    return atomic_load(&batch.failures);
+}
+
+/*
+* The outcome of testing one file: error is NULL if it passed.
+*/
+typedef struct DehuffResult {
+    const char *error;
+    uint64_t bytes;
+    double seconds;
+} DehuffResult;
+
+typedef struct DehuffTest {
+    char *const *files;
+    const Dictionary *dict;
+    BatchWorker *workers;
+    BufferPool *buffers;
+    DehuffResult *results;
+} DehuffTest;
+
+/*
+Decode every member of an archive and check it against the size and CRC in the directory.
+*/
+static const char *dehuff_test_archive(const char *filename, BatchWorker *w, uint64_t *bytes) {
+    Archive *archive = archive_open(filename);
+    if (archive == NULL) {
+        return "input is not a valid archive";
+    }
+    const char *error = NULL;
+    for (size_t i = 0; error == NULL && i < archive->count; i++) {
+        error = archive_extract(archive, i, w);
+        *bytes += archive->members[i].size;
+    }
+    archive_close(&archive);
+    return error;
+}
+
+/*
+Decode one file without writing it anywhere: a single frame, which must end where the file does,
+or an archive, whose members must pass their CRC checks.
+*/
+static void dehuff_test_file(void *arg, size_t index, unsigned worker) {
+    DehuffTest *test = (DehuffTest *) arg;
+    const char *filename = test->files[index];
+    DehuffResult *result = &test->results[index];
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    FILE *f = fopen(filename, "rb");
+    uint8_t head[3] = { 0 };
+    if (f == NULL) {
+        result->error = "cannot open file";
+        return;
+    }
+    size_t got = fread(head, 1, sizeof(head), f);
+    if (got == sizeof(head) && head[0] == 'H' && head[1] == 'A' && head[2] == 0x01) {
+        fclose(f);
+        result->error = dehuff_test_archive(filename, &test->workers[worker], &result->bytes);
+    } else {
+        rewind(f);
+        BitSource *src = bit_source_open(f);
+        DehuffOutput output = { -1, false, test->buffers, 0, 1 };
+        result->error = src == NULL ? "unable to allocate memory"
+                                    : decode_frame(&output, src, test->dict);
+        if (result->error == NULL && !bit_source_at_end(src)) {
+            result->error = "input has data after its frame";
+        }
+        result->bytes = output.written;
+        bit_source_close(&src);
+        fclose(f);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    result->seconds = (double) (stop.tv_sec - start.tv_sec)
+                      + (double) (stop.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/*
+Test count files on num_workers threads and print a line for each, in the order given, then the
+totals. Return the number of files that failed.
+*/
+static size_t dehuff_test(
+    char *const *files, size_t count, const Dictionary *dict, unsigned num_workers) {
+    if (budget_limited()) {
+        num_workers = budget_workers(num_workers, 2 * OUTPUT_BUFFER);
+    }
+    DehuffTest test = { files, dict, batch_workers_create(num_workers),
+        buffer_pool_create(budget_fit(OUTPUT_BUFFER, 1 << 12, num_workers), num_workers),
+        (DehuffResult *) calloc(count, sizeof(DehuffResult)) };
+    if (test.workers == NULL || test.buffers == NULL || test.results == NULL) {
+        fprintf(stderr, "dehuff:  unable to allocate memory\n");
+        batch_workers_free(&test.workers, num_workers);
+        buffer_pool_free(&test.buffers);
+        free(test.results);
+        return count;
+    }
+
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pool_for(num_workers, count, dehuff_test_file, &test);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    double seconds = (double) (stop.tv_sec - start.tv_sec)
+                     + (double) (stop.tv_nsec - start.tv_nsec) / 1e9;
+
+    size_t failures = 0;
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < count; i++) {
+        const DehuffResult *r = &test.results[i];
+        if (r->error != NULL) {
+            printf("%s: FAILED, %s\n", files[i], r->error);
+            failures++;
+        } else {
+            printf("%s: ok, %" PRIu64 " bytes, %.1f MB/s\n", files[i], r->bytes,
+                r->seconds > 0 ? (double) r->bytes / r->seconds / 1e6 : 0.0);
+        }
+        bytes += r->bytes;
+    }
+    printf("dehuff:  %zu files, %zu failed, %" PRIu64 " bytes in %.3f s (%.1f MB/s)\n", count,
+        failures, bytes, seconds, seconds > 0 ? (double) bytes / seconds / 1e6 : 0.0);
+
+    batch_workers_free(&test.workers, num_workers);
+    buffer_pool_free(&test.buffers);
+    free(test.results);
+    return failures;
+}
+
+/*
+Print the most memory that was counted against the budget and the peak resident set size.
+*/
+static void dehuff_report_memory(void) {
+    fprintf(stderr, "dehuff:  peak memory %zu bytes in buffers, %zu bytes resident\n",
+        budget_peak(), budget_peak_rss());
 }
 
 void print_help(void) {
-    printf("Usage: huff/dehuff -i infile -o outfile\n");
+    printf("Usage: huff/dehuff -i infile -o outfile [-D dict]\n");
+    printf("       dehuff -m -i infile -o outfile\n");
+    printf("       dehuff -t [-j workers] [-D dict] file...\n");
+    printf("       dehuff -j workers -i infile|- -o outfile|-\n");
+    printf("       dehuff ... [-v] --max-memory bytes[K|M|G]\n");
+    printf("       huff -a -i infile|- -o outfile|-, dehuff -i infile|- -o outfile|-\n");
+    printf("       huff/dehuff -B manifest [-j workers] [-D dict]\n");
     printf("       huff -h\n");
 }
 
+static const struct option long_options[] = {
+    { "max-memory", required_argument, NULL, 'M' },
+    { NULL, 0, NULL, 0 },
+};
+
 int main(int argc, char *argv[]) {
     int opt;
     char *input_file = NULL;
     char *output_file = NULL;
+    char *dict_file = NULL;
+    char *manifest_file = NULL;
+    unsigned num_workers = pool_default_workers();
+    bool map_output = false;
+    bool test = false;
+    bool verbose = false;
+    size_t limit;
 
-    while ((opt = getopt(argc, argv, "i:o:")) != -1) {
+    while ((opt = getopt_long(argc, argv, "mtvi:o:D:B:j:", long_options, NULL)) != -1) {
         switch (opt) {
+        case 'm': map_output = true; break;
+        case 't': test = true; break;
+        case 'v': verbose = true; break;
+        case 'M':
+            if (!budget_parse(optarg, &limit) || !budget_set(limit)) {
+                fprintf(stderr, "dehuff:  --max-memory must be a size above %u bytes\n",
+                    BUDGET_RESERVE);
+                return 1;
+            }
+            break;
         case 'i': input_file = optarg; break;
         case 'o': output_file = optarg; break;
-        default: fprintf(stderr, "Usage: %s -i input_file -o output_file\n", argv[0]); return 1;
+        case 'D': dict_file = optarg; break;
+        case 'B': manifest_file = optarg; break;
+        case 'j':
+            num_workers = (unsigned) strtoul(optarg, NULL, 10);
+            if (num_workers == 0) {
+                fprintf(stderr, "dehuff:  -j must be at least 1\n");
+                return 1;
+            }
+            break;
+        default:
+            fprintf(stderr, "Usage: %s -i input_file -o output_file [-D dict]\n", argv[0]);
+            return 1;
         }
     }
 
-    if (input_file == NULL || output_file == NULL) {
-        fprintf(stderr, "Usage: %s -i input_file -o output_file\n", argv[0]);
+    if (test && input_file == NULL && optind == argc) {
+        fprintf(stderr, "Usage: %s -t file...\n", argv[0]);
+        return 1;
+    }
+    if (!test && manifest_file == NULL && (input_file == NULL || output_file == NULL)) {
+        fprintf(stderr, "Usage: %s -i input_file -o output_file [-D dict]\n", argv[0]);
         return 1;
     }
 
-    FILE *infile = fopen(input_file, "rb");
+    Dictionary *dict = NULL;
+    if (dict_file != NULL) {
+        dict = dict_load(dict_file);
+        if (dict == NULL) {
+            fprintf(stderr, "Error reading dictionary %s\n", dict_file);
+            return 1;
+        }
+    }
+
+    if (test) {
+        if (input_file != NULL) {
+            argv[--optind] = input_file;
+        }
+        size_t failures = dehuff_test(argv + optind, (size_t) (argc - optind), dict, num_workers);
+        if (verbose) {
+            dehuff_report_memory();
+        }
+        dict_free(&dict);
+        return failures == 0 ? 0 : 1;
+    }
+
+    if (manifest_file != NULL) {
+        Manifest *manifest = manifest_read(manifest_file);
+        if (manifest == NULL) {
+            fprintf(stderr, "Error reading manifest %s\n", manifest_file);
+            dict_free(&dict);
+            return 1;
+        }
+        size_t failures = dehuff_batch(manifest, dict, num_workers);
+        if (verbose) {
+            dehuff_report_memory();
+        }
+        manifest_free(&manifest);
+        dict_free(&dict);
+        return failures == 0 ? 0 : 1;
+    }
+
+    FILE *infile = strcmp(input_file, "-") == 0 ? stdin : fopen(input_file, "rb");
     if (infile == NULL) {
         perror("Error opening input file");
         return 1;
     }
 
-    FILE *outfile = fopen(output_file, "wb");
-    if (outfile == NULL) {
+    int outfd = strcmp(output_file, "-") == 0
+                    ? STDOUT_FILENO
+                    : open(output_file, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (outfd < 0) {
         perror("Error opening output file");
         fclose(infile);
         return 1;
     }
 
-    BitReader *inbuf = bit_read_open(input_file);
+    BitSource *inbuf = bit_source_open(infile);
     if (inbuf == NULL) {
-        perror("Error opening input file as BitReader");
+        perror("Error opening input file as BitSource");
         fclose(infile);
-        fclose(outfile);
+        close(outfd);
         return 1;
     }
 
-    decompressFile(outfile, inbuf);
+    DehuffOutput output = { outfd, map_output,
+        buffer_pool_create(budget_fit(OUTPUT_BUFFER, 1 << 12, 1), 1), 0, num_workers };
+    PerfCounters counters;
+    PerfSample decode_counts;
+    if (verbose) {
+        perf_open(&counters);
+    }
 
+    int status = 1;
+    if (output.buffers == NULL) {
+        fprintf(stderr, "dehuff:  unable to allocate memory\n");
+    } else {
+        if (verbose) {
+            perf_start(&counters);
+        }
+        status = decompressFile(&output, inbuf, dict);
+        if (verbose) {
+            perf_stop(&counters, &decode_counts);
+            perf_print(stderr, "dehuff:  ", "decode", &counters, &decode_counts, output.written);
+        }
+    }
+    buffer_pool_free(&output.buffers);
+    if (verbose) {
+        perf_close(&counters);
+        dehuff_report_memory();
+    }
+
+    bit_source_close(&inbuf);
     fclose(infile);
-    fclose(outfile);
-    bit_read_close(&inbuf);
+    if (close(outfd) != 0 && status == 0) {
+        perror("Error writing output file");
+        status = 1;
+    }
+    dict_free(&dict);
 
-    return 0;
+    return status;
 }
@@ -0,0 +1,235 @@
+#include "dict.h"
+
+#include "huffman.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DICT_ROUNDS 16
+
+static Dictionary *dict_create(void) {
+    Dictionary *dict = (Dictionary *) calloc(1, sizeof(Dictionary));
+    return dict;
+}
+
+/*
+Build a tree that covers every symbol from summed counts. The counts are scaled to fit the 32-bit
+weights that create_tree() takes, and each symbol gets at least a count of 1.
+*/
+static Node *dict_build_tree(const uint64_t *sum, uint16_t *num_leaves) {
+    uint64_t total = 256;
+    for (int i = 0; i < 256; i++) {
+        total += sum[i];
+    }
+    int shift = 0;
+    while ((total >> shift) > INT32_MAX) {
+        shift++;
+    }
+
+    uint32_t histogram[256];
+    for (int i = 0; i < 256; i++) {
+        histogram[i] = (uint32_t) (sum[i] >> shift) + 1;
+    }
+
+    *num_leaves = 0;
+    return create_tree(histogram, num_leaves);
+}
+
+/*
+Serialize the trees and return the FNV-1a hash of the bytes.
+*/
+static uint32_t dict_hash(const Dictionary *dict) {
+    BitSink *sink = bit_sink_open(NULL);
+    if (sink == NULL) {
+        fprintf(stderr, "huff:  unable to allocate memory\n");
+        exit(1);
+    }
+    for (uint8_t t = 0; t < dict->num_tables; t++) {
+        bit_sink_put(sink, dict->num_leaves[t], 16);
+        huff_write_tree(sink, dict->trees[t]);
+    }
+    bit_sink_flush(sink);
+
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < sink->pos; i++) {
+        hash = (hash ^ sink->buf[i]) * 16777619u;
+    }
+    bit_sink_close(&sink);
+    return hash;
+}
+
+static void dict_finish(Dictionary *dict) {
+    for (uint8_t t = 0; t < dict->num_tables; t++) {
+        memset(dict->codes[t], 0, sizeof(dict->codes[t]));
+        fill_code_table(dict->codes[t], dict->trees[t], 0, 0);
+    }
+    dict->id = dict_hash(dict);
+}
+
+/*
+Train num_tables tables on the histograms of num_samples samples. The samples are split into
+groups by Lloyd iteration: each group gets the table built from its summed counts, and each sample
+moves to the group whose table codes it in the fewest bits. Return NULL on error.
+*/
+Dictionary *dict_train(uint32_t (*histograms)[256], size_t num_samples, uint8_t num_tables) {
+    if (num_samples == 0 || num_tables == 0 || num_tables > DICT_MAX_TABLES) {
+        return NULL;
+    }
+    if (num_tables > num_samples) {
+        num_tables = (uint8_t) num_samples;
+    }
+
+    Dictionary *dict = dict_create();
+    size_t *group = (size_t *) malloc(num_samples * sizeof(size_t));
+    if (dict == NULL || group == NULL) {
+        free(dict);
+        free(group);
+        return NULL;
+    }
+    dict->num_tables = num_tables;
+
+    for (size_t s = 0; s < num_samples; s++) {
+        group[s] = s % num_tables;
+    }
+
+    for (int round = 0; round < DICT_ROUNDS; round++) {
+        for (uint8_t t = 0; t < num_tables; t++) {
+            uint64_t sum[256] = { 0 };
+            for (size_t s = 0; s < num_samples; s++) {
+                if (group[s] == t) {
+                    for (int i = 0; i < 256; i++) {
+                        sum[i] += histograms[s][i];
+                    }
+                }
+            }
+            node_free(&dict->trees[t]);
+            dict->trees[t] = dict_build_tree(sum, &dict->num_leaves[t]);
+            memset(dict->codes[t], 0, sizeof(dict->codes[t]));
+            fill_code_table(dict->codes[t], dict->trees[t], 0, 0);
+        }
+
+        size_t moved = 0;
+        for (size_t s = 0; s < num_samples; s++) {
+            uint8_t best = dict_select(dict, histograms[s]);
+            if (best != group[s]) {
+                group[s] = best;
+                moved++;
+            }
+        }
+        if (moved == 0) {
+            break;
+        }
+    }
+
+    free(group);
+    dict_finish(dict);
+    return dict;
+}
+
+/*
+Write the dictionary: 'H' 'T', the table count, the id, and then each table as a 16-bit leaf count
+followed by its tree in the huff_write_tree() format. Return false on error.
+*/
+bool dict_write(const Dictionary *dict, const char *filename) {
+    FILE *f = fopen(filename, "wb");
+    if (f == NULL) {
+        return false;
+    }
+    BitSink *sink = bit_sink_open(f);
+    if (sink == NULL) {
+        fclose(f);
+        return false;
+    }
+
+    bit_sink_put(sink, 'H', 8);
+    bit_sink_put(sink, 'T', 8);
+    bit_sink_put(sink, dict->num_tables, 8);
+    bit_sink_put(sink, dict->id, 32);
+    for (uint8_t t = 0; t < dict->num_tables; t++) {
+        bit_sink_put(sink, dict->num_leaves[t], 16);
+        huff_write_tree(sink, dict->trees[t]);
+    }
+    bit_sink_flush(sink);
+    bit_sink_close(&sink);
+
+    return fclose(f) == 0;
+}
+
+/*
+Read a dictionary written by dict_write() and build its code and decode tables. Return NULL if the
+file cannot be read or does not hash to its recorded id.
+*/
+Dictionary *dict_load(const char *filename) {
+    FILE *f = fopen(filename, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+    BitSource *src = bit_source_open(f);
+    Dictionary *dict = dict_create();
+    if (src == NULL || dict == NULL) {
+        bit_source_close(&src);
+        free(dict);
+        fclose(f);
+        return NULL;
+    }
+
+    uint8_t type1 = (uint8_t) bit_source_get(src, 8);
+    uint8_t type2 = (uint8_t) bit_source_get(src, 8);
+    dict->num_tables = (uint8_t) bit_source_get(src, 8);
+    uint32_t id = (uint32_t) bit_source_get(src, 32);
+
+    bool ok = type1 == 'H' && type2 == 'T' && dict->num_tables > 0
+              && dict->num_tables <= DICT_MAX_TABLES;
+    for (uint8_t t = 0; ok && t < dict->num_tables; t++) {
+        dict->num_leaves[t] = (uint16_t) bit_source_get(src, 16);
+        ok = dict->num_leaves[t] == 256 && !bit_source_overrun(src);
+        if (ok) {
+            dict->trees[t] = huff_read_tree(src, dict->num_leaves[t]);
+            ok = !bit_source_overrun(src);
+        }
+    }
+    bit_source_close(&src);
+    fclose(f);
+
+    if (ok) {
+        dict_finish(dict);
+        ok = dict->id == id;
+    }
+    for (uint8_t t = 0; ok && t < dict->num_tables; t++) {
+        dict->decode[t] = decode_table_create(dict->trees[t]);
+        ok = dict->decode[t] != NULL;
+    }
+    if (!ok) {
+        dict_free(&dict);
+    }
+    return dict;
+}
+
+void dict_free(Dictionary **pdict) {
+    if (*pdict != NULL) {
+        for (int t = 0; t < DICT_MAX_TABLES; t++) {
+            node_free(&(*pdict)->trees[t]);
+            decode_table_free(&(*pdict)->decode[t]);
+        }
+        free(*pdict);
+        *pdict = NULL;
+    }
+}
+
+/*
+Return the table that codes the counted symbols in the fewest bits.
+*/
+uint8_t dict_select(const Dictionary *dict, const uint32_t *histogram) {
+    uint8_t best = 0;
+    uint64_t best_cost = UINT64_MAX;
+    for (uint8_t t = 0; t < dict->num_tables; t++) {
+        uint64_t cost = huff_cost(histogram, dict->codes[t]);
+        if (cost < best_cost) {
+            best = t;
+            best_cost = cost;
+        }
+    }
+    return best;
+}
@@ -0,0 +1,42 @@
+#ifndef _DICT_H
+#define _DICT_H
+
+/*
+* File:     dict.h
+* Purpose:  Header file for dict.c, shared dictionaries of pretrained
+*           code tables.  A frame compressed with a dictionary names one of
+*           its tables instead of carrying its own tree.
+*/
+
+#include "decode.h"
+#include "encode.h"
+#include "node.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define DICT_MAX_TABLES 16
+
+/*
+* Every table covers all 256 symbols, so any input can be encoded with any
+* of them.  id is a hash of the serialized tables; frames record it so that
+* a decoder can tell that it has the right dictionary.  The decode tables
+* are only built by dict_load().
+*/
+typedef struct Dictionary {
+    uint32_t id;
+    uint8_t num_tables;
+    uint16_t num_leaves[DICT_MAX_TABLES];
+    Node *trees[DICT_MAX_TABLES];
+    Code codes[DICT_MAX_TABLES][256];
+    DecodeTable *decode[DICT_MAX_TABLES];
+} Dictionary;
+
+Dictionary *dict_train(uint32_t (*histograms)[256], size_t num_samples, uint8_t num_tables);
+bool dict_write(const Dictionary *dict, const char *filename);
+Dictionary *dict_load(const char *filename);
+void dict_free(Dictionary **pdict);
+uint8_t dict_select(const Dictionary *dict, const uint32_t *histogram);
+
+#endif
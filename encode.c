@@ -0,0 +1,431 @@
+#include "encode.h"
+
+#include "cpu.h"
+#include "huffman.h"
+#include "pool.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define ENCODE_X86 1
+#endif
+
+#define SINK_SIZE    (1 << 16)
+#define ENCODE_CHUNK 4096
+
+typedef void (*EncodeKernel)(BitSink *, const EncodeTable *, const uint8_t *, size_t);
+
+static void bit_sink_drain(BitSink *sink) {
+    if (sink->stream != NULL && sink->pos > 0) {
+        if (fwrite(sink->buf, 1, sink->pos, sink->stream) != sink->pos) {
+            fprintf(stderr, "huff:  error writing output\n");
+            exit(1);
+        }
+        sink->pos = 0;
+    }
+}
+
+/*
+Allocate a BitSink with an empty buffer that drains to stream (or grows, if stream is NULL).
+Return NULL on error.
+*/
+BitSink *bit_sink_open(FILE *stream) {
+    BitSink *sink = (BitSink *) malloc(sizeof(BitSink));
+    if (sink == NULL) {
+        return NULL;
+    }
+
+    sink->buf = (uint8_t *) malloc(SINK_SIZE);
+    if (sink->buf == NULL) {
+        free(sink);
+        return NULL;
+    }
+    sink->cap = SINK_SIZE;
+
+    bit_sink_reset(sink, stream);
+
+    return sink;
+}
+
+/*
+Free the buffer and the BitSink, and set *psink to NULL. Pending bits are discarded, so call
+bit_sink_flush() first.
+*/
+void bit_sink_close(BitSink **psink) {
+    if (*psink != NULL) {
+        free((*psink)->buf);
+        free(*psink);
+        *psink = NULL;
+    }
+}
+
+/*
+Empty the sink and point it at a new stream, keeping its buffer for reuse.
+*/
+void bit_sink_reset(BitSink *sink, FILE *stream) {
+    sink->stream = stream;
+    sink->pos = 0;
+    sink->acc = 0;
+    sink->nbits = 0;
+}
+
+/*
+Make sure at least bytes more bytes can be spilled, draining or growing the buffer as needed.
+*/
+void bit_sink_reserve(BitSink *sink, size_t bytes) {
+    if (sink->cap - sink->pos >= bytes + 8) {
+        return;
+    }
+
+    bit_sink_drain(sink);
+
+    size_t need = sink->pos + bytes + 8;
+    if (sink->cap < need) {
+        size_t cap = 2 * sink->cap;
+        while (cap < need) {
+            cap *= 2;
+        }
+        uint8_t *buf = (uint8_t *) realloc(sink->buf, cap);
+        if (buf == NULL) {
+            fprintf(stderr, "huff:  unable to allocate memory\n");
+            exit(1);
+        }
+        sink->buf = buf;
+        sink->cap = cap;
+    }
+}
+
+/*
+Write the low length bits of bits, LSB first. length must not exceed 56.
+*/
+void bit_sink_put(BitSink *sink, uint64_t bits, uint8_t length) {
+    bit_sink_reserve(sink, 8);
+    bit_sink_append(sink, bits, length);
+}
+
+/*
+Copy size bytes into the sink. The sink must be on a byte boundary.
+*/
+void bit_sink_write(BitSink *sink, const uint8_t *data, size_t size) {
+    bit_sink_reserve(sink, size);
+    memcpy(sink->buf + sink->pos, data, size);
+    sink->pos += size;
+}
+
+/*
+Write out the whole bytes collected so far and flush the stream, keeping the last partial byte in
+the accumulator. A sink without a stream is left as it is.
+*/
+void bit_sink_sync(BitSink *sink) {
+    if (sink->stream != NULL) {
+        bit_sink_drain(sink);
+        fflush(sink->stream);
+    }
+}
+
+/*
+Pad the last partial byte with zeros, as bit_write_close() does, and drain the buffer.
+*/
+void bit_sink_flush(BitSink *sink) {
+    bit_sink_reserve(sink, 1);
+    if (sink->nbits > 0) {
+        sink->buf[sink->pos++] = (uint8_t) sink->acc;
+        sink->acc = 0;
+        sink->nbits = 0;
+    }
+    bit_sink_drain(sink);
+}
+
+void encode_table_init(EncodeTable *table, const Code *codes) {
+    table->codes = codes;
+    table->max_length = 0;
+    for (int i = 0; i < 256; i++) {
+        table->packed[i] = (uint32_t) codes[i].code_length << 24 | (codes[i].code & 0xffffff);
+        if (codes[i].code_length > table->max_length) {
+            table->max_length = codes[i].code_length;
+        }
+    }
+}
+
+static inline size_t encode_chunk_bytes(const EncodeTable *table, size_t n) {
+    return (n * table->max_length) / 8 + 1;
+}
+
+static inline void encode_run(BitSink *sink, const Code *codes, const uint8_t *in, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        bit_sink_append(sink, codes[in[i]].code, codes[in[i]].code_length);
+    }
+}
+
+/*
+The reference kernel: one table lookup and one accumulator append per symbol.
+*/
+void encode_symbols_scalar(BitSink *sink, const EncodeTable *table, const uint8_t *in, size_t n) {
+    while (n > 0) {
+        size_t k = n < ENCODE_CHUNK ? n : ENCODE_CHUNK;
+        bit_sink_reserve(sink, encode_chunk_bytes(table, k));
+        encode_run(sink, table->codes, in, k);
+        in += k;
+        n -= k;
+    }
+}
+
+static inline void encode_packed_add(uint64_t *acc, uint32_t *nbits, uint32_t entry) {
+    *acc |= (uint64_t) (entry & 0xffffff) << *nbits;
+    *nbits += entry >> 24;
+}
+
+static inline void encode_packed_spill(uint8_t **out, uint64_t *acc, uint32_t *nbits) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(*out, acc, sizeof(*acc));
+#else
+    for (int i = 0; i < 8; i++) {
+        (*out)[i] = (uint8_t) (*acc >> (8 * i));
+    }
+#endif
+    *out += *nbits >> 3;
+    *acc >>= *nbits & ~7u;
+    *nbits &= 7;
+}
+
+/*
+Four symbols per step from the packed table, with no branches on the data: the codes go into a
+local accumulator and whole bytes are stored once per group, or once per pair when four codes
+might not fit in the 56 bits the accumulator has room for. Tables with codes over
+ENCODE_PACKED_MAX bits take the reference path. Inlined into each packed kernel, so that each is
+compiled for its own instruction set.
+*/
+static inline __attribute__((always_inline)) void encode_packed_body(
+    BitSink *sink, const EncodeTable *table, const uint8_t *in, size_t n) {
+    if (table->max_length > ENCODE_PACKED_MAX) {
+        encode_symbols_scalar(sink, table, in, n);
+        return;
+    }
+
+    const uint32_t *packed = table->packed;
+    const bool pairs = 4 * table->max_length > 56;
+
+    while (n > 0) {
+        size_t k = n < ENCODE_CHUNK ? n : ENCODE_CHUNK;
+        bit_sink_reserve(sink, encode_chunk_bytes(table, k));
+
+        uint8_t *out = sink->buf + sink->pos;
+        uint64_t acc = sink->acc;
+        uint32_t nbits = sink->nbits;
+        size_t i = 0;
+        if (pairs) {
+            for (; i + 4 <= k; i += 4) {
+                encode_packed_add(&acc, &nbits, packed[in[i]]);
+                encode_packed_add(&acc, &nbits, packed[in[i + 1]]);
+                encode_packed_spill(&out, &acc, &nbits);
+                encode_packed_add(&acc, &nbits, packed[in[i + 2]]);
+                encode_packed_add(&acc, &nbits, packed[in[i + 3]]);
+                encode_packed_spill(&out, &acc, &nbits);
+            }
+        } else {
+            for (; i + 4 <= k; i += 4) {
+                encode_packed_add(&acc, &nbits, packed[in[i]]);
+                encode_packed_add(&acc, &nbits, packed[in[i + 1]]);
+                encode_packed_add(&acc, &nbits, packed[in[i + 2]]);
+                encode_packed_add(&acc, &nbits, packed[in[i + 3]]);
+                encode_packed_spill(&out, &acc, &nbits);
+            }
+        }
+        for (; i < k; i++) {
+            encode_packed_add(&acc, &nbits, packed[in[i]]);
+            encode_packed_spill(&out, &acc, &nbits);
+        }
+        sink->pos = (size_t) (out - sink->buf);
+        sink->acc = acc;
+        sink->nbits = nbits;
+
+        in += k;
+        n -= k;
+    }
+}
+
+void encode_symbols_packed(BitSink *sink, const EncodeTable *table, const uint8_t *in, size_t n) {
+    encode_packed_body(sink, table, in, n);
+}
+
+#ifdef ENCODE_X86
+
+/*
+The packed kernel with BMI2, whose shlx and shrx shift the accumulator by a variable count without
+going through cl.
+*/
+__attribute__((target("bmi2"))) void encode_symbols_packed_bmi2(
+    BitSink *sink, const EncodeTable *table, const uint8_t *in, size_t n) {
+    encode_packed_body(sink, table, in, n);
+}
+
+static EncodeKernel encode_select_packed(void) {
+    return (cpu_features() & CPU_BMI2) ? encode_symbols_packed_bmi2 : encode_symbols_packed;
+}
+
+#else
+
+void encode_symbols_packed_bmi2(
+    BitSink *sink, const EncodeTable *table, const uint8_t *in, size_t n) {
+    encode_symbols_packed(sink, table, in, n);
+}
+
+static EncodeKernel encode_select_packed(void) {
+    return encode_symbols_packed;
+}
+
+#endif
+
+/*
+Encode n bytes with the fastest kernel for the table: the packed kernel, as cpu_features() allows,
+when its codes fit, and otherwise the reference kernel. Every kernel produces the same bits.
+*/
+void encode_symbols(BitSink *sink, const EncodeTable *table, const uint8_t *in, size_t n) {
+    if (table->max_length <= ENCODE_PACKED_MAX) {
+        encode_select_packed()(sink, table, in, n);
+        return;
+    }
+    encode_symbols_scalar(sink, table, in, n);
+}
+
+/*
+* One task's share of an encode_symbols_parallel() call.  bits, from the
+* slice's own histogram, places it at offset bits into the output; its
+* first bytes go to head and the rest straight into the sink's buffer, and
+* tail is its last partial byte.
+*/
+typedef struct EncodeSlice {
+    const uint8_t *in;
+    size_t n;
+    uint64_t bits;
+    uint64_t offset;
+    uint32_t histogram[256];
+    uint8_t head[24];
+    size_t head_len;
+    uint64_t tail;
+} EncodeSlice;
+
+typedef struct EncodeParallel {
+    const EncodeTable *table;
+    EncodeSlice *slices;
+    uint8_t *base;
+    BitSink **heads;
+} EncodeParallel;
+
+/*
+Count a slice's symbols and, from the code lengths, the exact number of bits they take.
+*/
+static void encode_slice_measure(void *arg, size_t index, unsigned worker) {
+    (void) worker;
+    EncodeParallel *p = (EncodeParallel *) arg;
+    EncodeSlice *slice = &p->slices[index];
+    memset(slice->histogram, 0, sizeof(slice->histogram));
+    histogram_add(slice->in, slice->n, slice->histogram);
+    slice->bits = 0;
+    for (int s = 0; s < 256; s++) {
+        slice->bits += (uint64_t) slice->histogram[s] * p->table->codes[s].code_length;
+    }
+}
+
+/*
+Encode a slice at its bit offset. The kernels store 8 bytes at a time, so the slice before this
+one may overwrite up to 7 bytes past its end, which are this slice's first; those are coded into
+head instead, at least 8 bytes of them, and the rest go into the sink's buffer, where no other
+slice writes. The sink's capacity is the worst case for the symbols that are left, so that
+bit_sink_reserve() never moves the buffer; only the exact bytes and 8 past them are stored.
+*/
+static void encode_slice_encode(void *arg, size_t index, unsigned worker) {
+    EncodeParallel *p = (EncodeParallel *) arg;
+    EncodeSlice *slice = &p->slices[index];
+    BitSink *head = p->heads[worker];
+    head->pos = 0;
+    head->acc = 0;
+    head->nbits = (uint32_t) (slice->offset & 7);
+
+    size_t i = 0;
+    while (i < slice->n && head->pos < 8) {
+        encode_symbols(head, p->table, slice->in + i++, 1);
+    }
+    memcpy(slice->head, head->buf, head->pos);
+    slice->head_len = head->pos;
+    slice->tail = head->acc;
+    if (i == slice->n) {
+        return;
+    }
+
+    BitSink direct = { NULL, p->base + (slice->offset >> 3), 0, head->pos, head->acc, head->nbits };
+    direct.cap = direct.pos + (slice->n - i) * p->table->max_length / 8 + 32;
+    encode_symbols(&direct, p->table, slice->in + i, slice->n - i);
+    slice->tail = direct.acc;
+}
+
+/*
+Encode n bytes on num_workers threads, in slices of ENCODE_SLICE bytes, into exactly the bytes
+encode_symbols() would write. Each slice's length is measured first, so the whole output can be
+reserved in sink and each slice given its offset before any is encoded; then the heads are merged
+in order, each OR-ed with the partial byte before it. If counts is not NULL the bytes are also
+counted into it, from the slices' histograms.
+*/
+void encode_symbols_parallel(BitSink *sink, const EncodeTable *table, const uint8_t *in, size_t n,
+    uint32_t *counts, unsigned num_workers) {
+    size_t count = (n + ENCODE_SLICE - 1) / ENCODE_SLICE;
+    if (count == 0) {
+        return;
+    }
+    if (num_workers > count) {
+        num_workers = (unsigned) count;
+    }
+    EncodeSlice *slices = (EncodeSlice *) malloc(count * sizeof(EncodeSlice));
+    BitSink **heads = (BitSink **) calloc(num_workers, sizeof(BitSink *));
+    bool ok = slices != NULL && heads != NULL;
+    for (unsigned w = 0; ok && w < num_workers; w++) {
+        heads[w] = bit_sink_open(NULL);
+        ok = heads[w] != NULL;
+    }
+    if (!ok) {
+        fprintf(stderr, "huff:  unable to allocate memory\n");
+        exit(1);
+    }
+
+    EncodeParallel p = { table, slices, NULL, heads };
+    for (size_t i = 0; i < count; i++) {
+        slices[i].in = in + i * ENCODE_SLICE;
+        slices[i].n = i + 1 < count ? ENCODE_SLICE : n - i * ENCODE_SLICE;
+    }
+    pool_for(num_workers, count, encode_slice_measure, &p);
+
+    uint64_t offset = sink->nbits;
+    for (size_t i = 0; i < count; i++) {
+        slices[i].offset = offset;
+        offset += slices[i].bits;
+        for (int s = 0; counts != NULL && s < 256; s++) {
+            counts[s] += slices[i].histogram[s];
+        }
+    }
+    bit_sink_reserve(sink, (size_t) (offset >> 3) + 16);
+    p.base = sink->buf + sink->pos;
+    pool_for(num_workers, count, encode_slice_encode, &p);
+
+    uint64_t carry = sink->acc;
+    for (size_t i = 0; i < count; i++) {
+        if (slices[i].head_len == 0) {
+            carry |= slices[i].tail;
+            continue;
+        }
+        uint8_t *out = p.base + (slices[i].offset >> 3);
+        out[0] = (uint8_t) (slices[i].head[0] | carry);
+        memcpy(out + 1, slices[i].head + 1, slices[i].head_len - 1);
+        carry = slices[i].tail;
+    }
+    sink->pos += (size_t) (offset >> 3);
+    sink->acc = carry;
+    sink->nbits = (uint32_t) (offset & 7);
+
+    for (unsigned w = 0; w < num_workers; w++) {
+        bit_sink_close(&heads[w]);
+    }
+    free(heads);
+    free(slices);
+}
@@ -0,0 +1,96 @@
+#ifndef _ENCODE_H
+#define _ENCODE_H
+
+/*
+* File:     encode.h
+* Purpose:  Header file for encode.c, the buffered bit sink and the
+*           symbol encode kernels used by huff.
+*/
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef struct Code {
+    uint64_t code;
+    uint8_t code_length;
+} Code;
+
+/*
+* The code table in the layout the encode kernels want.  packed[] holds
+* each code in its low 24 bits, already in accumulator order, and its
+* length in the top 8, so the whole table is 1 KB; it is only valid when
+* max_length <= ENCODE_PACKED_MAX.
+*/
+#define ENCODE_PACKED_MAX 24
+
+typedef struct EncodeTable {
+    const Code *codes;
+    uint32_t packed[256];
+    uint8_t max_length;
+} EncodeTable;
+
+/*
+* Bits are collected LSB first in acc and spilled to buf a whole byte at a
+* time, which gives exactly the byte stream that BitWriter produces.  When
+* stream is not NULL the buffer is drained to it whenever it fills;
+* otherwise the buffer grows.
+*/
+typedef struct BitSink {
+    FILE *stream;
+    uint8_t *buf;
+    size_t cap;
+    size_t pos;
+    uint64_t acc;
+    uint32_t nbits;
+} BitSink;
+
+BitSink *bit_sink_open(FILE *stream);
+void bit_sink_close(BitSink **psink);
+void bit_sink_reset(BitSink *sink, FILE *stream);
+void bit_sink_reserve(BitSink *sink, size_t bytes);
+void bit_sink_put(BitSink *sink, uint64_t bits, uint8_t length);
+void bit_sink_write(BitSink *sink, const uint8_t *data, size_t size);
+void bit_sink_sync(BitSink *sink);
+void bit_sink_flush(BitSink *sink);
+
+/*
+Append length bits to the accumulator. The accumulator holds fewer than 8 bits between calls, so
+length may be up to 56. Whole bytes are spilled with one unaligned 8-byte store; the caller must
+have reserved room for it with bit_sink_reserve().
+*/
+static inline void bit_sink_append(BitSink *sink, uint64_t bits, uint32_t length) {
+    sink->acc |= bits << sink->nbits;
+    sink->nbits += length;
+    if (sink->nbits >= 8) {
+        uint32_t bytes = sink->nbits >> 3;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        memcpy(sink->buf + sink->pos, &sink->acc, sizeof(sink->acc));
+#else
+        for (int i = 0; i < 8; i++) {
+            sink->buf[sink->pos + i] = (uint8_t) (sink->acc >> (8 * i));
+        }
+#endif
+        sink->pos += bytes;
+        sink->acc >>= 8 * bytes;
+        sink->nbits &= 7;
+    }
+}
+
+/*
+* Bytes of input per task of encode_symbols_parallel().
+*/
+#define ENCODE_SLICE (1u << 20)
+
+void encode_table_init(EncodeTable *table, const Code *codes);
+
+void encode_symbols(BitSink *sink, const EncodeTable *table, const uint8_t *in, size_t n);
+void encode_symbols_parallel(BitSink *sink, const EncodeTable *table, const uint8_t *in, size_t n,
+    uint32_t *counts, unsigned num_workers);
+void encode_symbols_scalar(BitSink *sink, const EncodeTable *table, const uint8_t *in, size_t n);
+void encode_symbols_packed(BitSink *sink, const EncodeTable *table, const uint8_t *in, size_t n);
+void encode_symbols_packed_bmi2(
+    BitSink *sink, const EncodeTable *table, const uint8_t *in, size_t n);
+
+#endif
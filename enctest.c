@@ -0,0 +1,217 @@
+/*
+* File:     enctest.c
+* Purpose:  Test encode.c
+*/
+
+#include "bitwriter.h"
+#include "cpu.h"
+#include "encode.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define N_SYMBOLS 100003
+
+/*
+* A small deterministic generator so that failures are repeatable.
+*/
+static uint32_t rng_state = 12345;
+
+static uint32_t rng(void) {
+    rng_state = rng_state * 1103515245u + 12345u;
+    return rng_state >> 8;
+}
+
+/*
+* Give every symbol a random code with a length between 1 and max_length.
+* The kernels do not care whether the code is prefix-free.
+*/
+static void make_codes(Code *codes, uint8_t max_length) {
+    for (int i = 0; i < 256; i++) {
+        uint8_t length = (uint8_t) (1 + rng() % max_length);
+        uint64_t code = ((uint64_t) rng() << 32) | rng();
+        codes[i].code_length = length;
+        codes[i].code = code & ((length == 64) ? ~(uint64_t) 0 : (((uint64_t) 1 << length) - 1));
+    }
+}
+
+/*
+* Encode with BitWriter, one bit at a time, and return the bytes it wrote.
+*/
+static uint8_t *reference(const Code *codes, const uint8_t *in, size_t n, size_t *size) {
+    BitWriter *bw = bit_write_open("enctest.out");
+    assert(bw);
+    for (size_t i = 0; i < n; i++) {
+        uint64_t code = codes[in[i]].code;
+        for (uint8_t b = 0; b < codes[in[i]].code_length; b++) {
+            bit_write_bit(bw, (uint8_t) ((code >> b) & 1));
+        }
+    }
+    bit_write_close(&bw);
+
+    FILE *f = fopen("enctest.out", "rb");
+    assert(f);
+    fseek(f, 0, SEEK_END);
+    *size = (size_t) ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = (uint8_t *) malloc(*size + 1);
+    assert(data);
+    assert(fread(data, 1, *size, f) == *size);
+    fclose(f);
+    return data;
+}
+
+static void check(const char *name,
+    void (*kernel)(BitSink *, const EncodeTable *, const uint8_t *, size_t), const Code *codes,
+    const uint8_t *in, size_t n, bool verbose) {
+    size_t expect_size;
+    uint8_t *expect = reference(codes, in, n, &expect_size);
+
+    EncodeTable table;
+    encode_table_init(&table, codes);
+
+    /*
+    * Feed the input in uneven pieces so that group tails are exercised.
+    */
+    BitSink *sink = bit_sink_open(NULL);
+    assert(sink);
+    size_t done = 0;
+    size_t piece = 1;
+    while (done < n) {
+        size_t k = (n - done < piece) ? n - done : piece;
+        kernel(sink, &table, in + done, k);
+        done += k;
+        piece = piece * 3 + 1;
+    }
+    bit_sink_flush(sink);
+
+    if (verbose)
+        printf("%-11s max length %2u: %zu bytes\n", name, table.max_length, sink->pos);
+
+    assert(sink->pos == expect_size);
+    assert(memcmp(sink->buf, expect, expect_size) == 0);
+
+    bit_sink_close(&sink);
+    assert(sink == NULL);
+    free(expect);
+}
+
+/*
+* Encode n symbols after lead_bits bits with encode_symbols_parallel() on
+* 1 to 4 workers, and check that every result, a few bits appended after
+* it, and the counts match encode_symbols() on one thread.
+*/
+static void check_parallel(
+    const Code *codes, const uint8_t *in, size_t n, uint8_t lead_bits, bool verbose) {
+    EncodeTable table;
+    encode_table_init(&table, codes);
+
+    uint32_t expect_counts[256] = { 0 };
+    for (size_t i = 0; i < n; i++) {
+        ++expect_counts[in[i]];
+    }
+    BitSink *expect = bit_sink_open(NULL);
+    assert(expect);
+    bit_sink_put(expect, 0x2d, lead_bits);
+    encode_symbols(expect, &table, in, n);
+    bit_sink_put(expect, 0x5, 3);
+    bit_sink_flush(expect);
+
+    for (unsigned workers = 1; workers <= 4; workers++) {
+        uint32_t counts[256] = { 0 };
+        BitSink *sink = bit_sink_open(NULL);
+        assert(sink);
+        bit_sink_put(sink, 0x2d, lead_bits);
+        encode_symbols_parallel(sink, &table, in, n, counts, workers);
+        bit_sink_put(sink, 0x5, 3);
+        bit_sink_flush(sink);
+
+        if (verbose)
+            printf("parallel x%u max length %2u, %zu symbols: %zu bytes\n", workers,
+                table.max_length, n, sink->pos);
+
+        assert(sink->pos == expect->pos);
+        assert(memcmp(sink->buf, expect->buf, expect->pos) == 0);
+        assert(memcmp(counts, expect_counts, sizeof(counts)) == 0);
+        bit_sink_close(&sink);
+    }
+    bit_sink_close(&expect);
+}
+
+int main(int argc, char **argv) {
+    /*
+    * Poor man's argument checking: is "-v" the first command-line argument?
+    * Ignore all other arguments.
+    */
+    bool verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+
+    if (!verbose)
+        printf("Use \"enctest -v\" to print trace information.\n");
+
+    uint8_t *in = (uint8_t *) malloc(N_SYMBOLS);
+    assert(in);
+
+    /*
+    * Codes of up to ENCODE_PACKED_MAX bits take the packed kernels and
+    * longer ones, past 32 bits too, the reference kernel. Kernels this CPU
+    * (or HUFF_CPU) does not allow are skipped.
+    */
+    uint8_t max_lengths[] = { 1, 4, 8, 14, 20, 32, 46 };
+    for (size_t m = 0; m < sizeof(max_lengths); m++) {
+        Code codes[256];
+        make_codes(codes, max_lengths[m]);
+        for (size_t i = 0; i < N_SYMBOLS; i++) {
+            in[i] = (uint8_t) ((m & 1) ? rng() : rng() % 7);
+        }
+        check("scalar", encode_symbols_scalar, codes, in, N_SYMBOLS, verbose);
+        check("packed", encode_symbols_packed, codes, in, N_SYMBOLS, verbose);
+        if (cpu_features() & CPU_BMI2)
+            check("packed+bmi2", encode_symbols_packed_bmi2, codes, in, N_SYMBOLS, verbose);
+        check("dispatch", encode_symbols, codes, in, N_SYMBOLS, verbose);
+    }
+
+    /*
+    * Parallel encoding must give the same bytes whatever the number of
+    * workers, for inputs just either side of a slice boundary and for ones
+    * whose last slice is a few symbols, at every starting bit offset.
+    */
+    size_t sizes[] = { ENCODE_SLICE - 1, ENCODE_SLICE + 1, 3 * ENCODE_SLICE + 12345 };
+    uint8_t *big = (uint8_t *) malloc(sizes[2]);
+    assert(big);
+    for (size_t m = 0; m < sizeof(max_lengths); m++) {
+        Code codes[256];
+        make_codes(codes, max_lengths[m]);
+        for (size_t i = 0; i < sizes[2]; i++) {
+            big[i] = (uint8_t) ((m & 1) ? rng() : rng() % 7);
+        }
+        for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+            check_parallel(codes, big, sizes[k], (uint8_t) ((m * 3 + k) % 8), verbose);
+        }
+    }
+    free(big);
+
+    /*
+    * A sink attached to a stream drains instead of growing.
+    */
+    FILE *f = tmpfile();
+    assert(f);
+    BitSink *sink = bit_sink_open(f);
+    for (int i = 0; i < 100000; i++) {
+        bit_sink_put(sink, 0xa5, 8);
+    }
+    assert(sink->cap == 1 << 16);
+    bit_sink_flush(sink);
+    assert(ftell(f) == 100000);
+    bit_sink_close(&sink);
+    fclose(f);
+
+    free(in);
+    remove("enctest.out");
+
+    printf("enctest, as it is, reports no errors\n");
+    return 0;
+}
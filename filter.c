@@ -0,0 +1,250 @@
+#include "filter.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define FILTER_X86 1
+#include <emmintrin.h>
+#endif
+
+/*
+Return whether filters and stride describe a transform that filter_apply() knows.
+*/
+bool filter_valid(uint8_t filters, uint8_t stride) {
+    return (filters & ~(FILTER_DELTA | FILTER_SHUFFLE)) == 0
+           && (stride == 1 || stride == 2 || stride == 4 || stride == 8);
+}
+
+/*
+Parse a filter as huff -f takes it: "delta", "shuffle" or "delta+shuffle", then ':' and the stride
+in bytes, as in "delta+shuffle:4". Return false if text is not of that form.
+*/
+bool filter_parse(const char *text, uint8_t *filters, uint8_t *stride) {
+    static const struct {
+        const char *name;
+        uint8_t filters;
+    } names[] = {
+        { "delta:", FILTER_DELTA },
+        { "shuffle:", FILTER_SHUFFLE },
+        { "delta+shuffle:", FILTER_DELTA | FILTER_SHUFFLE },
+    };
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        size_t len = strlen(names[i].name);
+        if (strncmp(text, names[i].name, len) == 0) {
+            char *end;
+            unsigned long value = strtoul(text + len, &end, 10);
+            if (*end != '\0' || value > FILTER_MAX_STRIDE
+                || !filter_valid(names[i].filters, (uint8_t) value)) {
+                return false;
+            }
+            *filters = names[i].filters;
+            *stride = (uint8_t) value;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+Return the number of separately coded planes a filtered buffer is made of.
+*/
+unsigned filter_plane_count(uint8_t filters, uint8_t stride) {
+    return (filters & FILTER_SHUFFLE) ? stride : 1;
+}
+
+/*
+Return the size of a plane of a filtered buffer of n bytes, and where it starts in *start.
+*/
+size_t filter_plane(uint8_t filters, uint8_t stride, size_t n, unsigned plane, size_t *start) {
+    if (!(filters & FILTER_SHUFFLE)) {
+        *start = 0;
+        return n;
+    }
+    size_t elements = n / stride;
+    *start = plane * elements;
+    return plane + 1 == stride ? n - *start : elements;
+}
+
+static inline uint64_t load_element(const uint8_t *p, unsigned stride) {
+    uint64_t value = 0;
+    for (unsigned i = 0; i < stride; i++) {
+        value |= (uint64_t) p[i] << (8 * i);
+    }
+    return value;
+}
+
+static inline void store_element(uint8_t *p, uint64_t value, unsigned stride) {
+    for (unsigned i = 0; i < stride; i++) {
+        p[i] = (uint8_t) (value >> (8 * i));
+    }
+}
+
+/*
+Turn elements into differences in place. Called with a constant stride, so each use unrolls.
+*/
+static inline void delta_encode(uint8_t *data, size_t elements, unsigned stride) {
+    uint64_t prev = 0;
+    for (size_t i = 0; i < elements; i++) {
+        uint64_t value = load_element(data + i * stride, stride);
+        store_element(data + i * stride, value - prev, stride);
+        prev = value;
+    }
+}
+
+/*
+Turn differences back into elements in place, a running sum.
+*/
+static inline void delta_decode(uint8_t *data, size_t elements, unsigned stride) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < elements; i++) {
+        sum += load_element(data + i * stride, stride);
+        store_element(data + i * stride, sum, stride);
+    }
+}
+
+static void delta(uint8_t *data, size_t elements, unsigned stride, bool invert) {
+    switch (stride) {
+    case 1: invert ? delta_decode(data, elements, 1) : delta_encode(data, elements, 1); break;
+    case 2: invert ? delta_decode(data, elements, 2) : delta_encode(data, elements, 2); break;
+    case 4: invert ? delta_decode(data, elements, 4) : delta_encode(data, elements, 4); break;
+    default: invert ? delta_decode(data, elements, 8) : delta_encode(data, elements, 8); break;
+    }
+}
+
+/*
+Gather the elements from their byte planes, starting at element first.
+*/
+static void unshuffle_scalar(
+    const uint8_t *in, uint8_t *out, size_t elements, unsigned stride, size_t first) {
+    for (unsigned p = 0; p < stride; p++) {
+        const uint8_t *plane = in + p * elements;
+        for (size_t i = first; i < elements; i++) {
+            out[i * stride + p] = plane[i];
+        }
+    }
+}
+
+#ifdef FILTER_X86
+
+/*
+Interleave the planes sixteen elements at a time: unpacking bytes, then 16-bit pairs, then 32-bit
+quads puts element i's bytes side by side. Return the number of elements done.
+*/
+static size_t unshuffle_sse2(const uint8_t *in, uint8_t *out, size_t elements, unsigned stride) {
+    size_t i = 0;
+    if (stride == 2) {
+        for (; i + 16 <= elements; i += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i *) (in + i));
+            __m128i b = _mm_loadu_si128((const __m128i *) (in + elements + i));
+            _mm_storeu_si128((__m128i *) (out + 2 * i), _mm_unpacklo_epi8(a, b));
+            _mm_storeu_si128((__m128i *) (out + 2 * i + 16), _mm_unpackhi_epi8(a, b));
+        }
+    } else if (stride == 4) {
+        for (; i + 16 <= elements; i += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i *) (in + i));
+            __m128i b = _mm_loadu_si128((const __m128i *) (in + elements + i));
+            __m128i c = _mm_loadu_si128((const __m128i *) (in + 2 * elements + i));
+            __m128i d = _mm_loadu_si128((const __m128i *) (in + 3 * elements + i));
+            __m128i ab_lo = _mm_unpacklo_epi8(a, b);
+            __m128i ab_hi = _mm_unpackhi_epi8(a, b);
+            __m128i cd_lo = _mm_unpacklo_epi8(c, d);
+            __m128i cd_hi = _mm_unpackhi_epi8(c, d);
+            uint8_t *o = out + 4 * i;
+            _mm_storeu_si128((__m128i *) o, _mm_unpacklo_epi16(ab_lo, cd_lo));
+            _mm_storeu_si128((__m128i *) (o + 16), _mm_unpackhi_epi16(ab_lo, cd_lo));
+            _mm_storeu_si128((__m128i *) (o + 32), _mm_unpacklo_epi16(ab_hi, cd_hi));
+            _mm_storeu_si128((__m128i *) (o + 48), _mm_unpackhi_epi16(ab_hi, cd_hi));
+        }
+    } else if (stride == 8) {
+        for (; i + 16 <= elements; i += 16) {
+            __m128i v[8];
+            for (int p = 0; p < 8; p++) {
+                v[p] = _mm_loadu_si128((const __m128i *) (in + (size_t) p * elements + i));
+            }
+            __m128i pairs[8], quads[8];
+            for (int p = 0; p < 4; p++) {
+                pairs[2 * p] = _mm_unpacklo_epi8(v[2 * p], v[2 * p + 1]);
+                pairs[2 * p + 1] = _mm_unpackhi_epi8(v[2 * p], v[2 * p + 1]);
+            }
+            for (int h = 0; h < 2; h++) {
+                quads[4 * h] = _mm_unpacklo_epi16(pairs[h], pairs[2 + h]);
+                quads[4 * h + 1] = _mm_unpackhi_epi16(pairs[h], pairs[2 + h]);
+                quads[4 * h + 2] = _mm_unpacklo_epi16(pairs[4 + h], pairs[6 + h]);
+                quads[4 * h + 3] = _mm_unpackhi_epi16(pairs[4 + h], pairs[6 + h]);
+            }
+            uint8_t *o = out + 8 * i;
+            for (int q = 0; q < 2; q++) {
+                for (int k = 0; k < 2; k++) {
+                    __m128i lo = quads[4 * q + k];
+                    __m128i hi = quads[4 * q + 2 + k];
+                    _mm_storeu_si128((__m128i *) o, _mm_unpacklo_epi32(lo, hi));
+                    _mm_storeu_si128((__m128i *) (o + 16), _mm_unpackhi_epi32(lo, hi));
+                    o += 32;
+                }
+            }
+        }
+    }
+    return i;
+}
+
+#else
+
+static size_t unshuffle_sse2(const uint8_t *in, uint8_t *out, size_t elements, unsigned stride) {
+    (void) in;
+    (void) out;
+    (void) elements;
+    (void) stride;
+    return 0;
+}
+
+#endif
+
+/*
+Filter n bytes of in into out, which must not overlap it. A delta is taken as the elements are
+scattered to their planes.
+*/
+void filter_apply(uint8_t filters, uint8_t stride, const uint8_t *in, uint8_t *out, size_t n) {
+    size_t elements = n / stride;
+    size_t whole = elements * stride;
+
+    if (!(filters & FILTER_SHUFFLE)) {
+        memcpy(out, in, n);
+        if (filters & FILTER_DELTA) {
+            delta(out, elements, stride, false);
+        }
+        return;
+    }
+
+    uint64_t prev = 0;
+    for (size_t i = 0; i < elements; i++) {
+        uint64_t value = load_element(in + i * stride, stride);
+        uint64_t diff = (filters & FILTER_DELTA) ? value - prev : value;
+        prev = value;
+        for (unsigned p = 0; p < stride; p++) {
+            out[p * elements + i] = (uint8_t) (diff >> (8 * p));
+        }
+    }
+    memcpy(out + whole, in + whole, n - whole);
+}
+
+/*
+Undo filter_apply(): filter n bytes of in back into out, which must not overlap it. The planes are
+interleaved with SSE2 where there is, and the running sum of a delta taken in the same buffer.
+*/
+void filter_invert(uint8_t filters, uint8_t stride, const uint8_t *in, uint8_t *out, size_t n) {
+    size_t elements = n / stride;
+    size_t whole = elements * stride;
+
+    if ((filters & FILTER_SHUFFLE) && stride > 1) {
+        size_t done = unshuffle_sse2(in, out, elements, stride);
+        unshuffle_scalar(in, out, elements, stride, done);
+        memcpy(out + whole, in + whole, n - whole);
+    } else {
+        memcpy(out, in, n);
+    }
+    if (filters & FILTER_DELTA) {
+        delta(out, elements, stride, true);
+    }
+}
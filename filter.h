@@ -0,0 +1,41 @@
+#ifndef _FILTER_H
+#define _FILTER_H
+
+/*
+* File:     filter.h
+* Purpose:  Header file for filter.c, reversible transforms applied before
+*           the histogram for data made of fixed-width values, such as
+*           binary telemetry of little-endian integers and floats.
+*
+* The input is taken as elements of stride bytes, stride being 1, 2, 4 or
+* 8; a tail of fewer than stride bytes is passed through unchanged.
+*
+* FILTER_DELTA    replaces each element with its difference from the one
+*                 before, as a little-endian integer modulo 2^(8*stride),
+*                 so slowly changing counters become small numbers.
+* FILTER_SHUFFLE  splits the elements into stride byte planes, all first
+*                 bytes, then all second bytes and so on, so that each
+*                 byte position can have its own code.  The tail goes at
+*                 the end of the last plane.
+*
+* Both may be set, in which case the delta is taken first.
+*/
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define FILTER_DELTA   1
+#define FILTER_SHUFFLE 2
+
+#define FILTER_MAX_STRIDE 8
+
+bool filter_valid(uint8_t filters, uint8_t stride);
+bool filter_parse(const char *text, uint8_t *filters, uint8_t *stride);
+unsigned filter_plane_count(uint8_t filters, uint8_t stride);
+size_t filter_plane(uint8_t filters, uint8_t stride, size_t n, unsigned plane, size_t *start);
+
+void filter_apply(uint8_t filters, uint8_t stride, const uint8_t *in, uint8_t *out, size_t n);
+void filter_invert(uint8_t filters, uint8_t stride, const uint8_t *in, uint8_t *out, size_t n);
+
+#endif
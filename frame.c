@@ -0,0 +1,377 @@
+#include "frame.h"
+
+#include "compact.h"
+#include "filter.h"
+#include "huffman.h"
+#include "lz77.h"
+#include "wide.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+Write the header of a frame that carries its own tree: 'H' 'C', the file size, the number of
+leaves, and the tree.
+*/
+void frame_write_tree_header(BitSink *outbuf, uint32_t filesize, uint16_t num_leaves, Node *tree) {
+    bit_sink_put(outbuf, 'H', 8);
+    bit_sink_put(outbuf, 'C', 8);
+    bit_sink_put(outbuf, filesize, 32);
+    bit_sink_put(outbuf, num_leaves, 16);
+    huff_write_tree(outbuf, tree);
+}
+
+/*
+Write the header of a frame that names a dictionary table instead of carrying a tree: 'H' 'D', the
+dictionary id, the table number and the file size.
+*/
+void frame_write_dict_header(
+    BitSink *outbuf, uint32_t filesize, const Dictionary *dict, uint8_t table_id) {
+    bit_sink_put(outbuf, 'H', 8);
+    bit_sink_put(outbuf, 'D', 8);
+    bit_sink_put(outbuf, dict->id, 32);
+    bit_sink_put(outbuf, table_id, 8);
+    bit_sink_put(outbuf, filesize, 32);
+}
+
+/*
+Write the header of an adaptive frame: just 'H' 'V'. The coded symbols follow, up to the end
+symbol, with no size or table.
+*/
+void frame_write_adaptive_header(BitSink *outbuf) {
+    bit_sink_put(outbuf, 'H', 8);
+    bit_sink_put(outbuf, 'V', 8);
+}
+
+/*
+Write the header of a block frame: just 'H' 'B'. Blocks follow, as block.h describes.
+*/
+void frame_write_block_header(BitSink *outbuf) {
+    bit_sink_put(outbuf, 'H', 8);
+    bit_sink_put(outbuf, 'B', 8);
+}
+
+/*
+Compress size bytes of memory into one frame, exactly as huff does a file of the same contents.
+*/
+void frame_compress(BitSink *outbuf, const uint8_t *data, uint32_t size, const Dictionary *dict) {
+    uint32_t histogram[256];
+    fill_histogram_buffer(data, size, histogram);
+
+    EncodeTable table;
+    if (dict != NULL) {
+        uint8_t table_id = dict_select(dict, histogram);
+        frame_write_dict_header(outbuf, size, dict, table_id);
+        encode_table_init(&table, dict->codes[table_id]);
+        encode_symbols(outbuf, &table, data, size);
+        return;
+    }
+
+    uint16_t num_leaves = 0;
+    Node *code_tree = create_tree(histogram, &num_leaves);
+    Code code_table[256];
+    memset(code_table, 0, sizeof(code_table));
+    fill_code_table(code_table, code_tree, 0, 0);
+
+    frame_write_tree_header(outbuf, size, num_leaves, code_tree);
+    encode_table_init(&table, code_table);
+    encode_symbols(outbuf, &table, data, size);
+
+    node_free(&code_tree);
+}
+
+/*
+Return the bytes of the frame huff would write for a file of size bytes whose histogram, counted as
+fill_histogram() counts it, is histogram: an 'HK' frame if compact is set, an 'HD' frame if dict is
+not NULL, and otherwise an 'HC' frame. The table is built and its header written to scratch, but
+nothing is coded: the codes cost the sum over symbols of their count times their code length. The
+counts are counts, or histogram less the extra 0x00 and 0xff if counts is NULL; a table built from
+a sample is costed against counts scaled up from it. Return UINT64_MAX if the table has no code for
+a symbol that occurs.
+*/
+uint64_t frame_estimate(const uint32_t *histogram, const uint32_t *counts, uint32_t size,
+    const Dictionary *dict, int compact, BitSink *scratch) {
+    uint32_t table_histogram[256];
+    uint32_t exact[256];
+    memcpy(table_histogram, histogram, sizeof(table_histogram));
+    memcpy(exact, counts != NULL ? counts : histogram, sizeof(exact));
+    if (counts == NULL) {
+        --exact[0x00];
+        --exact[0xff];
+    }
+
+    Code codes[256];
+    memset(codes, 0, sizeof(codes));
+    bit_sink_reset(scratch, NULL);
+    if (compact) {
+        --table_histogram[0x00];
+        --table_histogram[0xff];
+        uint8_t lengths[256];
+        compact_lengths(table_histogram, lengths);
+        compact_codes(lengths, codes);
+        frame_write_compact_header(scratch, size, lengths);
+    } else if (dict != NULL) {
+        uint8_t table_id = dict_select(dict, table_histogram);
+        frame_write_dict_header(scratch, size, dict, table_id);
+        memcpy(codes, dict->codes[table_id], sizeof(codes));
+    } else {
+        uint16_t num_leaves = 0;
+        Node *tree = create_tree(table_histogram, &num_leaves);
+        fill_code_table(codes, tree, 0, 0);
+        frame_write_tree_header(scratch, size, num_leaves, tree);
+        node_free(&tree);
+    }
+
+    uint64_t code_bits = huff_cost(exact, codes);
+    if (code_bits == UINT64_MAX) {
+        return UINT64_MAX;
+    }
+    return (8 * (uint64_t) scratch->pos + scratch->nbits + code_bits + 7) / 8;
+}
+
+/*
+Write the header of a compact frame: 'H' 'K', the file size as a varint, and unless the file is
+empty the code lengths in the form compact.h describes.
+*/
+void frame_write_compact_header(BitSink *outbuf, uint32_t filesize, const uint8_t *lengths) {
+    bit_sink_put(outbuf, 'H', 8);
+    bit_sink_put(outbuf, 'K', 8);
+    compact_write_varint(outbuf, filesize);
+    if (filesize > 0) {
+        compact_write_lengths(outbuf, lengths);
+    }
+}
+
+/*
+Compress size bytes of memory into one compact frame, whose header is a fraction of the size of an
+'HC' frame's: worth it for messages of a few hundred bytes.
+*/
+void frame_compress_compact(BitSink *outbuf, const uint8_t *data, uint32_t size) {
+    uint32_t histogram[256] = { 0 };
+    for (uint32_t i = 0; i < size; i++) {
+        ++histogram[data[i]];
+    }
+
+    uint8_t lengths[256];
+    Code codes[256];
+    compact_lengths(histogram, lengths);
+    compact_codes(lengths, codes);
+
+    frame_write_compact_header(outbuf, size, lengths);
+    EncodeTable table;
+    encode_table_init(&table, codes);
+    encode_symbols(outbuf, &table, data, size);
+}
+
+/*
+Compress size bytes of memory into one LZ77 frame, as lz77.h describes, with matches found up to
+2^window_bits bytes back.
+*/
+void frame_compress_lz(BitSink *outbuf, const uint8_t *data, uint32_t size, uint8_t window_bits) {
+    bit_sink_put(outbuf, 'H', 8);
+    bit_sink_put(outbuf, 'L', 8);
+    bit_sink_put(outbuf, size, 32);
+    lz_compress(outbuf, data, size, window_bits);
+}
+
+/*
+Compress size bytes of memory into one frame of 16-bit symbols, as wide.h describes.
+*/
+void frame_compress_wide(BitSink *outbuf, const uint8_t *data, uint32_t size) {
+    bit_sink_put(outbuf, 'H', 8);
+    bit_sink_put(outbuf, 'W', 8);
+    bit_sink_put(outbuf, size, 32);
+    wide_compress(outbuf, data, size);
+}
+
+/*
+Compress size bytes of memory into one filtered frame: 'H' 'F', the filters, the stride and the
+size, then for each plane of the filtered bytes that is not empty its code lengths, as compact.h
+describes them, and its symbols. Exits if memory cannot be allocated, as the bit sink does.
+*/
+void frame_compress_filtered(BitSink *outbuf, const uint8_t *data, uint32_t size,
+    uint8_t filters, uint8_t stride) {
+    uint8_t *filtered = (uint8_t *) malloc(size ? size : 1);
+    if (filtered == NULL) {
+        fprintf(stderr, "huff:  unable to allocate memory\n");
+        exit(1);
+    }
+    filter_apply(filters, stride, data, filtered, size);
+
+    bit_sink_put(outbuf, 'H', 8);
+    bit_sink_put(outbuf, 'F', 8);
+    bit_sink_put(outbuf, filters, 8);
+    bit_sink_put(outbuf, stride, 8);
+    bit_sink_put(outbuf, size, 32);
+
+    for (unsigned p = 0; p < filter_plane_count(filters, stride); p++) {
+        size_t start;
+        size_t n = filter_plane(filters, stride, size, p, &start);
+        if (n == 0) {
+            continue;
+        }
+        uint32_t histogram[256] = { 0 };
+        histogram_add(filtered + start, n, histogram);
+        uint8_t lengths[256];
+        Code codes[256];
+        compact_lengths(histogram, lengths);
+        compact_codes(lengths, codes);
+        compact_write_lengths(outbuf, lengths);
+
+        EncodeTable table;
+        encode_table_init(&table, codes);
+        encode_symbols(outbuf, &table, filtered + start, n);
+    }
+    free(filtered);
+}
+
+/*
+Decode the planes of an 'F' frame whose header has been read into scratch, then undo the filters
+from there into out. Both hold header->filesize bytes. Return NULL on success or a description of
+what is wrong with the input.
+*/
+const char *frame_decompress_filtered(
+    BitSource *inbuf, const FrameHeader *header, uint8_t *scratch, uint8_t *out) {
+    DecodeTable *table = (DecodeTable *) malloc(sizeof(DecodeTable));
+    if (table == NULL) {
+        return "unable to allocate memory";
+    }
+
+    const char *error = NULL;
+    unsigned planes = filter_plane_count(header->filters, header->stride);
+    for (unsigned p = 0; error == NULL && p < planes; p++) {
+        size_t start;
+        size_t n = filter_plane(header->filters, header->stride, header->filesize, p, &start);
+        if (n == 0) {
+            continue;
+        }
+        uint8_t lengths[256];
+        if (!compact_read_lengths(inbuf, lengths) || !decode_table_lengths(table, lengths)) {
+            error = "input has a damaged code table";
+        } else {
+            decode_symbols(inbuf, table, scratch + start, n);
+        }
+    }
+    free(table);
+
+    if (error == NULL && bit_source_overrun(inbuf)) {
+        error = "input is truncated";
+    }
+    if (error == NULL) {
+        filter_invert(header->filters, header->stride, scratch, out, header->filesize);
+    }
+    return error;
+}
+
+/*
+Decode the symbols of a 'W' frame whose header has been read, filesize bytes, into out. Return NULL
+on success or a description of what is wrong with the input.
+*/
+const char *frame_decompress_wide(BitSource *inbuf, uint32_t filesize, uint8_t *out) {
+    const char *error = NULL;
+    if (filesize >= 2) {
+        CanonicalTable *table = NULL;
+        error = wide_read_table(inbuf, &table);
+        if (error == NULL && !wide_decode(inbuf, table, out, filesize / 2)) {
+            error = "input has a damaged code";
+        }
+        canonical_table_free(&table);
+    }
+    if (error == NULL && filesize % 2) {
+        out[filesize - 1] = (uint8_t) bit_source_get(inbuf, 8);
+    }
+    if (error == NULL && bit_source_overrun(inbuf)) {
+        error = "input is truncated";
+    }
+    return error;
+}
+
+/*
+Read a frame header and find the table its data is decoded with. A 'C' frame's tree is read into
+header->owned, which is allocated on first use and reused after that, and so is a 'K' frame's code.
+'V' and 'B' frames have neither size nor table here: an AdaptiveModel or the block headers take it
+from there, and an 'L' frame has only its size, its tables being read by lz_decompress(), as has a
+'W' frame, whose table is read by wide_read_table(). An 'F' frame has its filters, stride and size,
+its tables being read by frame_decompress_filtered(). Return NULL on success or a description of
+what is wrong with the input.
+*/
+const char *frame_read_header(BitSource *inbuf, const Dictionary *dict, FrameHeader *header) {
+    uint8_t type1 = (uint8_t) bit_source_get(inbuf, 8);
+    uint8_t type2 = (uint8_t) bit_source_get(inbuf, 8);
+
+    if (type1 != 'H' || (type2 != 'C' && type2 != 'D' && type2 != 'K' && type2 != 'V'
+                          && type2 != 'B' && type2 != 'L' && type2 != 'F' && type2 != 'W')) {
+        return "input is not a huff file";
+    }
+    header->type = type2;
+    header->filesize = 0;
+    header->table = NULL;
+
+    if (type2 == 'L' || type2 == 'W') {
+        header->filesize = (uint32_t) bit_source_get(inbuf, 32);
+    } else if (type2 == 'F') {
+        header->filters = (uint8_t) bit_source_get(inbuf, 8);
+        header->stride = (uint8_t) bit_source_get(inbuf, 8);
+        header->filesize = (uint32_t) bit_source_get(inbuf, 32);
+        if (!filter_valid(header->filters, header->stride)) {
+            return "input has an unknown filter";
+        }
+    } else if (type2 == 'C') {
+        header->filesize = (uint32_t) bit_source_get(inbuf, 32);
+        uint16_t num_leaves = (uint16_t) bit_source_get(inbuf, 16);
+
+        if (header->owned == NULL) {
+            header->owned = (DecodeTable *) malloc(sizeof(DecodeTable));
+            if (header->owned == NULL) {
+                return "unable to allocate memory";
+            }
+        }
+        if (!decode_table_read(header->owned, inbuf, num_leaves)) {
+            return "input has a damaged code tree";
+        }
+        header->table = header->owned;
+    } else if (type2 == 'K') {
+        uint64_t filesize;
+        uint8_t lengths[256] = { 0 };
+        if (!compact_read_varint(inbuf, &filesize) || filesize > UINT32_MAX) {
+            return "input has a damaged size";
+        }
+        header->filesize = (uint32_t) filesize;
+        if (filesize > 0 && !compact_read_lengths(inbuf, lengths)) {
+            return "input has a damaged code table";
+        }
+
+        if (header->owned == NULL) {
+            header->owned = (DecodeTable *) malloc(sizeof(DecodeTable));
+            if (header->owned == NULL) {
+                return "unable to allocate memory";
+            }
+        }
+        if (!decode_table_lengths(header->owned, lengths)) {
+            return "input has a damaged code table";
+        }
+        header->table = header->owned;
+    } else if (type2 == 'D') {
+        uint32_t dict_id = (uint32_t) bit_source_get(inbuf, 32);
+        uint8_t table_id = (uint8_t) bit_source_get(inbuf, 8);
+        header->filesize = (uint32_t) bit_source_get(inbuf, 32);
+
+        if (dict == NULL) {
+            return "input was compressed with a dictionary; use -D";
+        }
+        if (dict_id != dict->id || table_id >= dict->num_tables) {
+            return "input was compressed with a different dictionary";
+        }
+        header->table = dict->decode[table_id];
+    }
+
+    if (bit_source_overrun(inbuf)) {
+        return "input is truncated";
+    }
+    return NULL;
+}
+
+void frame_header_free(FrameHeader *header) {
+    decode_table_free(&header->owned);
+    header->table = NULL;
+}
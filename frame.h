@@ -0,0 +1,54 @@
+#ifndef _FRAME_H
+#define _FRAME_H
+
+/*
+* File:     frame.h
+* Purpose:  Header file for frame.c, which reads and writes the headers of
+*           compressed files and compresses whole in-memory buffers.
+*/
+
+#include "decode.h"
+#include "dict.h"
+#include "encode.h"
+#include "node.h"
+
+#include <inttypes.h>
+
+/*
+* What a frame header says about the data that follows it.  table is either
+* owned, which was read from the frame and can be reused for the next
+* frame, or a table of the dictionary.  filters and stride are only set for
+* an 'F' frame, whose planes each have their own table.
+*/
+typedef struct FrameHeader {
+    uint8_t type;
+    uint8_t filters;
+    uint8_t stride;
+    uint32_t filesize;
+    const DecodeTable *table;
+    DecodeTable *owned;
+} FrameHeader;
+
+void frame_write_tree_header(BitSink *outbuf, uint32_t filesize, uint16_t num_leaves, Node *tree);
+void frame_write_dict_header(
+    BitSink *outbuf, uint32_t filesize, const Dictionary *dict, uint8_t table_id);
+void frame_write_adaptive_header(BitSink *outbuf);
+void frame_write_block_header(BitSink *outbuf);
+void frame_write_compact_header(BitSink *outbuf, uint32_t filesize, const uint8_t *lengths);
+void frame_compress(BitSink *outbuf, const uint8_t *data, uint32_t size, const Dictionary *dict);
+void frame_compress_compact(BitSink *outbuf, const uint8_t *data, uint32_t size);
+void frame_compress_lz(
+    BitSink *outbuf, const uint8_t *data, uint32_t size, uint8_t window_bits);
+void frame_compress_wide(BitSink *outbuf, const uint8_t *data, uint32_t size);
+void frame_compress_filtered(BitSink *outbuf, const uint8_t *data, uint32_t size,
+    uint8_t filters, uint8_t stride);
+uint64_t frame_estimate(const uint32_t *histogram, const uint32_t *counts, uint32_t size,
+    const Dictionary *dict, int compact, BitSink *scratch);
+
+const char *frame_read_header(BitSource *inbuf, const Dictionary *dict, FrameHeader *header);
+const char *frame_decompress_filtered(
+    BitSource *inbuf, const FrameHeader *header, uint8_t *scratch, uint8_t *out);
+const char *frame_decompress_wide(BitSource *inbuf, uint32_t filesize, uint8_t *out);
+void frame_header_free(FrameHeader *header);
+
+#endif
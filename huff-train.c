@@ -0,0 +1,113 @@
+#include "dict.h"
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/*
+Count the bytes of one sample file. Return false if it cannot be read.
+*/
+static bool count_sample(const char *filename, uint32_t *histogram) {
+    FILE *f = fopen(filename, "rb");
+    if (f == NULL) {
+        return false;
+    }
+
+    for (int i = 0; i < 256; i++)
+        histogram[i] = 0;
+
+    uint8_t buffer[1 << 16];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            ++histogram[buffer[i]];
+        }
+    }
+
+    fclose(f);
+    return true;
+}
+
+void print_help(void) {
+    printf("Usage: huff-train -o dict [-n tables] [-v] sample...\n");
+    printf("       huff-train -h\n");
+}
+
+int main(int argc, char **argv) {
+    int opt = 0;
+    char *dict_file = NULL;
+    long num_tables = 1;
+    int verbose = 0;
+
+    while ((opt = getopt(argc, argv, "vho:n:")) != -1) {
+        switch (opt) {
+        case 'h': print_help(); return 1;
+        case 'v': verbose = 1; break;
+        case 'o': dict_file = optarg; break;
+        case 'n':
+            num_tables = strtol(optarg, NULL, 10);
+            if (num_tables < 1 || num_tables > DICT_MAX_TABLES) {
+                printf("huff-train:  -n must be between 1 and %d\n", DICT_MAX_TABLES);
+                return 1;
+            }
+            break;
+        default: print_help(); return 1;
+        }
+    }
+
+    if (dict_file == NULL) {
+        printf("huff-train:  -o option is required\n");
+        print_help();
+        return 1;
+    }
+
+    size_t num_samples = (size_t) (argc - optind);
+    if (num_samples == 0) {
+        printf("huff-train:  no sample files\n");
+        print_help();
+        return 1;
+    }
+
+    uint32_t (*histograms)[256] = calloc(num_samples, sizeof(*histograms));
+    if (histograms == NULL) {
+        printf("huff-train:  unable to allocate memory\n");
+        return 1;
+    }
+
+    for (size_t s = 0; s < num_samples; s++) {
+        if (!count_sample(argv[optind + (int) s], histograms[s])) {
+            printf("huff-train:  error reading sample %s\n", argv[optind + (int) s]);
+            free(histograms);
+            return 1;
+        }
+    }
+
+    Dictionary *dict = dict_train(histograms, num_samples, (uint8_t) num_tables);
+    if (dict == NULL || !dict_write(dict, dict_file)) {
+        printf("huff-train:  error writing dictionary %s\n", dict_file);
+        dict_free(&dict);
+        free(histograms);
+        return 1;
+    }
+
+    if (verbose) {
+        uint64_t bytes = 0;
+        uint64_t bits = 0;
+        for (size_t s = 0; s < num_samples; s++) {
+            uint8_t t = dict_select(dict, histograms[s]);
+            for (int i = 0; i < 256; i++) {
+                bytes += histograms[s][i];
+                bits += (uint64_t) histograms[s][i] * dict->codes[t][i].code_length;
+            }
+        }
+        printf("dictionary %08" PRIx32 ": %u tables, %zu samples\n", dict->id, dict->num_tables,
+            num_samples);
+        printf("samples: %" PRIu64 " bytes -> %" PRIu64 " bytes of codes\n", bytes, (bits + 7) / 8);
+    }
+
+    dict_free(&dict);
+    free(histograms);
+    return 0;
+}
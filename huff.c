@@ -1,129 +1,781 @@
+#include "adaptive.h"
+#include "batch.h"
+#include "block.h"
+#include "budget.h"
+#include "compact.h"
 #include "bitreader.h"
-#include "bitwriter.h"
+#include "dict.h"
+#include "encode.h"
+#include "filter.h"
+#include "frame.h"
+#include "huffman.h"
+#include "lz77.h"
 #include "node.h"
+#include "perf.h"
+#include "pool.h"
 #include "pq.h"
+#include "walk.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <getopt.h>
 #include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
-typedef struct Code {
-    uint64_t code;
-    uint8_t code_length;
-} Code;
+/*
+Encode fin on num_workers threads, a window of ENCODE_SLICE slices at a time, into exactly the
+bytes encode_symbols() would write. Under a memory budget the window shrinks, as blocks do.
+*/
+static void huff_encode_parallel(BitSink *outbuf, FILE *fin, const EncodeTable *table,
+    uint32_t *counts, unsigned num_workers) {
+    size_t window = budget_fit((size_t) num_workers * ENCODE_SLICE, ENCODE_SLICE, 3);
+    uint8_t *buffer = (uint8_t *) malloc(window);
+    if (buffer == NULL || !budget_take(3 * window)) {
+        fprintf(stderr, "huff:  unable to allocate memory\n");
+        exit(1);
+    }
+
+    size_t n;
+    while ((n = fread(buffer, 1, window, fin)) > 0) {
+        encode_symbols_parallel(outbuf, table, buffer, n, counts, num_workers);
+    }
 
-uint32_t fill_histogram(FILE *fin, uint32_t *histogram) {
-    for (int i = 0; i < 256; i++)
-        histogram[i] = 0;
+    free(buffer);
+    budget_give(3 * window);
+}
 
-    ++histogram[0x00];
-    ++histogram[0xff];
+/*
+Encode fin to the end, on num_workers threads when there is more than one. If counts is not NULL
+the bytes are also counted into it, for comparing the table that was used with the one an exact
+histogram would have given.
+*/
+static void huff_encode_stream(BitSink *outbuf, FILE *fin, const Code *code_table,
+    uint32_t *counts, unsigned num_workers, uint32_t filesize) {
+    EncodeTable table;
+    encode_table_init(&table, code_table);
+    if (num_workers > 1 && filesize > ENCODE_SLICE) {
+        huff_encode_parallel(outbuf, fin, &table, counts, num_workers);
+        return;
+    }
 
-    uint32_t size = 0;
-    int byte;
-    while ((byte = fgetc(fin)) != EOF) {
-        ++histogram[byte];
-        ++size;
+    uint8_t buffer[1 << 16];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), fin)) > 0) {
+        encode_symbols(outbuf, &table, buffer, n);
+        for (size_t i = 0; counts != NULL && i < n; i++) {
+            ++counts[buffer[i]];
+        }
     }
+}
 
-    fseek(fin, 0, SEEK_SET);
+void huff_compress_file(BitSink *outbuf, FILE *fin, uint32_t filesize, uint16_t num_leaves,
+    Node *code_tree, Code *code_table, uint32_t *counts, unsigned num_workers) {
+    frame_write_tree_header(outbuf, filesize, num_leaves, code_tree);
+    huff_encode_stream(outbuf, fin, code_table, counts, num_workers, filesize);
+}
 
-    return size;
+void huff_compress_dict(BitSink *outbuf, FILE *fin, uint32_t filesize, const Dictionary *dict,
+    uint8_t table_id, uint32_t *counts, unsigned num_workers) {
+    frame_write_dict_header(outbuf, filesize, dict, table_id);
+    huff_encode_stream(outbuf, fin, dict->codes[table_id], counts, num_workers, filesize);
 }
 
-Node *create_tree(uint32_t *histogram, uint16_t *num_leaves) {
-    PriorityQueue *pq = pq_create();
+/*
+Compress fin in one pass with the adaptive coder. Each read takes whatever the stream has, and
+everything coded so far is written out before the next read, so a reader at the other end of a
+pipe is never more than a partial byte behind. Return the number of bytes read.
+*/
+uint64_t huff_compress_adaptive(BitSink *outbuf, FILE *fin) {
+    uint64_t total = 0;
+    AdaptiveModel *model = adaptive_create(false);
+    if (model == NULL) {
+        fprintf(stderr, "huff:  unable to allocate memory\n");
+        exit(1);
+    }
+
+    frame_write_adaptive_header(outbuf);
+    bit_sink_sync(outbuf);
 
-    for (int i = 0; i < 256; i++) {
-        if (histogram[i] != 0) {
-            Node *new_node = node_create((uint8_t) i, histogram[i]);
-            enqueue(pq, new_node);
-            (*num_leaves) += 1;
+    uint8_t buffer[1 << 16];
+    for (;;) {
+        ssize_t n = read(fileno(fin), buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR) {
+            continue;
         }
+        if (n < 0) {
+            fprintf(stderr, "huff:  error reading input\n");
+            exit(1);
+        }
+        if (n == 0) {
+            break;
+        }
+        adaptive_encode(model, outbuf, buffer, (size_t) n);
+        bit_sink_sync(outbuf);
+        total += (uint64_t) n;
     }
 
-    while (!pq_size_is_1(pq)) {
-        Node *left = dequeue(pq);
-        Node *right = dequeue(pq);
+    adaptive_finish(model, outbuf);
+    adaptive_free(&model);
+    return total;
+}
 
-        Node *new_node = node_create(0, (uint32_t) (left->weight + right->weight));
-        new_node->left = left;
-        new_node->right = right;
+/*
+Read all of fin into a buffer charged to the memory budget, for the modes that need the whole
+input at once; fin may be a pipe. Store the size in *psize and the capacity charged in *pcap.
+*/
+static uint8_t *huff_read_all(FILE *fin, size_t *psize, size_t *pcap) {
+    uint8_t *data = NULL;
+    size_t cap = 0;
+    size_t size = 0;
+    for (;;) {
+        if (size == cap && !batch_reserve(&data, &cap, size + 1)) {
+            fprintf(stderr, "huff:  unable to allocate memory\n");
+            exit(1);
+        }
+        ssize_t n = read(fileno(fin), data + size, cap - size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            fprintf(stderr, "huff:  error reading input\n");
+            exit(1);
+        }
+        if (n == 0) {
+            break;
+        }
+        size += (size_t) n;
+    }
+    if (size > UINT32_MAX) {
+        fprintf(stderr, "huff:  input is too large to hold in one frame\n");
+        exit(1);
+    }
+    *psize = size;
+    *pcap = cap;
+    return data;
+}
 
-        enqueue(pq, new_node);
+/*
+Compress fin as one LZ77 frame. Return the number of bytes read.
+*/
+uint64_t huff_compress_lz(BitSink *outbuf, FILE *fin, uint8_t window_bits) {
+    size_t size, cap;
+    uint8_t *data = huff_read_all(fin, &size, &cap);
+    frame_compress_lz(outbuf, data, (uint32_t) size, window_bits);
+    free(data);
+    budget_give(cap);
+    return size;
+}
+
+/*
+Compress fin as one frame of 16-bit symbols. Return the number of bytes read.
+*/
+uint64_t huff_compress_wide(BitSink *outbuf, FILE *fin) {
+    size_t size, cap;
+    uint8_t *data = huff_read_all(fin, &size, &cap);
+    frame_compress_wide(outbuf, data, (uint32_t) size);
+    free(data);
+    budget_give(cap);
+    return size;
+}
+
+/*
+Compress fin as one filtered frame, each byte plane with its own code. Return the number of bytes
+read.
+*/
+uint64_t huff_compress_filtered(BitSink *outbuf, FILE *fin, uint8_t filters, uint8_t stride) {
+    size_t size, cap;
+    uint8_t *data = huff_read_all(fin, &size, &cap);
+    if (!budget_take(size)) {
+        fprintf(stderr, "huff:  unable to allocate memory\n");
+        exit(1);
+    }
+    frame_compress_filtered(outbuf, data, (uint32_t) size, filters, stride);
+    budget_give(size);
+    free(data);
+    budget_give(cap);
+    return size;
+}
+
+/*
+Compress fin in blocks of block_size bytes, each reusing the previous block's table when that is
+cheaper than sending a new one. Like adaptive mode this needs only one pass, so fin may be a pipe.
+A block is held three times over (the input and up to twice that in codes), so under a memory
+budget the blocks are made smaller until that fits. Return the number of bytes read.
+*/
+uint64_t huff_compress_blocks(BitSink *outbuf, FILE *fin, uint32_t block_size, int verbose) {
+    uint64_t total = 0;
+    uint32_t wanted = block_size;
+    block_size = (uint32_t) budget_fit(block_size, 1 << 12, 3);
+    if (verbose && block_size < wanted) {
+        fprintf(stderr, "huff:  blocks of %" PRIu32 " bytes to fit --max-memory\n", block_size);
     }
 
-    Node *root = dequeue(pq);
-    pq_free(&pq);
+    BlockEncoder *enc = block_encoder_create();
+    BufferPool *pool = buffer_pool_create(block_size, 1);
+    bool reserved = budget_take(2 * (size_t) block_size);
+    if (enc == NULL || pool == NULL || !reserved) {
+        fprintf(stderr, "huff:  unable to allocate memory\n");
+        exit(1);
+    }
+    uint8_t *buffer = buffer_pool_get(pool);
 
-    return root;
+    frame_write_block_header(outbuf);
+    size_t n;
+    while ((n = fread(buffer, 1, block_size, fin)) > 0) {
+        block_encode(enc, outbuf, buffer, (uint32_t) n);
+        total += n;
+    }
+    block_finish(outbuf);
+
+    if (verbose) {
+        fprintf(stderr, "huff:  %" PRIu64 " blocks, %" PRIu64 " fresh tables, %" PRIu64
+                        " reused, %" PRIu64 " ANS\n",
+            enc->fresh + enc->reused, enc->fresh, enc->reused, enc->ans);
+    }
+    buffer_pool_put(pool, buffer);
+    buffer_pool_free(&pool);
+    budget_give(2 * (size_t) block_size);
+    block_encoder_free(&enc);
+    return total;
+}
+
+/*
+Bytes read at a time by --estimate.
+*/
+#define ESTIMATE_CHUNK (1 << 20)
+
+static void huff_report_estimate(const char *what, uint64_t in, uint64_t out) {
+    printf("huff:  %s%" PRIu64 " bytes -> %" PRIu64 " bytes (%.3f)\n", what, in, out,
+        in ? (double) out / (double) in : 0.0);
 }
 
-void fill_code_table(Code *code_table, Node *node, uint64_t code, uint8_t code_length) {
-    if (node == NULL)
+/*
+Work out what huff would write for fin, with the same options, without coding or writing anything:
+the histogram is taken (from a sample if sample_size is not 0, in which case the result is an
+estimate), the table built, and the size reported is its header plus each symbol's count times its
+code length. With block_size the blocks are costed one by one as -b would code them, and with
+verbose each is listed. fin may be a pipe unless it is sampled. Return false, having said why, if
+the input cannot be estimated.
+*/
+bool huff_estimate(FILE *fin, uint64_t sample_size, const Dictionary *dict, int compact,
+    uint32_t block_size, int verbose) {
+    BitSink *scratch = bit_sink_open(NULL);
+    BlockEncoder *enc = block_size > 0 ? block_encoder_create() : NULL;
+    size_t chunk = block_size > 0 ? block_size : ESTIMATE_CHUNK;
+    uint8_t *buffer = (uint8_t *) malloc(chunk);
+    if (scratch == NULL || (block_size > 0 && enc == NULL) || buffer == NULL
+        || !budget_take(chunk)) {
+        fprintf(stderr, "huff:  unable to allocate memory\n");
+        exit(1);
+    }
+
+    bool ok = true;
+    uint64_t total = 0;
+    size_t n;
+    if (block_size > 0) {
+        uint64_t out = 2 + 1;
+        for (uint64_t i = 0; (n = fread(buffer, 1, chunk, fin)) > 0; i++) {
+            uint64_t fresh = enc->fresh;
+            uint64_t ans = enc->ans;
+            uint64_t bytes = block_estimate(enc, buffer, (uint32_t) n);
+            if (verbose) {
+                printf("huff:  block %" PRIu64 " at %" PRIu64 ": %zu bytes -> %" PRIu64
+                       " bytes (%.3f), %s table\n",
+                    i, total, n, bytes, (double) bytes / (double) n,
+                    enc->fresh > fresh ? (enc->ans > ans ? "fresh ANS" : "fresh")
+                                       : (enc->ans > ans ? "reused ANS" : "reused"));
+            }
+            out += bytes;
+            total += n;
+        }
+        if (verbose) {
+            printf("huff:  %" PRIu64 " blocks, %" PRIu64 " fresh tables, %" PRIu64
+                   " reused, %" PRIu64 " ANS\n",
+                enc->fresh + enc->reused, enc->fresh, enc->reused, enc->ans);
+        }
+        huff_report_estimate("", total, out);
+    } else if (sample_size > 0) {
+        uint32_t histogram[256];
+        uint64_t sampled = 0;
+        uint32_t size = fill_histogram_sampled(fin, histogram, sample_size, &sampled);
+        uint32_t counts[256];
+        for (int s = 0; s < 256; s++) {
+            uint32_t count = histogram[s] - (s == 0x00 || s == 0xff);
+            counts[s] = sampled ? (uint32_t) ((double) count * size / (double) sampled + 0.5) : 0;
+        }
+        uint64_t out = frame_estimate(histogram, counts, size, dict, compact, scratch);
+        printf("huff:  from a sample of %" PRIu64 " bytes\n", sampled);
+        huff_report_estimate("about ", size, out);
+    } else {
+        uint32_t histogram[256] = { 0 };
+        while ((n = fread(buffer, 1, chunk, fin)) > 0 && total + n <= UINT32_MAX) {
+            histogram_add(buffer, n, histogram);
+            total += n;
+        }
+        if (n > 0) {
+            fprintf(stderr, "huff:  input is too large for one frame; estimate it with -b\n");
+            ok = false;
+        } else {
+            ++histogram[0x00];
+            ++histogram[0xff];
+            uint64_t out
+                = frame_estimate(histogram, NULL, (uint32_t) total, dict, compact, scratch);
+            if (verbose) {
+                printf("huff:  header %zu bytes\n", scratch->pos + (scratch->nbits + 7) / 8);
+            }
+            huff_report_estimate("", total, out);
+        }
+    }
+
+    budget_give(chunk);
+    free(buffer);
+    block_encoder_free(&enc);
+    bit_sink_close(&scratch);
+    return ok;
+}
+
+/*
+Compress fin into a compact frame with the codes it leaves in codes. fill_histogram() counts 0x00
+and 0xff once more than they occur, which a compact code has no need for.
+*/
+void huff_compress_compact(BitSink *outbuf, FILE *fin, uint32_t filesize, uint32_t *histogram,
+    Code *codes, uint32_t *counts, unsigned num_workers) {
+    --histogram[0x00];
+    --histogram[0xff];
+
+    uint8_t lengths[256];
+    compact_lengths(histogram, lengths);
+    compact_codes(lengths, codes);
+
+    frame_write_compact_header(outbuf, filesize, lengths);
+    huff_encode_stream(outbuf, fin, codes, counts, num_workers, filesize);
+}
+
+/*
+Report what building the table from a sample cost: the code bits spent with it, against the bits
+the same kind of table built from the exact histogram (counted while encoding) would spend.
+*/
+static void huff_report_sample(const uint32_t *exact, const Code *codes, uint64_t sampled,
+    uint32_t filesize, int compact, const Dictionary *dict) {
+    uint32_t histogram[256];
+    memcpy(histogram, exact, sizeof(histogram));
+    uint64_t used = huff_cost(histogram, codes);
+
+    uint64_t best;
+    if (compact) {
+        uint8_t lengths[256];
+        Code best_codes[256];
+        compact_lengths(histogram, lengths);
+        compact_codes(lengths, best_codes);
+        best = huff_cost(histogram, best_codes);
+    } else if (dict != NULL) {
+        best = huff_cost(histogram, dict->codes[dict_select(dict, histogram)]);
+    } else {
+        ++histogram[0x00];
+        ++histogram[0xff];
+        uint16_t num_leaves = 0;
+        Node *tree = create_tree(histogram, &num_leaves);
+        Code best_codes[256];
+        memset(best_codes, 0, sizeof(best_codes));
+        fill_code_table(best_codes, tree, 0, 0);
+        node_free(&tree);
+        --histogram[0x00];
+        --histogram[0xff];
+        best = huff_cost(histogram, best_codes);
+    }
+
+    double loss = best ? 100.0 * ((double) used - (double) best) / (double) best : 0.0;
+    fprintf(stderr,
+        "huff:  sampled %" PRIu64 " of %" PRIu32 " bytes; %" PRIu64 " code bits, %" PRIu64
+        " with an exact histogram (%+.3f%%)\n",
+        sampled, filesize, used, best, loss);
+}
+
+typedef struct HuffBatch {
+    const Manifest *manifest;
+    const Dictionary *dict;
+    int compact;
+    BatchWorker *workers;
+    atomic_size_t failures;
+} HuffBatch;
+
+static void huff_batch_file(void *arg, size_t index, unsigned worker) {
+    HuffBatch *batch = (HuffBatch *) arg;
+    BatchWorker *w = &batch->workers[worker];
+    const char *input = batch->manifest->inputs[index];
+    const char *output = batch->manifest->outputs[index];
+
+    size_t size;
+    if (!read_whole_file(input, &w->data, &w->data_cap, &size) || size > UINT32_MAX) {
+        fprintf(stderr, "huff:  error reading input file %s\n", input);
+        atomic_fetch_add(&batch->failures, 1);
         return;
+    }
+
+    bit_sink_reset(w->sink, NULL);
+    if (batch->compact) {
+        frame_compress_compact(w->sink, w->data, (uint32_t) size);
+    } else {
+        frame_compress(w->sink, w->data, (uint32_t) size, batch->dict);
+    }
+    bit_sink_flush(w->sink);
+
+    if (!write_whole_file(output, w->sink->buf, w->sink->pos)) {
+        fprintf(stderr, "huff:  error writing output file %s\n", output);
+        atomic_fetch_add(&batch->failures, 1);
+    }
+}
+
+/*
+Compress every file named in a manifest, on num_workers threads that each keep their buffers from
+one file to the next. Under a memory budget there are only as many workers as can hold the largest
+file and its output at once. Return the number of files that failed.
+*/
+size_t huff_batch(
+    const Manifest *manifest, const Dictionary *dict, int compact, unsigned num_workers) {
+    if (budget_limited()) {
+        num_workers = budget_workers(num_workers, 2 * manifest_largest_input(manifest));
+    }
+    HuffBatch batch = { manifest, dict, compact, batch_workers_create(num_workers), 0 };
+    if (batch.workers == NULL) {
+        fprintf(stderr, "huff:  unable to allocate memory\n");
+        return manifest->count;
+    }
+
+    pool_for(num_workers, manifest->count, huff_batch_file, &batch);
+
+    batch_workers_free(&batch.workers, num_workers);
+    return atomic_load(&batch.failures);
+}
+
+/*
+Files larger than this are compressed by huff -r in chunks of this many bytes, each a run of blocks
+in one block frame, so that a large file is shared among the workers rather than left to one.
+*/
+#define RECURSE_CHUNK (1u << 22)
 
-    if (node->left != NULL || node->right != NULL) {
-        fill_code_table(code_table, node->left, code, code_length + 1);
+/*
+* A task of huff -r: a whole file, or one chunk of a file with chunks.
+*/
+typedef struct HuffTask {
+    size_t file;
+    uint64_t chunk;
+} HuffTask;
 
-        code |= (uint64_t) 1 << code_length;
+/*
+* A file of huff -r.  A file with chunks is written a chunk at a time, in
+* order: next is the chunk whose turn it is, and only its worker touches
+* out and failed.
+*/
+typedef struct HuffTreeFile {
+    uint64_t chunks;
+    uint64_t next;
+    FILE *out;
+    bool failed;
+} HuffTreeFile;
 
-        fill_code_table(code_table, node->right, code, code_length + 1);
+typedef struct HuffRecurse {
+    const FileTree *tree;
+    const char *in_root;
+    const char *out_root;
+    const Dictionary *dict;
+    int compact;
+    uint32_t block_size;
+    int verbose;
+    HuffTask *tasks;
+    HuffTreeFile *files;
+    BatchWorker *workers;
+    pthread_mutex_t lock;
+    pthread_cond_t turn;
+    struct timespec start;
+    double next_report;
+    uint64_t total_bytes;
+    atomic_size_t files_done;
+    atomic_size_t failures;
+    atomic_uint_fast64_t bytes_in;
+    atomic_uint_fast64_t bytes_out;
+} HuffRecurse;
 
-        code &= ~((uint64_t) 1 << code_length);
+static double huff_seconds_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) (now.tv_sec - start->tv_sec) + (double) (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*
+Compress a whole file of the tree as huff -B would.
+*/
+static void huff_recurse_file(HuffRecurse *r, BatchWorker *w, size_t file) {
+    char *input = walk_join(r->in_root, r->tree->paths[file], "");
+    char *output = walk_join(r->out_root, r->tree->paths[file], ".huff");
+    size_t size = 0;
+    bool ok = input != NULL && output != NULL
+              && read_whole_file(input, &w->data, &w->data_cap, &size) && size <= UINT32_MAX;
+    if (ok) {
+        bit_sink_reset(w->sink, NULL);
+        if (r->compact) {
+            frame_compress_compact(w->sink, w->data, (uint32_t) size);
+        } else {
+            frame_compress(w->sink, w->data, (uint32_t) size, r->dict);
+        }
+        bit_sink_flush(w->sink);
+        ok = write_whole_file(output, w->sink->buf, w->sink->pos);
+    }
+    if (ok) {
+        atomic_fetch_add(&r->bytes_in, size);
+        atomic_fetch_add(&r->bytes_out, w->sink->pos);
     } else {
-        code_table[node->symbol].code = code;
-        code_table[node->symbol].code_length = code_length;
+        fprintf(stderr, "huff:  error compressing %s\n", input != NULL ? input : "file");
+        atomic_fetch_add(&r->failures, 1);
+    }
+    atomic_fetch_add(&r->files_done, 1);
+    free(input);
+    free(output);
+}
+
+/*
+Read size bytes at offset of the file at path into w->data, grown as needed. Return false on error.
+*/
+static bool huff_read_chunk(const char *path, uint64_t offset, size_t size, BatchWorker *w) {
+    FILE *f = fopen(path, "rb");
+    bool ok = f != NULL && batch_reserve(&w->data, &w->data_cap, size)
+              && fseeko(f, (off_t) offset, SEEK_SET) == 0 && fread(w->data, 1, size, f) == size;
+    if (f != NULL) {
+        fclose(f);
+    }
+    return ok;
+}
+
+/*
+Compress one chunk of a large file into a run of blocks, the first chunk starting the block frame
+and the last ending it. Each chunk starts with a fresh table, so none depends on another and they
+are coded side by side; then each waits for the chunk before it to be written, and writes its own.
+*/
+static void huff_recurse_chunk(HuffRecurse *r, BatchWorker *w, const HuffTask *task) {
+    HuffTreeFile *file = &r->files[task->file];
+    uint64_t offset = task->chunk * RECURSE_CHUNK;
+    uint64_t left = r->tree->sizes[task->file] - offset;
+    size_t size = left < RECURSE_CHUNK ? (size_t) left : RECURSE_CHUNK;
+    bool last = task->chunk + 1 == file->chunks;
+
+    char *input = walk_join(r->in_root, r->tree->paths[task->file], "");
+    BlockEncoder *enc = block_encoder_create();
+    bool ok = input != NULL && enc != NULL && huff_read_chunk(input, offset, size, w);
+    if (ok) {
+        bit_sink_reset(w->sink, NULL);
+        if (task->chunk == 0) {
+            frame_write_block_header(w->sink);
+        }
+        for (size_t i = 0; i < size; i += r->block_size) {
+            uint32_t n = (uint32_t) (size - i < r->block_size ? size - i : r->block_size);
+            block_encode(enc, w->sink, w->data + i, n);
+        }
+        if (last) {
+            block_finish(w->sink);
+        }
+        bit_sink_flush(w->sink);
+    }
+    block_encoder_free(&enc);
+
+    pthread_mutex_lock(&r->lock);
+    while (file->next != task->chunk) {
+        pthread_cond_wait(&r->turn, &r->lock);
+    }
+    pthread_mutex_unlock(&r->lock);
+
+    if (task->chunk == 0) {
+        char *output = walk_join(r->out_root, r->tree->paths[task->file], ".huff");
+        file->out = output != NULL ? fopen(output, "wb") : NULL;
+        free(output);
+    }
+    file->failed |= !ok || file->out == NULL
+                    || fwrite(w->sink->buf, 1, w->sink->pos, file->out) != w->sink->pos;
+    atomic_fetch_add(&r->bytes_in, size);
+    atomic_fetch_add(&r->bytes_out, ok ? w->sink->pos : 0);
+    if (last) {
+        if (file->out != NULL && fclose(file->out) != 0) {
+            file->failed = true;
+        }
+        if (file->failed) {
+            fprintf(stderr, "huff:  error compressing %s\n", input != NULL ? input : "file");
+            atomic_fetch_add(&r->failures, 1);
+        }
+        atomic_fetch_add(&r->files_done, 1);
     }
+    free(input);
+
+    pthread_mutex_lock(&r->lock);
+    file->next++;
+    pthread_cond_broadcast(&r->turn);
+    pthread_mutex_unlock(&r->lock);
 }
 
-void huff_write_tree(BitWriter *outbuf, Node *node) {
-    if (node->left == NULL) {
-        bit_write_bit(outbuf, 1);
-        bit_write_uint8(outbuf, node->symbol);
+static void huff_recurse_task(void *arg, size_t index, unsigned worker) {
+    HuffRecurse *r = (HuffRecurse *) arg;
+    const HuffTask *task = &r->tasks[index];
+    if (r->files[task->file].chunks == 0) {
+        huff_recurse_file(r, &r->workers[worker], task->file);
     } else {
-        huff_write_tree(outbuf, node->left);
-        huff_write_tree(outbuf, node->right);
-        bit_write_bit(outbuf, 0);
-    }
-}
-
-void huff_compress_file(BitWriter *outbuf, FILE *fin, uint32_t filesize, uint16_t num_leaves,
-    Node *code_tree, Code *code_table) {
-    bit_write_uint8(outbuf, 'H');
-    bit_write_uint8(outbuf, 'C');
-    bit_write_uint32(outbuf, filesize);
-    bit_write_uint16(outbuf, num_leaves);
-    huff_write_tree(outbuf, code_tree);
-    while (true) {
-        int b = fgetc(fin);
-        if (b == EOF) {
-            break;
+        huff_recurse_chunk(r, &r->workers[worker], task);
+    }
+
+    if (r->verbose) {
+        pthread_mutex_lock(&r->lock);
+        double seconds = huff_seconds_since(&r->start);
+        if (seconds >= r->next_report) {
+            uint64_t bytes = atomic_load(&r->bytes_in);
+            fprintf(stderr,
+                "huff:  %zu of %zu files, %" PRIu64 " of %" PRIu64 " bytes, %.1f MB/s\n",
+                atomic_load(&r->files_done), r->tree->count, bytes, r->total_bytes,
+                (double) bytes / seconds / 1e6);
+            r->next_report = seconds + 1.0;
         }
-        uint64_t code = code_table[b].code;
-        uint8_t code_length = code_table[b].code_length;
-        for (uint8_t i = 0; i < code_length; i++) {
-            bit_write_bit(outbuf, (code & 1));
-            code >>= 1;
+        pthread_mutex_unlock(&r->lock);
+    }
+}
+
+/*
+Compress every file under in_root into the same place under out_root, with ".huff" added, on
+num_workers threads. Files larger than RECURSE_CHUNK become block frames coded a chunk per task,
+and their chunks are queued before the small files, so that a large file starts early and is spread
+over every worker instead of finishing alone on one. With verbose, progress is reported about once
+a second, and the totals at the end. Return the number of files that failed.
+*/
+size_t huff_recurse(const char *in_root, const char *out_root, const Dictionary *dict, int compact,
+    uint32_t block_size, unsigned num_workers, int verbose) {
+    FileTree *tree = walk_tree(in_root);
+    if (tree == NULL) {
+        fprintf(stderr, "huff:  error reading directory %s\n", in_root);
+        return 1;
+    }
+    if (!walk_mirror(tree, out_root)) {
+        fprintf(stderr, "huff:  error making directories under %s\n", out_root);
+        walk_free(&tree);
+        return 1;
+    }
+    if (budget_limited()) {
+        num_workers = budget_workers(num_workers, 2 * (size_t) RECURSE_CHUNK);
+    }
+
+    HuffRecurse r = { tree, in_root, out_root, dict, compact,
+        block_size > 0 ? block_size : BLOCK_DEFAULT_SIZE, verbose, NULL,
+        (HuffTreeFile *) calloc(tree->count + 1, sizeof(HuffTreeFile)),
+        batch_workers_create(num_workers), PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+        { 0, 0 }, 1.0, 0, 0, 0, 0, 0 };
+    size_t task_count = 0;
+    for (size_t i = 0; r.files != NULL && i < tree->count; i++) {
+        uint64_t size = tree->sizes[i];
+        r.files[i].chunks = size > RECURSE_CHUNK ? (size + RECURSE_CHUNK - 1) / RECURSE_CHUNK : 0;
+        task_count += r.files[i].chunks > 0 ? r.files[i].chunks : 1;
+        r.total_bytes += size;
+    }
+    r.tasks = (HuffTask *) malloc((task_count + 1) * sizeof(HuffTask));
+    if (r.files == NULL || r.workers == NULL || r.tasks == NULL) {
+        fprintf(stderr, "huff:  unable to allocate memory\n");
+        free(r.files);
+        free(r.tasks);
+        batch_workers_free(&r.workers, num_workers);
+        walk_free(&tree);
+        return 1;
+    }
+
+    size_t t = 0;
+    for (size_t i = 0; i < tree->count; i++) {
+        for (uint64_t c = 0; c < r.files[i].chunks; c++) {
+            r.tasks[t++] = (HuffTask) { i, c };
         }
     }
+    for (size_t i = 0; i < tree->count; i++) {
+        if (r.files[i].chunks == 0) {
+            r.tasks[t++] = (HuffTask) { i, 0 };
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &r.start);
+    pool_for(num_workers, task_count, huff_recurse_task, &r);
+    double seconds = huff_seconds_since(&r.start);
+
+    size_t failures = atomic_load(&r.failures);
+    if (verbose) {
+        uint64_t in = atomic_load(&r.bytes_in);
+        uint64_t out = atomic_load(&r.bytes_out);
+        fprintf(stderr,
+            "huff:  %zu files (%zu skipped), %" PRIu64 " bytes to %" PRIu64 " (%.3f) in %.3f s, "
+            "%.1f MB/s, %zu failed\n",
+            tree->count, tree->skipped, in, out, in ? (double) out / (double) in : 0.0, seconds,
+            seconds > 0 ? (double) in / seconds / 1e6 : 0.0, failures);
+    }
+    pthread_mutex_destroy(&r.lock);
+    pthread_cond_destroy(&r.turn);
+    free(r.files);
+    free(r.tasks);
+    batch_workers_free(&r.workers, num_workers);
+    walk_free(&tree);
+    return failures;
+}
+
+/*
+Print the most memory that was counted against the budget and the peak resident set size.
+*/
+static void huff_report_memory(void) {
+    fprintf(stderr, "huff:  peak memory %zu bytes in buffers, %zu bytes resident\n",
+        budget_peak(), budget_peak_rss());
 }
 
 void print_help(void) {
-    printf("Usage: huff -i infile -o outfile\n");
+    printf("Usage: huff -i infile -o outfile [-D dict | -c] [-s samplebytes] [-j workers] [-v]\n");
+    printf("       huff -a -i infile|- -o outfile|-\n");
+    printf("       huff -b blocksize -i infile|- -o outfile|- [-v]\n");
+    printf("       huff -z [-w windowbits] -i infile|- -o outfile|- [-v]\n");
+    printf("       huff -W -i infile|- -o outfile|- [-v]\n");
+    printf("       huff -f delta|shuffle|delta+shuffle:stride -i infile|- -o outfile|- [-v]\n");
+    printf("       huff -B manifest [-j workers] [-D dict | -c] [-v]\n");
+    printf("       huff -r indir -o outdir [-j workers] [-b blocksize] [-D dict | -c] [-v]\n");
+    printf("       huff --estimate -i infile|- [-b blocksize | -s samplebytes] [-D dict | -c]"
+           " [-v]\n");
+    printf("       huff ... --max-memory bytes[K|M|G]\n");
     printf("       huff -h\n");
 }
 
+static const struct option long_options[] = {
+    { "max-memory", required_argument, NULL, 'M' },
+    { "estimate", no_argument, NULL, 'E' },
+    { NULL, 0, NULL, 0 },
+};
+
 int main(int argc, char **argv) {
     int opt = 0;
     BitReader *br = NULL;
-    BitWriter *bw = NULL;
+    BitSink *bw = NULL;
     FILE *infile = stdin;
+    FILE *outfile = NULL;
+    Dictionary *dict = NULL;
+    char *manifest_file = NULL;
+    char *tree_root = NULL;
+    char *output_name = NULL;
+    unsigned num_workers = pool_default_workers();
 
     int input_flag = 0;
     int output_flag = 0;
+    int verbose = 0;
+    int adaptive = 0;
+    int compact = 0;
+    int lz = 0;
+    int wide = 0;
+    int estimate = 0;
+    uint8_t window_bits = LZ_DEFAULT_WINDOW;
+    uint8_t filters = 0;
+    uint8_t stride = 0;
+    uint32_t block_size = 0;
+    uint64_t sample_size = 0;
 
     if (argc == 1) {
         printf("huff:  -i option is required\n");
@@ -137,10 +789,69 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    while ((opt = getopt(argc, argv, "vhi:o:")) != -1) {
+    const char *short_options = "acvzWhi:o:b:s:w:f:r:D:B:j:";
+    while ((opt = getopt_long(argc, argv, short_options, long_options, NULL)) != -1) {
         switch (opt) {
+        case 'M': {
+            size_t limit;
+            if (!budget_parse(optarg, &limit) || !budget_set(limit)) {
+                printf("huff:  --max-memory must be a size above %u bytes\n", BUDGET_RESERVE);
+                return 1;
+            }
+            break;
+        }
+        case 'E': estimate = 1; break;
         case 'h': print_help(); return 1;
+        case 'v': verbose = 1; break;
+        case 'a': adaptive = 1; break;
+        case 'c': compact = 1; break;
+        case 'z': lz = 1; break;
+        case 'W': wide = 1; break;
+        case 'f':
+            if (!filter_parse(optarg, &filters, &stride)) {
+                printf("huff:  -f must be delta, shuffle or delta+shuffle, ':' and 1, 2, 4 or 8\n");
+                return 1;
+            }
+            break;
+        case 'w': {
+            unsigned long bits = strtoul(optarg, NULL, 10);
+            if (bits < LZ_MIN_WINDOW || bits > LZ_MAX_WINDOW) {
+                printf("huff:  -w must be between %d and %d\n", LZ_MIN_WINDOW, LZ_MAX_WINDOW);
+                return 1;
+            }
+            window_bits = (uint8_t) bits;
+            break;
+        }
+        case 's':
+            sample_size = strtoull(optarg, NULL, 10);
+            if (sample_size == 0) {
+                printf("huff:  -s must be at least 1\n");
+                return 1;
+            }
+            break;
+        case 'b': {
+            unsigned long size = strtoul(optarg, NULL, 10);
+            if (size == 0 || size > UINT32_MAX) {
+                printf("huff:  -b must be between 1 and %" PRIu32 "\n", UINT32_MAX);
+                return 1;
+            }
+            block_size = (uint32_t) size;
+            break;
+        }
+        case 'B': manifest_file = optarg; break;
+        case 'j':
+            num_workers = (unsigned) strtoul(optarg, NULL, 10);
+            if (num_workers == 0) {
+                printf("huff:  -j must be at least 1\n");
+                return 1;
+            }
+            break;
         case 'i':
+            if (strcmp(optarg, "-") == 0) {
+                infile = stdin;
+                input_flag = 1;
+                break;
+            }
             br = bit_read_open(optarg);
             if (br == NULL) {
                 printf("huff:  error reading input file %s\n", optarg);
@@ -156,46 +867,181 @@ int main(int argc, char **argv) {
             input_flag = 1;
             break;
         case 'o':
-            bw = bit_write_open(optarg);
-            if (bw == NULL) {
-                bit_write_close(&bw);
+            output_name = optarg;
+            output_flag = 1;
+            break;
+        case 'r': tree_root = optarg; break;
+        case 'D':
+            dict = dict_load(optarg);
+            if (dict == NULL) {
+                printf("huff:  error reading dictionary %s\n", optarg);
                 return 1;
             }
-            output_flag = 1;
             break;
         }
     }
 
+    if (manifest_file != NULL) {
+        Manifest *manifest = manifest_read(manifest_file);
+        if (manifest == NULL) {
+            printf("huff:  error reading manifest %s\n", manifest_file);
+            dict_free(&dict);
+            return 1;
+        }
+
+        struct timespec start, stop;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        size_t failures = huff_batch(manifest, dict, compact, num_workers);
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+
+        if (verbose) {
+            double seconds = (double) (stop.tv_sec - start.tv_sec)
+                             + (double) (stop.tv_nsec - start.tv_nsec) / 1e9;
+            printf("huff:  %zu files in %.3f s (%.1f us/file), %zu failed\n", manifest->count,
+                seconds, manifest->count ? seconds * 1e6 / (double) manifest->count : 0.0,
+                failures);
+            huff_report_memory();
+        }
+
+        manifest_free(&manifest);
+        dict_free(&dict);
+        return failures == 0 ? 0 : 1;
+    }
+
+    if (tree_root != NULL) {
+        if (output_flag == 0) {
+            printf("huff: -r needs -o for the output directory\n");
+            dict_free(&dict);
+            return 1;
+        }
+        size_t failures
+            = huff_recurse(tree_root, output_name, dict, compact, block_size, num_workers, verbose);
+        if (verbose) {
+            huff_report_memory();
+        }
+        dict_free(&dict);
+        return failures == 0 ? 0 : 1;
+    }
+
     if (input_flag == 0) {
         printf("huff: -i option is required\n");
         print_help();
         return 1;
     }
 
+    if (estimate) {
+        if (infile == stdin && sample_size > 0) {
+            printf("huff:  -s needs a file, not standard input\n");
+            return 1;
+        }
+        bool ok = huff_estimate(infile, sample_size, dict, compact, block_size, verbose);
+        dict_free(&dict);
+        if (infile != stdin) {
+            fclose(infile);
+        }
+        bit_read_close(&br);
+        return ok ? 0 : 1;
+    }
+
     if (output_flag == 0) {
         printf("huff: -o option is required\n");
         print_help();
         return 1;
     }
 
-    uint32_t histogram[256];
-    uint32_t filesize = fill_histogram(infile, histogram);
+    if (infile == stdin && !adaptive && !lz && !wide && stride == 0 && block_size == 0) {
+        printf("huff:  reading standard input needs -a, -b, -f, -W or -z\n");
+        return 1;
+    }
 
-    uint16_t num_leaves = 0;
-    Node *code_tree = create_tree(histogram, &num_leaves);
+    outfile = strcmp(output_name, "-") == 0 ? stdout : fopen(output_name, "wb");
+    if (outfile == NULL) {
+        return 1;
+    }
+    bw = bit_sink_open(outfile);
+    if (bw == NULL) {
+        fclose(outfile);
+        return 1;
+    }
 
-    Code *code_table = (Code *) calloc(256, sizeof(Code));
-    fill_code_table(code_table, code_tree, 0, 0);
+    /*
+    * With -v, hardware counters are read around each stage when the system
+    * allows it.
+    */
+    PerfCounters counters;
+    PerfSample histogram_counts = { { 0 } };
+    PerfSample encode_counts;
+    uint64_t total = 0;
+    if (verbose) {
+        perf_open(&counters);
+        perf_start(&counters);
+    }
+
+    if (adaptive) {
+        total = huff_compress_adaptive(bw, infile);
+    } else if (lz) {
+        total = huff_compress_lz(bw, infile, window_bits);
+    } else if (wide) {
+        total = huff_compress_wide(bw, infile);
+    } else if (stride > 0) {
+        total = huff_compress_filtered(bw, infile, filters, stride);
+    } else if (block_size > 0) {
+        total = huff_compress_blocks(bw, infile, block_size, verbose);
+    } else {
+        uint32_t histogram[256];
+        uint64_t sampled = 0;
+        uint32_t filesize = sample_size > 0
+                                ? fill_histogram_sampled(infile, histogram, sample_size, &sampled)
+                                : fill_histogram(infile, histogram);
+        total = filesize;
+        if (verbose) {
+            perf_stop(&counters, &histogram_counts);
+            perf_start(&counters);
+        }
+        uint32_t exact[256] = { 0 };
+        uint32_t *counts = (verbose && sample_size > 0) ? exact : NULL;
+
+        Code *code_table = (Code *) calloc(256, sizeof(Code));
+        if (compact) {
+            huff_compress_compact(
+                bw, infile, filesize, histogram, code_table, counts, num_workers);
+        } else if (dict != NULL) {
+            uint8_t table_id = dict_select(dict, histogram);
+            memcpy(code_table, dict->codes[table_id], 256 * sizeof(Code));
+            huff_compress_dict(bw, infile, filesize, dict, table_id, counts, num_workers);
+        } else {
+            uint16_t num_leaves = 0;
+            Node *code_tree = create_tree(histogram, &num_leaves);
+            fill_code_table(code_table, code_tree, 0, 0);
 
-    huff_compress_file(bw, infile, filesize, num_leaves, code_tree, code_table);
+            huff_compress_file(
+                bw, infile, filesize, num_leaves, code_tree, code_table, counts, num_workers);
 
-    node_free(&code_tree);
-    free(code_table);
+            node_free(&code_tree);
+        }
+
+        if (counts != NULL) {
+            huff_report_sample(counts, code_table, sampled, filesize, compact, dict);
+        }
+        free(code_table);
+    }
+    bit_sink_flush(bw);
+    if (verbose) {
+        perf_stop(&counters, &encode_counts);
+        if (!adaptive && !lz && !wide && stride == 0 && block_size == 0) {
+            perf_print(stderr, "huff:  ", "histogram", &counters, &histogram_counts, total);
+        }
+        perf_print(stderr, "huff:  ", "encode", &counters, &encode_counts, total);
+        perf_close(&counters);
+        huff_report_memory();
+    }
+    dict_free(&dict);
 
     fclose(infile);
     infile = NULL;
     assert(infile == NULL);
-    bit_write_close(&bw);
+    bit_sink_close(&bw);
+    fclose(outfile);
     bit_read_close(&br);
     assert(br == NULL);
     assert(bw == NULL);
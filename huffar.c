@@ -0,0 +1,218 @@
+#include "archive.h"
+#include "batch.h"
+#include "pool.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct Extraction {
+    const Archive *archive;
+    const size_t *indices;
+    const char *directory;
+    BatchWorker *workers;
+    int verbose;
+    atomic_size_t failures;
+} Extraction;
+
+/*
+Create the directories leading up to path.
+*/
+static bool make_parents(char *path) {
+    for (char *p = strchr(path + 1, '/'); p != NULL; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        int status = mkdir(path, 0777);
+        *p = '/';
+        if (status != 0 && errno != EEXIST) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void extract_member(void *arg, size_t index, unsigned worker) {
+    Extraction *x = (Extraction *) arg;
+    const ArchiveMember *m = &x->archive->members[x->indices[index]];
+
+    if (!archive_safe_name(m->name)) {
+        fprintf(stderr, "huffar:  refusing to extract %s\n", m->name);
+        atomic_fetch_add(&x->failures, 1);
+        return;
+    }
+
+    const char *error = archive_extract(x->archive, x->indices[index], &x->workers[worker]);
+    if (error != NULL) {
+        fprintf(stderr, "huffar:  %s: %s\n", m->name, error);
+        atomic_fetch_add(&x->failures, 1);
+        return;
+    }
+
+    size_t len = strlen(x->directory) + strlen(m->name) + 2;
+    char *path = (char *) malloc(len);
+    if (path == NULL) {
+        atomic_fetch_add(&x->failures, 1);
+        return;
+    }
+    snprintf(path, len, "%s/%s", x->directory, m->name);
+    if (!make_parents(path) || !write_whole_file(path, x->workers[worker].out, m->size)) {
+        fprintf(stderr, "huffar:  error writing %s\n", path);
+        atomic_fetch_add(&x->failures, 1);
+    } else if (x->verbose) {
+        printf("%s\n", m->name);
+    }
+    free(path);
+}
+
+static int create_archive(const char *filename, char **files, int num_files, int verbose) {
+    Archive *archive = archive_create(filename);
+    if (archive == NULL) {
+        fprintf(stderr, "huffar:  error creating %s\n", filename);
+        return 1;
+    }
+
+    uint8_t *data = NULL;
+    size_t cap = 0;
+    int status = 0;
+    for (int i = 0; i < num_files; i++) {
+        size_t size;
+        if (!archive_safe_name(files[i])) {
+            fprintf(stderr, "huffar:  refusing to add %s, an absolute path or one with ..\n",
+                files[i]);
+            status = 1;
+            continue;
+        }
+        if (!read_whole_file(files[i], &data, &cap, &size)) {
+            fprintf(stderr, "huffar:  error reading %s\n", files[i]);
+            status = 1;
+            continue;
+        }
+        if (!archive_add(archive, files[i], data, size)) {
+            fprintf(stderr, "huffar:  error adding %s\n", files[i]);
+            status = 1;
+            break;
+        }
+        if (verbose) {
+            printf("%s\n", files[i]);
+        }
+    }
+    free(data);
+
+    if (!archive_finish(&archive)) {
+        fprintf(stderr, "huffar:  error writing %s\n", filename);
+        status = 1;
+    }
+    return status;
+}
+
+static int list_archive(const Archive *archive) {
+    for (size_t i = 0; i < archive->count; i++) {
+        const ArchiveMember *m = &archive->members[i];
+        printf("%12" PRIu64 " %12" PRIu64 "  %08" PRIx32 "  %s\n", m->size, m->compressed, m->crc,
+            m->name);
+    }
+    return 0;
+}
+
+static int extract_archive(const Archive *archive, char **names, int num_names,
+    const char *directory, unsigned num_workers, int verbose) {
+    size_t count = num_names > 0 ? (size_t) num_names : archive->count;
+    size_t *indices = (size_t *) malloc((count + 1) * sizeof(size_t));
+    if (indices == NULL) {
+        return 1;
+    }
+
+    int status = 0;
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t index = num_names > 0 ? archive_find(archive, names[i]) : i;
+        if (index == archive->count) {
+            fprintf(stderr, "huffar:  %s is not in the archive\n", names[i]);
+            status = 1;
+        } else {
+            indices[n++] = index;
+        }
+    }
+
+    Extraction x = { archive, indices, directory, batch_workers_create(num_workers), verbose, 0 };
+    if (x.workers == NULL) {
+        free(indices);
+        return 1;
+    }
+    pool_for(num_workers, n, extract_member, &x);
+    if (atomic_load(&x.failures) > 0) {
+        status = 1;
+    }
+
+    batch_workers_free(&x.workers, num_workers);
+    free(indices);
+    return status;
+}
+
+void print_help(void) {
+    printf("Usage: huffar -c -f archive [-v] file...\n");
+    printf("       huffar -t -f archive\n");
+    printf("       huffar -x -f archive [-C dir] [-j workers] [-v] [member...]\n");
+    printf("       huffar -h\n");
+}
+
+int main(int argc, char **argv) {
+    int opt = 0;
+    int mode = 0;
+    char *archive_file = NULL;
+    const char *directory = ".";
+    unsigned num_workers = pool_default_workers();
+    int verbose = 0;
+
+    while ((opt = getopt(argc, argv, "ctxf:C:j:vh")) != -1) {
+        switch (opt) {
+        case 'c':
+        case 't':
+        case 'x': mode = opt; break;
+        case 'f': archive_file = optarg; break;
+        case 'C': directory = optarg; break;
+        case 'j':
+            num_workers = (unsigned) strtoul(optarg, NULL, 10);
+            if (num_workers == 0) {
+                fprintf(stderr, "huffar:  -j must be at least 1\n");
+                return 1;
+            }
+            break;
+        case 'v': verbose = 1; break;
+        case 'h': print_help(); return 1;
+        default: print_help(); return 1;
+        }
+    }
+
+    if (mode == 0 || archive_file == NULL) {
+        printf("huffar:  one of -c, -t or -x, and -f, are required\n");
+        print_help();
+        return 1;
+    }
+
+    if (mode == 'c') {
+        if (optind == argc) {
+            printf("huffar:  no files to add\n");
+            return 1;
+        }
+        return create_archive(archive_file, argv + optind, argc - optind, verbose);
+    }
+
+    Archive *archive = archive_open(archive_file);
+    if (archive == NULL) {
+        fprintf(stderr, "huffar:  error reading archive %s\n", archive_file);
+        return 1;
+    }
+
+    int status = (mode == 't') ? list_archive(archive)
+                               : extract_archive(archive, argv + optind, argc - optind,
+                                   directory, num_workers, verbose);
+
+    archive_close(&archive);
+    return status;
+}
@@ -0,0 +1,192 @@
+/*
+* File:     huffc.c
+* Purpose:  The client of huffd: sends files to the daemon to be
+*           compressed or decompressed, one at a time or a whole manifest
+*           over one connection, and reads its counters.
+*/
+
+#include "batch.h"
+#include "filter.h"
+#include "lz77.h"
+#include "rpc.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+* Buffers kept from one file to the next.
+*/
+typedef struct HuffcBuffers {
+    uint8_t *in;
+    size_t in_cap;
+    uint8_t *out;
+    size_t out_cap;
+} HuffcBuffers;
+
+/*
+Send input to the daemon and write the reply to output; "-" means standard input or output.
+Return false, having said why, on error.
+*/
+static bool huffc_file(int fd, RpcRequest *request, const char *input, const char *output,
+    HuffcBuffers *buffers) {
+    const char *in_name = strcmp(input, "-") == 0 ? "/dev/stdin" : input;
+    const char *out_name = strcmp(output, "-") == 0 ? "/dev/stdout" : output;
+
+    size_t size;
+    if (!read_whole_file(in_name, &buffers->in, &buffers->in_cap, &size)) {
+        fprintf(stderr, "huffc:  error reading input file %s\n", input);
+        return false;
+    }
+    if (size > UINT32_MAX) {
+        fprintf(stderr, "huffc:  %s is too large for one request\n", input);
+        return false;
+    }
+    request->size = (uint32_t) size;
+
+    uint8_t status;
+    uint32_t reply_size;
+    if (!rpc_send_request(fd, request, buffers->in)
+        || !rpc_read_response(fd, &status, &buffers->out, &buffers->out_cap, &reply_size)) {
+        fprintf(stderr, "huffc:  lost the connection to the daemon\n");
+        return false;
+    }
+    if (status != RPC_OK) {
+        fprintf(stderr, "huffc:  %s: %.*s\n", input, (int) reply_size, buffers->out);
+        return false;
+    }
+    if (!write_whole_file(out_name, buffers->out, reply_size)) {
+        fprintf(stderr, "huffc:  error writing output file %s\n", output);
+        return false;
+    }
+    return true;
+}
+
+/*
+Ask the daemon for its counters and print them.
+*/
+static bool huffc_stats(int fd) {
+    RpcRequest request = { RPC_STATS, 0, 0, 0 };
+    uint8_t *text = NULL;
+    size_t cap = 0;
+    uint8_t status;
+    uint32_t size;
+    bool ok = rpc_send_request(fd, &request, NULL)
+              && rpc_read_response(fd, &status, &text, &cap, &size) && status == RPC_OK;
+    if (ok) {
+        fwrite(text, 1, size, stdout);
+    } else {
+        fprintf(stderr, "huffc:  lost the connection to the daemon\n");
+    }
+    free(text);
+    return ok;
+}
+
+void print_help(void) {
+    printf("Usage: huffc [-s socket] [-c | -W | -z [-w windowbits] | -f filter] -i infile|- -o outfile|-\n");
+    printf("       huffc [-s socket] -d -i infile|- -o outfile|-\n");
+    printf("       huffc [-s socket] [-d] [...] -B manifest [-v]\n");
+    printf("       huffc [-s socket] -t\n");
+    printf("       huffc -h\n");
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    const char *socket_path = RPC_DEFAULT_SOCKET;
+    const char *input = NULL;
+    const char *output = NULL;
+    const char *manifest_file = NULL;
+    RpcRequest request = { RPC_COMPRESS, 'C', 0, 0 };
+    bool stats = false;
+    bool verbose = false;
+
+    while ((opt = getopt(argc, argv, "hdczWvts:w:f:i:o:B:")) != -1) {
+        switch (opt) {
+        case 's': socket_path = optarg; break;
+        case 'd': request.op = RPC_DECOMPRESS; break;
+        case 'c': request.mode = 'K'; break;
+        case 'W': request.mode = 'W'; break;
+        case 'z': request.mode = 'L'; break;
+        case 'w': {
+            unsigned long bits = strtoul(optarg, NULL, 10);
+            if (bits < LZ_MIN_WINDOW || bits > LZ_MAX_WINDOW) {
+                printf("huffc:  -w must be between %d and %d\n", LZ_MIN_WINDOW, LZ_MAX_WINDOW);
+                return 1;
+            }
+            request.param = (uint8_t) bits;
+            break;
+        }
+        case 'f': {
+            uint8_t filters, stride;
+            if (!filter_parse(optarg, &filters, &stride)) {
+                printf("huffc:  -f must be delta, shuffle or delta+shuffle, ':' and 1, 2, 4 or 8\n");
+                return 1;
+            }
+            request.mode = 'F';
+            request.param = (uint8_t) (filters << 4 | stride);
+            break;
+        }
+        case 't': stats = true; break;
+        case 'v': verbose = true; break;
+        case 'i': input = optarg; break;
+        case 'o': output = optarg; break;
+        case 'B': manifest_file = optarg; break;
+        default: print_help(); return 1;
+        }
+    }
+    if (!stats && manifest_file == NULL && (input == NULL || output == NULL)) {
+        print_help();
+        return 1;
+    }
+
+    int fd = rpc_connect(socket_path);
+    if (fd < 0) {
+        fprintf(stderr, "huffc:  cannot connect to %s: %s\n", socket_path, strerror(errno));
+        return 1;
+    }
+
+    bool ok = true;
+    HuffcBuffers buffers = { NULL, 0, NULL, 0 };
+    if (stats) {
+        ok = huffc_stats(fd);
+    } else if (manifest_file != NULL) {
+        Manifest *manifest = manifest_read(manifest_file);
+        if (manifest == NULL) {
+            fprintf(stderr, "huffc:  error reading manifest %s\n", manifest_file);
+            close(fd);
+            return 1;
+        }
+
+        struct timespec start, stop;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        size_t failures = 0;
+        for (size_t i = 0; i < manifest->count; i++) {
+            if (!huffc_file(fd, &request, manifest->inputs[i], manifest->outputs[i], &buffers)) {
+                failures++;
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+
+        if (verbose) {
+            double seconds = (double) (stop.tv_sec - start.tv_sec)
+                             + (double) (stop.tv_nsec - start.tv_nsec) / 1e9;
+            printf("huffc:  %zu files in %.3f s (%.1f us/file), %zu failed\n", manifest->count,
+                seconds, manifest->count ? seconds * 1e6 / (double) manifest->count : 0.0,
+                failures);
+        }
+        ok = failures == 0;
+        manifest_free(&manifest);
+    } else {
+        ok = huffc_file(fd, &request, input, output, &buffers);
+    }
+
+    free(buffers.in);
+    free(buffers.out);
+    close(fd);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,452 @@
+/*
+* File:     huffd.c
+* Purpose:  A compression daemon: compress and decompress requests framed
+*           as rpc.h describes, served on a Unix domain socket by a fixed
+*           pool of workers that keep their buffers and decode tables from
+*           one request to the next.
+*/
+
+#include "batch.h"
+#include "budget.h"
+#include "decode.h"
+#include "dict.h"
+#include "encode.h"
+#include "filter.h"
+#include "frame.h"
+#include "lz77.h"
+#include "pool.h"
+#include "rpc.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+* Bytes of input and output buffer each worker sets aside at startup, so
+* that requests up to this size allocate nothing.
+*/
+#define HUFFD_PREALLOC (1 << 20)
+
+/*
+* Latency bucket b counts requests that took less than 2^(b+1)
+* microseconds (and at least 2^b, except for bucket 0).
+*/
+#define HUFFD_LATENCY_BUCKETS 24
+
+typedef struct HuffdCounters {
+    atomic_uint_fast64_t requests;
+    atomic_uint_fast64_t errors;
+    atomic_uint_fast64_t bytes_in;
+    atomic_uint_fast64_t bytes_out;
+    atomic_uint_fast64_t latency[HUFFD_LATENCY_BUCKETS];
+} HuffdCounters;
+
+/*
+* A worker's buffers: in holds the request payload, out the reply, scratch
+* the planes of a filtered frame.  header keeps the last code table read,
+* to be reused.  fd is the connection being served, or -1.
+*/
+typedef struct HuffdWorker {
+    uint8_t *in;
+    size_t in_cap;
+    uint8_t *out;
+    size_t out_cap;
+    uint8_t *scratch;
+    size_t scratch_cap;
+    BitSink *sink;
+    FrameHeader header;
+    atomic_int fd;
+} HuffdWorker;
+
+typedef struct Huffd {
+    int listen_fd;
+    const Dictionary *dict;
+    unsigned num_workers;
+    HuffdWorker *workers;
+    atomic_bool stopping;
+    atomic_uint_fast64_t connections;
+    HuffdCounters compress;
+    HuffdCounters decompress;
+} Huffd;
+
+static double elapsed_us(const struct timespec *start) {
+    struct timespec stop;
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    return (double) (stop.tv_sec - start->tv_sec) * 1e6
+           + (double) (stop.tv_nsec - start->tv_nsec) / 1e3;
+}
+
+static void huffd_count(HuffdCounters *c, bool ok, size_t in, size_t out, double us) {
+    unsigned bucket = 0;
+    while (bucket + 1 < HUFFD_LATENCY_BUCKETS && us >= (double) (2u << bucket)) {
+        bucket++;
+    }
+    atomic_fetch_add(&c->requests, 1);
+    atomic_fetch_add(&c->errors, ok ? 0 : 1);
+    atomic_fetch_add(&c->bytes_in, in);
+    atomic_fetch_add(&c->bytes_out, out);
+    atomic_fetch_add(&c->latency[bucket], 1);
+}
+
+/*
+Return the bound in microseconds below which at least fraction of the requests finished.
+*/
+static uint64_t huffd_percentile(const HuffdCounters *c, double fraction) {
+    uint64_t total = 0;
+    for (int b = 0; b < HUFFD_LATENCY_BUCKETS; b++) {
+        total += atomic_load(&c->latency[b]);
+    }
+    uint64_t seen = 0;
+    for (int b = 0; b < HUFFD_LATENCY_BUCKETS; b++) {
+        seen += atomic_load(&c->latency[b]);
+        if (total > 0 && (double) seen >= fraction * (double) total) {
+            return 2ull << b;
+        }
+    }
+    return 0;
+}
+
+static size_t huffd_format_counters(char *text, size_t cap, const char *name, HuffdCounters *c) {
+    size_t len = (size_t) snprintf(text, cap,
+        "%-10s requests %" PRIuFAST64 " errors %" PRIuFAST64 " in %" PRIuFAST64
+        " out %" PRIuFAST64 " p50 <%" PRIu64 "us p99 <%" PRIu64 "us\n",
+        name, atomic_load(&c->requests), atomic_load(&c->errors), atomic_load(&c->bytes_in),
+        atomic_load(&c->bytes_out), huffd_percentile(c, 0.5), huffd_percentile(c, 0.99));
+    for (int b = 0; b < HUFFD_LATENCY_BUCKETS && len < cap; b++) {
+        uint64_t count = atomic_load(&c->latency[b]);
+        if (count > 0) {
+            len += (size_t) snprintf(
+                text + len, cap - len, "  <%10lluus %" PRIu64 "\n", 2ull << b, count);
+        }
+    }
+    return len < cap ? len : cap - 1;
+}
+
+/*
+Write the counters as text: connections, then for each kind of request its count, errors, bytes
+in and out, latency percentiles and the latency histogram.
+*/
+static size_t huffd_format_stats(Huffd *d, char *text, size_t cap) {
+    size_t len = (size_t) snprintf(
+        text, cap, "connections %" PRIuFAST64 "\n", atomic_load(&d->connections));
+    len += huffd_format_counters(text + len, cap - len, "compress", &d->compress);
+    len += huffd_format_counters(text + len, cap - len, "decompress", &d->decompress);
+    return len;
+}
+
+static const char *huffd_compress(
+    Huffd *d, HuffdWorker *w, const RpcRequest *request, const uint8_t **reply, size_t *size) {
+    bit_sink_reset(w->sink, NULL);
+    switch (request->mode) {
+    case 'D':
+        if (d->dict == NULL) {
+            return "daemon has no dictionary";
+        }
+        frame_compress(w->sink, w->in, request->size, d->dict);
+        break;
+    case 'C': frame_compress(w->sink, w->in, request->size, d->dict); break;
+    case 'K': frame_compress_compact(w->sink, w->in, request->size); break;
+    case 'W': frame_compress_wide(w->sink, w->in, request->size); break;
+    case 'L': {
+        uint8_t window_bits = request->param ? request->param : LZ_DEFAULT_WINDOW;
+        if (window_bits < LZ_MIN_WINDOW || window_bits > LZ_MAX_WINDOW) {
+            return "window size is out of range";
+        }
+        frame_compress_lz(w->sink, w->in, request->size, window_bits);
+        break;
+    }
+    case 'F': {
+        uint8_t filters = request->param >> 4;
+        uint8_t stride = request->param & 15;
+        if (!filter_valid(filters, stride)) {
+            return "unknown filter";
+        }
+        frame_compress_filtered(w->sink, w->in, request->size, filters, stride);
+        break;
+    }
+    default: return "unknown compression mode";
+    }
+    bit_sink_flush(w->sink);
+    *reply = w->sink->buf;
+    *size = w->sink->pos;
+    return NULL;
+}
+
+static const char *huffd_decompress(
+    Huffd *d, HuffdWorker *w, const RpcRequest *request, const uint8_t **reply, size_t *size) {
+    BitSource src;
+    bit_source_init(&src, w->in, request->size);
+    const char *error = frame_read_header(&src, d->dict, &w->header);
+    if (error != NULL) {
+        return error;
+    }
+
+    size_t n = w->header.filesize;
+    if (!batch_reserve(&w->out, &w->out_cap, n)) {
+        return "unable to allocate memory";
+    }
+    switch (w->header.type) {
+    case 'C':
+    case 'D':
+    case 'K':
+        decode_symbols(&src, w->header.table, w->out, n);
+        error = bit_source_overrun(&src) ? "input is truncated" : NULL;
+        break;
+    case 'L': error = lz_decompress(&src, w->out, n); break;
+    case 'W': error = frame_decompress_wide(&src, w->header.filesize, w->out); break;
+    case 'F':
+        if (!batch_reserve(&w->scratch, &w->scratch_cap, n)) {
+            return "unable to allocate memory";
+        }
+        error = frame_decompress_filtered(&src, &w->header, w->scratch, w->out);
+        break;
+    default: return "only single frames of known size can be decompressed by huffd";
+    }
+    *reply = w->out;
+    *size = n;
+    return error;
+}
+
+/*
+Answer one request. Return false if the reply could not be sent.
+*/
+static bool huffd_request(Huffd *d, HuffdWorker *w, const RpcRequest *request) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    const uint8_t *reply = NULL;
+    size_t size = 0;
+    const char *error = NULL;
+    HuffdCounters *counters = NULL;
+    char stats[4096];
+
+    switch (request->op) {
+    case RPC_COMPRESS:
+        counters = &d->compress;
+        error = huffd_compress(d, w, request, &reply, &size);
+        break;
+    case RPC_DECOMPRESS:
+        counters = &d->decompress;
+        error = huffd_decompress(d, w, request, &reply, &size);
+        break;
+    case RPC_STATS:
+        size = huffd_format_stats(d, stats, sizeof(stats));
+        reply = (const uint8_t *) stats;
+        break;
+    default: error = "unknown request"; break;
+    }
+
+    bool sent = error == NULL
+                    ? rpc_send_response(w->fd, RPC_OK, reply, (uint32_t) size)
+                    : rpc_send_response(
+                        w->fd, RPC_ERROR, (const uint8_t *) error, (uint32_t) strlen(error));
+    if (counters != NULL) {
+        huffd_count(counters, error == NULL, request->size, error == NULL ? size : 0,
+            elapsed_us(&start));
+    }
+    return sent;
+}
+
+/*
+The body of each worker: accept a connection and answer its requests until it is closed, then
+the next, until the daemon is stopped.
+*/
+static void huffd_serve(void *arg, size_t index, unsigned worker) {
+    (void) index;
+    Huffd *d = (Huffd *) arg;
+    HuffdWorker *w = &d->workers[worker];
+
+    while (!atomic_load(&d->stopping)) {
+        int fd = accept(d->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (atomic_load(&d->stopping) || errno == EBADF || errno == EINVAL) {
+                break;
+            }
+            continue;
+        }
+        atomic_store(&w->fd, fd);
+        atomic_fetch_add(&d->connections, 1);
+
+        RpcRequest request;
+        while (!atomic_load(&d->stopping)
+               && rpc_read_request(fd, &request, &w->in, &w->in_cap)) {
+            if (!huffd_request(d, w, &request)) {
+                break;
+            }
+        }
+        atomic_store(&w->fd, -1);
+        close(fd);
+    }
+}
+
+/*
+Wait for SIGINT or SIGTERM, then stop accepting and end every connection being served. The
+workers finish the request in hand.
+*/
+static void *huffd_signals(void *arg) {
+    Huffd *d = (Huffd *) arg;
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    int sig;
+    sigwait(&signals, &sig);
+
+    atomic_store(&d->stopping, true);
+    shutdown(d->listen_fd, SHUT_RDWR);
+    for (unsigned w = 0; w < d->num_workers; w++) {
+        int fd = atomic_load(&d->workers[w].fd);
+        if (fd >= 0) {
+            shutdown(fd, SHUT_RD);
+        }
+    }
+    return NULL;
+}
+
+static void huffd_workers_free(HuffdWorker **pworkers, unsigned num_workers) {
+    if (*pworkers == NULL) {
+        return;
+    }
+    for (unsigned w = 0; w < num_workers; w++) {
+        HuffdWorker *worker = &(*pworkers)[w];
+        free(worker->in);
+        free(worker->out);
+        free(worker->scratch);
+        budget_give(worker->in_cap + worker->out_cap + worker->scratch_cap);
+        bit_sink_close(&worker->sink);
+        frame_header_free(&worker->header);
+    }
+    free(*pworkers);
+    *pworkers = NULL;
+}
+
+static HuffdWorker *huffd_workers_create(unsigned num_workers) {
+    HuffdWorker *workers = (HuffdWorker *) calloc(num_workers, sizeof(HuffdWorker));
+    if (workers == NULL) {
+        return NULL;
+    }
+    for (unsigned w = 0; w < num_workers; w++) {
+        atomic_init(&workers[w].fd, -1);
+        workers[w].sink = bit_sink_open(NULL);
+        if (workers[w].sink == NULL) {
+            huffd_workers_free(&workers, num_workers);
+            return NULL;
+        }
+        batch_reserve(&workers[w].in, &workers[w].in_cap, HUFFD_PREALLOC);
+        batch_reserve(&workers[w].out, &workers[w].out_cap, HUFFD_PREALLOC);
+    }
+    return workers;
+}
+
+void print_help(void) {
+    printf("Usage: huffd [-s socket] [-j workers] [-D dict] [-v] [--max-memory bytes[K|M|G]]\n");
+    printf("       huffd -h\n");
+}
+
+static const struct option long_options[] = {
+    { "max-memory", required_argument, NULL, 'M' },
+    { NULL, 0, NULL, 0 },
+};
+
+int main(int argc, char **argv) {
+    int opt;
+    const char *socket_path = RPC_DEFAULT_SOCKET;
+    Dictionary *dict = NULL;
+    unsigned num_workers = pool_default_workers();
+    bool verbose = false;
+    size_t limit;
+
+    while ((opt = getopt_long(argc, argv, "hvs:j:D:", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'M':
+            if (!budget_parse(optarg, &limit) || !budget_set(limit)) {
+                fprintf(stderr, "huffd:  --max-memory must be a size above %u bytes\n",
+                    BUDGET_RESERVE);
+                return 1;
+            }
+            break;
+        case 'v': verbose = true; break;
+        case 's': socket_path = optarg; break;
+        case 'j':
+            num_workers = (unsigned) strtoul(optarg, NULL, 10);
+            if (num_workers == 0) {
+                fprintf(stderr, "huffd:  -j must be at least 1\n");
+                return 1;
+            }
+            break;
+        case 'D':
+            dict_free(&dict);
+            dict = dict_load(optarg);
+            if (dict == NULL) {
+                fprintf(stderr, "huffd:  error reading dictionary %s\n", optarg);
+                return 1;
+            }
+            break;
+        default: print_help(); return 1;
+        }
+    }
+
+    /*
+    * SIGINT and SIGTERM are taken by huffd_signals() alone, so they are
+    * blocked before any other thread starts.
+    */
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    Huffd d;
+    memset(&d, 0, sizeof(d));
+    d.dict = dict;
+    d.num_workers = num_workers;
+    d.listen_fd = rpc_listen(socket_path);
+    if (d.listen_fd < 0) {
+        fprintf(stderr, "huffd:  cannot listen on %s: %s\n", socket_path, strerror(errno));
+        dict_free(&dict);
+        return 1;
+    }
+    d.workers = huffd_workers_create(num_workers);
+    pthread_t signal_thread;
+    if (d.workers == NULL || pthread_create(&signal_thread, NULL, huffd_signals, &d) != 0) {
+        fprintf(stderr, "huffd:  unable to start workers\n");
+        huffd_workers_free(&d.workers, num_workers);
+        close(d.listen_fd);
+        unlink(socket_path);
+        dict_free(&dict);
+        return 1;
+    }
+    if (verbose) {
+        fprintf(stderr, "huffd:  listening on %s with %u workers\n", socket_path, num_workers);
+    }
+
+    pool_for(num_workers, num_workers, huffd_serve, &d);
+
+    if (!atomic_load(&d.stopping)) {
+        pthread_kill(signal_thread, SIGTERM);
+    }
+    pthread_join(signal_thread, NULL);
+    close(d.listen_fd);
+    unlink(socket_path);
+
+    if (verbose) {
+        char stats[4096];
+        huffd_format_stats(&d, stats, sizeof(stats));
+        fprintf(stderr, "%s", stats);
+        fprintf(stderr, "huffd:  peak memory %zu bytes in buffers, %zu bytes resident\n",
+            budget_peak(), budget_peak_rss());
+    }
+    huffd_workers_free(&d.workers, num_workers);
+    dict_free(&dict);
+    return 0;
+}
@@ -0,0 +1,259 @@
+#include "huffman.h"
+
+#include "pq.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+uint32_t fill_histogram(FILE *fin, uint32_t *histogram) {
+    for (int i = 0; i < 256; i++)
+        histogram[i] = 0;
+
+    ++histogram[0x00];
+    ++histogram[0xff];
+
+    uint32_t size = 0;
+    int byte;
+    while ((byte = fgetc(fin)) != EOF) {
+        ++histogram[byte];
+        ++size;
+    }
+
+    fseek(fin, 0, SEEK_SET);
+
+    return size;
+}
+
+/*
+Estimate the histogram of fin from about sample_bytes of it, read as SAMPLE_CHUNK-byte chunks spread
+evenly over the file, rather than reading all of it. Every symbol is counted at least once, so the
+bytes the sample missed still get codes, and 0x00 and 0xff once more as in fill_histogram(). A file
+no larger than the sample is counted exactly. Set *sampled to the number of bytes read, and return
+the file size with fin back at the start.
+*/
+uint32_t fill_histogram_sampled(
+    FILE *fin, uint32_t *histogram, uint64_t sample_bytes, uint64_t *sampled) {
+    for (int i = 0; i < 256; i++)
+        histogram[i] = 0;
+    *sampled = 0;
+
+    struct stat st;
+    uint8_t *buffer = (uint8_t *) malloc(SAMPLE_CHUNK);
+    if (buffer == NULL || fstat(fileno(fin), &st) != 0) {
+        free(buffer);
+        return fill_histogram(fin, histogram);
+    }
+    uint64_t size = (uint64_t) st.st_size;
+
+    bool exact = size <= sample_bytes || size <= 2 * SAMPLE_CHUNK;
+    size_t n;
+    if (exact) {
+        while ((n = fread(buffer, 1, SAMPLE_CHUNK, fin)) > 0) {
+            for (size_t i = 0; i < n; i++) {
+                ++histogram[buffer[i]];
+            }
+            *sampled += n;
+        }
+    } else {
+        uint64_t chunks = sample_bytes / SAMPLE_CHUNK > 1 ? sample_bytes / SAMPLE_CHUNK : 2;
+        uint64_t stride = (size - SAMPLE_CHUNK) / (chunks - 1);
+        for (uint64_t c = 0; c < chunks; c++) {
+            if (fseeko(fin, (off_t) (c * stride), SEEK_SET) != 0) {
+                break;
+            }
+            n = fread(buffer, 1, SAMPLE_CHUNK, fin);
+            for (size_t i = 0; i < n; i++) {
+                ++histogram[buffer[i]];
+            }
+            *sampled += n;
+        }
+    }
+    free(buffer);
+
+    for (int i = 0; i < 256 && !exact; i++) {
+        if (histogram[i] == 0) {
+            histogram[i] = 1;
+        }
+    }
+    ++histogram[0x00];
+    ++histogram[0xff];
+
+    fseek(fin, 0, SEEK_SET);
+    return (uint32_t) size;
+}
+
+/*
+Add the bytes of size bytes of memory to histogram. Four tables take turns, so that a run of the
+same byte does not make each increment wait for the one before it to be stored.
+*/
+void histogram_add(const uint8_t *data, size_t size, uint32_t *histogram) {
+    uint32_t counts[4][256];
+    memset(counts, 0, sizeof(counts));
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        ++counts[0][data[i]];
+        ++counts[1][data[i + 1]];
+        ++counts[2][data[i + 2]];
+        ++counts[3][data[i + 3]];
+    }
+    for (; i < size; i++) {
+        ++counts[0][data[i]];
+    }
+    for (int s = 0; s < 256; s++) {
+        histogram[s] += counts[0][s] + counts[1][s] + counts[2][s] + counts[3][s];
+    }
+}
+
+/*
+Count size bytes of memory the way fill_histogram() counts a file, including the extra 0x00 and 0xff
+that make sure the tree has at least two leaves.
+*/
+void fill_histogram_buffer(const uint8_t *data, uint32_t size, uint32_t *histogram) {
+    for (int i = 0; i < 256; i++)
+        histogram[i] = 0;
+
+    ++histogram[0x00];
+    ++histogram[0xff];
+
+    histogram_add(data, size, histogram);
+}
+
+Node *create_tree(uint32_t *histogram, uint16_t *num_leaves) {
+    PriorityQueue *pq = pq_create();
+
+    for (int i = 0; i < 256; i++) {
+        if (histogram[i] != 0) {
+            Node *new_node = node_create((uint8_t) i, histogram[i]);
+            enqueue(pq, new_node);
+            (*num_leaves) += 1;
+        }
+    }
+
+    while (!pq_size_is_1(pq)) {
+        Node *left = dequeue(pq);
+        Node *right = dequeue(pq);
+
+        Node *new_node = node_create(0, (uint32_t) (left->weight + right->weight));
+        new_node->left = left;
+        new_node->right = right;
+
+        enqueue(pq, new_node);
+    }
+
+    Node *root = dequeue(pq);
+    pq_free(&pq);
+
+    return root;
+}
+
+void fill_code_table(Code *code_table, Node *node, uint64_t code, uint8_t code_length) {
+    if (node == NULL)
+        return;
+
+    if (node->left != NULL || node->right != NULL) {
+        fill_code_table(code_table, node->left, code, code_length + 1);
+
+        code |= (uint64_t) 1 << code_length;
+
+        fill_code_table(code_table, node->right, code, code_length + 1);
+
+        code &= ~((uint64_t) 1 << code_length);
+    } else {
+        code_table[node->symbol].code = code;
+        code_table[node->symbol].code_length = code_length;
+    }
+}
+
+void huff_write_tree(BitSink *outbuf, Node *node) {
+    if (node->left == NULL) {
+        bit_sink_put(outbuf, 1, 1);
+        bit_sink_put(outbuf, node->symbol, 8);
+    } else {
+        huff_write_tree(outbuf, node->left);
+        huff_write_tree(outbuf, node->right);
+        bit_sink_put(outbuf, 0, 1);
+    }
+}
+
+static void stack_push(Node **stack, int *top, Node *node) {
+    if (*top == 63) {
+        fprintf(stderr, "Stack overflow\n");
+        exit(1);
+    }
+    stack[++(*top)] = node;
+}
+
+static Node *stack_pop(Node **stack, int *top) {
+    if (*top == -1) {
+        fprintf(stderr, "Stack underflow\n");
+        exit(1);
+    }
+    return stack[(*top)--];
+}
+
+/*
+Rebuild the tree that huff_write_tree() wrote: a 1 bit and a symbol is a leaf, a 0 bit joins the
+top two subtrees on the stack.
+*/
+Node *huff_read_tree(BitSource *inbuf, uint16_t num_leaves) {
+    uint16_t num_nodes = (uint16_t) (2 * num_leaves - 1);
+    Node *node;
+    Node *stack[64];
+    int top = -1;
+
+    for (uint16_t i = 0; i < num_nodes; ++i) {
+        int bit = (int) bit_source_get(inbuf, 1);
+        if (bit == 1) {
+            uint8_t symbol = (uint8_t) bit_source_get(inbuf, 8);
+            node = node_create(symbol, 0);
+        } else {
+            node = node_create(0, 0);
+            node->right = stack_pop(stack, &top);
+            node->left = stack_pop(stack, &top);
+        }
+        stack_push(stack, &top, node);
+    }
+
+    return stack_pop(stack, &top);
+}
+
+/*
+Return the number of bits the symbols counted in histogram take with code_table. Symbols the table
+cannot encode cost UINT64_MAX.
+*/
+uint64_t huff_cost(const uint32_t *histogram, const Code *code_table) {
+    uint64_t bits = 0;
+    for (int i = 0; i < 256; i++) {
+        if (histogram[i] != 0) {
+            if (code_table[i].code_length == 0) {
+                return UINT64_MAX;
+            }
+            bits += (uint64_t) histogram[i] * code_table[i].code_length;
+        }
+    }
+    return bits;
+}
+
+/*
+Return the entropy of the histogram in bits, rounded down: no prefix code can spend fewer bits on
+it, so it stands in for the cost of a fresh table without building one.
+*/
+uint64_t huff_entropy(const uint32_t *histogram) {
+    uint64_t total = 0;
+    for (int i = 0; i < 256; i++) {
+        total += histogram[i];
+    }
+
+    double bits = 0.0;
+    for (int i = 0; i < 256; i++) {
+        if (histogram[i] != 0) {
+            bits += (double) histogram[i] * log2((double) total / (double) histogram[i]);
+        }
+    }
+    return (uint64_t) bits;
+}
@@ -0,0 +1,34 @@
+#ifndef _HUFFMAN_H
+#define _HUFFMAN_H
+
+/*
+* File:     huffman.h
+* Purpose:  Header file for huffman.c, the histogram, code tree and code
+*           table routines shared by huff, dehuff and huff-train.
+*/
+
+#include "decode.h"
+#include "encode.h"
+#include "node.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+/*
+* Bytes read at a time by fill_histogram_sampled().
+*/
+#define SAMPLE_CHUNK (1 << 16)
+
+uint32_t fill_histogram(FILE *fin, uint32_t *histogram);
+uint32_t fill_histogram_sampled(
+    FILE *fin, uint32_t *histogram, uint64_t sample_bytes, uint64_t *sampled);
+void fill_histogram_buffer(const uint8_t *data, uint32_t size, uint32_t *histogram);
+void histogram_add(const uint8_t *data, size_t size, uint32_t *histogram);
+Node *create_tree(uint32_t *histogram, uint16_t *num_leaves);
+void fill_code_table(Code *code_table, Node *node, uint64_t code, uint8_t code_length);
+void huff_write_tree(BitSink *outbuf, Node *node);
+Node *huff_read_tree(BitSource *inbuf, uint16_t num_leaves);
+uint64_t huff_cost(const uint32_t *histogram, const Code *code_table);
+uint64_t huff_entropy(const uint32_t *histogram);
+
+#endif
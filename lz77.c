@@ -0,0 +1,364 @@
+#include "lz77.h"
+
+#include "canonical.h"
+#include "compact.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define LZ_HASH_BITS 15
+#define LZ_NONE      UINT32_MAX
+
+/*
+* Candidates tried per position, and the match length beyond which the
+* next position is not tried for a longer one.
+*/
+#define LZ_CHAIN      48
+#define LZ_LAZY_LIMIT 32
+
+/*
+* A literal has length 0 and the byte in distance.
+*/
+typedef struct LzToken {
+    uint16_t length;
+    uint32_t distance;
+} LzToken;
+
+/*
+* head[] holds the latest position for each hash of three bytes and prev[]
+* the one before it with the same hash, indexed by position modulo the
+* window.
+*/
+typedef struct LzMatcher {
+    const uint8_t *data;
+    size_t size;
+    uint32_t window;
+    uint32_t head[1 << LZ_HASH_BITS];
+    uint32_t *prev;
+} LzMatcher;
+
+/*
+Split a value into its bucket and the extra bits that pick it out of the bucket.
+*/
+static inline uint32_t lz_bucket(uint32_t value, uint32_t *extra_bits, uint32_t *extra) {
+    if (value < 4) {
+        *extra_bits = 0;
+        *extra = 0;
+        return value;
+    }
+    uint32_t top = 31 - (uint32_t) __builtin_clz(value);
+    *extra_bits = top - 1;
+    *extra = value & ((1u << (top - 1)) - 1);
+    return 2 * top + ((value >> (top - 1)) & 1);
+}
+
+/*
+Return the smallest value in a bucket, and its number of extra bits in *extra_bits.
+*/
+static inline uint32_t lz_bucket_base(uint32_t bucket, uint32_t *extra_bits) {
+    if (bucket < 4) {
+        *extra_bits = 0;
+        return bucket;
+    }
+    uint32_t top = bucket / 2;
+    *extra_bits = top - 1;
+    return (2 + (bucket & 1)) << (top - 1);
+}
+
+static inline uint32_t lz_hash(const uint8_t *p) {
+    uint32_t x = (uint32_t) p[0] << 16 | (uint32_t) p[1] << 8 | p[2];
+    return (x * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static void lz_insert(LzMatcher *m, size_t pos) {
+    if (pos + LZ_MIN_MATCH > m->size) {
+        return;
+    }
+    uint32_t h = lz_hash(m->data + pos);
+    m->prev[pos & (m->window - 1)] = m->head[h];
+    m->head[h] = (uint32_t) pos;
+}
+
+/*
+Count the bytes a and b have in common, up to limit, eight at a time while there are eight left.
+*/
+static inline uint32_t lz_match_length(const uint8_t *a, const uint8_t *b, uint32_t limit) {
+    uint32_t len = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (len + 8 <= limit) {
+        uint64_t x, y;
+        memcpy(&x, a + len, sizeof(x));
+        memcpy(&y, b + len, sizeof(y));
+        if (x != y) {
+            return len + ((uint32_t) __builtin_ctzll(x ^ y) >> 3);
+        }
+        len += 8;
+    }
+#endif
+    while (len < limit && a[len] == b[len]) {
+        len++;
+    }
+    return len;
+}
+
+/*
+Find the longest match for pos among the last LZ_CHAIN candidates within the window. Return its
+length, or 0 if none is LZ_MIN_MATCH long, with its distance in *distance.
+*/
+static uint32_t lz_find(const LzMatcher *m, size_t pos, uint32_t *distance) {
+    if (pos + LZ_MIN_MATCH > m->size) {
+        return 0;
+    }
+    const uint8_t *here = m->data + pos;
+    uint32_t limit = m->size - pos < LZ_MAX_MATCH ? (uint32_t) (m->size - pos) : LZ_MAX_MATCH;
+    uint32_t best = LZ_MIN_MATCH - 1;
+
+    uint32_t candidate = m->head[lz_hash(here)];
+    for (int chain = LZ_CHAIN; chain > 0 && candidate != LZ_NONE; chain--) {
+        if (candidate >= pos || pos - candidate >= m->window) {
+            break;
+        }
+        const uint8_t *there = m->data + candidate;
+        if (there[best] == here[best] && there[0] == here[0]) {
+            uint32_t len = lz_match_length(there, here, limit);
+            if (len > best) {
+                best = len;
+                *distance = (uint32_t) (pos - candidate);
+                if (len == limit) {
+                    break;
+                }
+            }
+        }
+        candidate = m->prev[candidate & (m->window - 1)];
+    }
+    return best >= LZ_MIN_MATCH ? best : 0;
+}
+
+/*
+Code one block of tokens: build both codes from the tokens' own statistics, send their lengths,
+then the tokens and LZ_END.
+*/
+static void lz_write_block(BitSink *sink, const LzToken *tokens, size_t count) {
+    uint32_t litlen_freq[LZ_LITLEN_SYMBOLS] = { 0 };
+    uint32_t distance_freq[LZ_DISTANCE_BUCKETS] = { 0 };
+    uint32_t extra_bits, extra;
+
+    for (size_t i = 0; i < count; i++) {
+        if (tokens[i].length == 0) {
+            litlen_freq[tokens[i].distance]++;
+        } else {
+            litlen_freq[LZ_END + 1
+                        + lz_bucket(tokens[i].length - LZ_MIN_MATCH, &extra_bits, &extra)]++;
+            distance_freq[lz_bucket(tokens[i].distance - 1, &extra_bits, &extra)]++;
+        }
+    }
+    litlen_freq[LZ_END] = 1;
+
+    uint8_t litlen_lengths[LZ_LITLEN_SYMBOLS];
+    uint8_t distance_lengths[LZ_DISTANCE_BUCKETS];
+    uint32_t litlen_codes[LZ_LITLEN_SYMBOLS];
+    uint32_t distance_codes[LZ_DISTANCE_BUCKETS];
+    canonical_lengths(litlen_freq, LZ_LITLEN_SYMBOLS, COMPACT_MAX_LENGTH, litlen_lengths);
+    canonical_lengths(distance_freq, LZ_DISTANCE_BUCKETS, COMPACT_MAX_LENGTH, distance_lengths);
+    canonical_codes(litlen_lengths, LZ_LITLEN_SYMBOLS, litlen_codes);
+    canonical_codes(distance_lengths, LZ_DISTANCE_BUCKETS, distance_codes);
+    compact_write_lengths_n(sink, litlen_lengths, LZ_LITLEN_SYMBOLS);
+    compact_write_lengths_n(sink, distance_lengths, LZ_DISTANCE_BUCKETS);
+
+    for (size_t i = 0; i < count; i++) {
+        if (tokens[i].length == 0) {
+            uint32_t s = tokens[i].distance;
+            bit_sink_put(sink, litlen_codes[s], litlen_lengths[s]);
+            continue;
+        }
+        uint32_t s = LZ_END + 1 + lz_bucket(tokens[i].length - LZ_MIN_MATCH, &extra_bits, &extra);
+        bit_sink_put(sink, litlen_codes[s] | (uint64_t) extra << litlen_lengths[s],
+            (uint8_t) (litlen_lengths[s] + extra_bits));
+        uint32_t d = lz_bucket(tokens[i].distance - 1, &extra_bits, &extra);
+        bit_sink_put(sink, distance_codes[d] | (uint64_t) extra << distance_lengths[d],
+            (uint8_t) (distance_lengths[d] + extra_bits));
+    }
+    bit_sink_put(sink, litlen_codes[LZ_END], litlen_lengths[LZ_END]);
+}
+
+/*
+Code size bytes as the body of an 'HL' frame, finding matches up to 2^window_bits bytes back with
+hash chains and one step of lazy matching: a match is put off by a literal when the next position
+has a longer one. Exits if memory cannot be allocated, as the bit sink does.
+*/
+void lz_compress(BitSink *sink, const uint8_t *data, size_t size, uint8_t window_bits) {
+    bit_sink_put(sink, window_bits, 8);
+
+    LzMatcher *m = (LzMatcher *) malloc(sizeof(LzMatcher));
+    LzToken *tokens = (LzToken *) malloc(LZ_BLOCK * sizeof(LzToken));
+    uint32_t *prev = (uint32_t *) malloc(((size_t) 1 << window_bits) * sizeof(uint32_t));
+    if (m == NULL || tokens == NULL || prev == NULL) {
+        fprintf(stderr, "huff:  unable to allocate memory\n");
+        exit(1);
+    }
+    m->data = data;
+    m->size = size;
+    m->window = 1u << window_bits;
+    m->prev = prev;
+    memset(m->head, 0xff, sizeof(m->head));
+
+    size_t count = 0;
+    size_t block_start = 0;
+    size_t pos = 0;
+    /*
+    * When a match is put off, the one found at the next position is kept
+    * for the next step rather than searched for again.
+    */
+    bool have_next = false;
+    uint32_t next_length = 0;
+    uint32_t next_distance = 0;
+    while (pos < size) {
+        uint32_t distance = next_distance;
+        uint32_t length = have_next ? next_length : lz_find(m, pos, &distance);
+        lz_insert(m, pos);
+
+        have_next = false;
+        if (length > 0 && length < LZ_LAZY_LIMIT) {
+            next_length = lz_find(m, pos + 1, &next_distance);
+            if (next_length > length) {
+                length = 0;
+                have_next = true;
+            }
+        }
+
+        if (length == 0) {
+            tokens[count++] = (LzToken) { 0, data[pos] };
+            pos++;
+        } else {
+            tokens[count++] = (LzToken) { (uint16_t) length, distance };
+            for (size_t i = pos + 1; i < pos + length; i++) {
+                lz_insert(m, i);
+            }
+            pos += length;
+        }
+
+        if (count == LZ_BLOCK || pos - block_start >= LZ_BLOCK || pos == size) {
+            lz_write_block(sink, tokens, count);
+            count = 0;
+            block_start = pos;
+        }
+    }
+
+    free(prev);
+    free(tokens);
+    free(m);
+}
+
+/*
+Make sure src holds at least bits bits, padding past the end of the input.
+*/
+static inline void lz_need(BitSource *src, uint32_t bits) {
+    while (src->nbits < bits) {
+        bit_source_refill(src);
+    }
+}
+
+/*
+Read the low bits of acc, which the caller has made sure are there.
+*/
+static inline uint32_t lz_take(BitSource *src, uint32_t bits) {
+    uint32_t value = (uint32_t) (src->acc & ((1ull << bits) - 1));
+    src->acc >>= bits;
+    src->nbits -= bits;
+    return value;
+}
+
+/*
+Copy a match of length bytes from distance back. Distances of 8 or more copy 8 bytes at a time,
+which may write up to 7 bytes past the match; slack is the room out has for that.
+*/
+static inline void lz_copy(uint8_t *out, uint32_t distance, uint32_t length, size_t slack) {
+    const uint8_t *from = out - distance;
+    if (distance >= 8 && slack >= length + 8) {
+        for (uint32_t i = 0; i < length; i += 8) {
+            memcpy(out + i, from + i, 8);
+        }
+        return;
+    }
+    for (uint32_t i = 0; i < length; i++) {
+        out[i] = from[i];
+    }
+}
+
+static const char *lz_decode_block(BitSource *src, CanonicalTable *litlen,
+    CanonicalTable *distances, uint32_t window, uint8_t *out, size_t size, size_t *ppos) {
+    uint8_t litlen_lengths[LZ_LITLEN_SYMBOLS];
+    uint8_t distance_lengths[LZ_DISTANCE_BUCKETS];
+    if (!compact_read_lengths_n(src, litlen_lengths, LZ_LITLEN_SYMBOLS)
+        || !compact_read_lengths_n(src, distance_lengths, LZ_DISTANCE_BUCKETS)
+        || !canonical_table_build(litlen, litlen_lengths)
+        || !canonical_table_build(distances, distance_lengths)) {
+        return "input has a damaged code table";
+    }
+
+    size_t pos = *ppos;
+    uint32_t extra_bits;
+    for (;;) {
+        lz_need(src, COMPACT_MAX_LENGTH + 7);
+        uint32_t s = canonical_decode(src, litlen);
+        if (s < LZ_END) {
+            if (pos == size) {
+                return "input has more data than its size";
+            }
+            out[pos++] = (uint8_t) s;
+            continue;
+        }
+        if (s == LZ_END) {
+            break;
+        }
+        if (s == CANONICAL_INVALID) {
+            return "input has a damaged code";
+        }
+
+        uint32_t length = LZ_MIN_MATCH + lz_bucket_base(s - LZ_END - 1, &extra_bits);
+        length += lz_take(src, extra_bits);
+        lz_need(src, COMPACT_MAX_LENGTH + 23);
+        uint32_t d = canonical_decode(src, distances);
+        if (d == CANONICAL_INVALID) {
+            return "input has a damaged code";
+        }
+        uint32_t distance = 1 + lz_bucket_base(d, &extra_bits);
+        distance += lz_take(src, extra_bits);
+
+        if (distance > pos || distance > window || length > size - pos) {
+            return "input has a damaged match";
+        }
+        lz_copy(out + pos, distance, length, size - pos);
+        pos += length;
+    }
+
+    *ppos = pos;
+    return bit_source_overrun(src) ? "input is truncated" : NULL;
+}
+
+/*
+Decode the body of an 'HL' frame into the size bytes of out. Return NULL on success or a
+description of what is wrong with the input.
+*/
+const char *lz_decompress(BitSource *src, uint8_t *out, size_t size) {
+    uint8_t window_bits = (uint8_t) bit_source_get(src, 8);
+    if (window_bits < LZ_MIN_WINDOW || window_bits > LZ_MAX_WINDOW) {
+        return "input has a damaged window size";
+    }
+
+    CanonicalTable *litlen = canonical_table_create(LZ_LITLEN_SYMBOLS);
+    CanonicalTable *distances = canonical_table_create(LZ_DISTANCE_BUCKETS);
+    const char *error = NULL;
+    if (litlen == NULL || distances == NULL) {
+        error = "unable to allocate memory";
+    }
+
+    size_t pos = 0;
+    while (error == NULL && pos < size) {
+        error = lz_decode_block(src, litlen, distances, 1u << window_bits, out, size, &pos);
+    }
+
+    canonical_table_free(&litlen);
+    canonical_table_free(&distances);
+    return error;
+}
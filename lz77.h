@@ -0,0 +1,52 @@
+#ifndef _LZ77_H
+#define _LZ77_H
+
+/*
+* File:     lz77.h
+* Purpose:  Header file for lz77.c, the LZ77 front end behind 'HL' frames:
+*           repeated strings become (length, distance) matches, and the
+*           literals, lengths and distances are Huffman coded with separate
+*           canonical codes.
+*
+* Layout:   'H' 'L', 32-bit size, then the 8-bit window size in bits, then
+*           blocks until size bytes have been produced.  Each block starts
+*           with the code lengths of the literal/length alphabet and of the
+*           distance alphabet, as compact_write_lengths_n() writes them, and
+*           ends with LZ_END.
+*
+* Symbols 0-255 of the literal/length alphabet are literal bytes, LZ_END
+* ends a block and the rest give a match length.  Match lengths less
+* LZ_MIN_MATCH and distances less one are sent as a bucket symbol and extra
+* bits, as DEFLATE does distances: values 0-3 are their own bucket, and
+* above that each power of two is split into two buckets whose members
+* differ in the extra bits.
+*/
+
+#include "decode.h"
+#include "encode.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH 258
+
+#define LZ_END             256
+#define LZ_LENGTH_BUCKETS  16
+#define LZ_LITLEN_SYMBOLS  (LZ_END + 1 + LZ_LENGTH_BUCKETS)
+#define LZ_DISTANCE_BUCKETS 48
+
+#define LZ_MIN_WINDOW     10
+#define LZ_MAX_WINDOW     24
+#define LZ_DEFAULT_WINDOW 16
+
+/*
+* Input bytes coded with one pair of tables.
+*/
+#define LZ_BLOCK (1u << 18)
+
+void lz_compress(BitSink *sink, const uint8_t *data, size_t size, uint8_t window_bits);
+const char *lz_decompress(BitSource *src, uint8_t *out, size_t size);
+
+#endif
@@ -16,6 +16,10 @@ Node *node_create(uint8_t symbol, uint32_t weight) {
 
     n->symbol = symbol;
     n->weight = weight;
+    n->code = 0;
+    n->code_length = 0;
+    n->left = NULL;
+    n->right = NULL;
 
     return n;
 }
@@ -25,6 +29,8 @@ Free the children of *pnode, free *pnode, and set *pnode to NULL
 */
 void node_free(Node **pnode) {
     if (*pnode != NULL) {
+        node_free(&(*pnode)->left);
+        node_free(&(*pnode)->right);
         free(*pnode);
         *pnode = NULL;
     }
@@ -0,0 +1,147 @@
+#include "perf.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+static const char *const perf_names[PERF_COUNTERS]
+    = { "cycles", "instr", "br-miss", "L1D-miss", "LLC-miss" };
+
+#ifdef __linux__
+
+static int perf_event_open(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/*
+Open the counters for this thread. Any that the kernel refuses are left at -1.
+*/
+void perf_open(PerfCounters *counters) {
+    const uint64_t l1d_read_miss = PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8
+                                   | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+    counters->fd[0] = perf_event_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    counters->fd[1] = perf_event_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    counters->fd[2] = perf_event_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    counters->fd[3] = perf_event_open(PERF_TYPE_HW_CACHE, l1d_read_miss);
+    counters->fd[4] = perf_event_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+
+    counters->any = false;
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+        counters->any |= counters->fd[i] >= 0;
+    }
+}
+
+void perf_close(PerfCounters *counters) {
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+        if (counters->fd[i] >= 0) {
+            close(counters->fd[i]);
+            counters->fd[i] = -1;
+        }
+    }
+    counters->any = false;
+}
+
+void perf_start(PerfCounters *counters) {
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+        if (counters->fd[i] >= 0) {
+            ioctl(counters->fd[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(counters->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+/*
+Stop the counters and read what they counted since perf_start().
+*/
+void perf_stop(PerfCounters *counters, PerfSample *sample) {
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+        sample->value[i] = PERF_MISSING;
+        if (counters->fd[i] >= 0) {
+            ioctl(counters->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+            uint64_t value;
+            if (read(counters->fd[i], &value, sizeof(value)) == (ssize_t) sizeof(value)) {
+                sample->value[i] = value;
+            }
+        }
+    }
+}
+
+#else
+
+void perf_open(PerfCounters *counters) {
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+        counters->fd[i] = -1;
+    }
+    counters->any = false;
+}
+
+void perf_close(PerfCounters *counters) {
+    counters->any = false;
+}
+
+void perf_start(PerfCounters *counters) {
+    (void) counters;
+}
+
+void perf_stop(PerfCounters *counters, PerfSample *sample) {
+    (void) counters;
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+        sample->value[i] = PERF_MISSING;
+    }
+}
+
+#endif
+
+/*
+Add sample to total, a missing count in either making the sum missing.
+*/
+void perf_add(PerfSample *total, const PerfSample *sample) {
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+        if (total->value[i] == PERF_MISSING || sample->value[i] == PERF_MISSING) {
+            total->value[i] = PERF_MISSING;
+        } else {
+            total->value[i] += sample->value[i];
+        }
+    }
+}
+
+/*
+Print one line for a stage: each count per input byte, and instructions per cycle. Counters that
+are missing print as "-"; if none could be opened the line says so instead.
+*/
+void perf_print(FILE *out, const char *prefix, const char *stage, const PerfCounters *counters,
+    const PerfSample *sample, uint64_t bytes) {
+    fprintf(out, "%s%-10s", prefix, stage);
+    if (!counters->any) {
+        fprintf(out, " counters unavailable\n");
+        return;
+    }
+
+    double per = bytes ? 1.0 / (double) bytes : 0.0;
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+        if (sample->value[i] == PERF_MISSING) {
+            fprintf(out, " %s/B -", perf_names[i]);
+        } else {
+            fprintf(out, " %s/B %.3f", perf_names[i], (double) sample->value[i] * per);
+        }
+    }
+    const uint64_t cycles = sample->value[0];
+    const uint64_t instructions = sample->value[1];
+    if (cycles != PERF_MISSING && instructions != PERF_MISSING && cycles > 0) {
+        fprintf(out, " IPC %.2f", (double) instructions / (double) cycles);
+    }
+    fprintf(out, "\n");
+}
@@ -0,0 +1,39 @@
+#ifndef _PERF_H
+#define _PERF_H
+
+/*
+* File:     perf.h
+* Purpose:  Header file for perf.c, optional hardware counters read with
+*           perf_event_open() around the stages of bench and huff/dehuff -v.
+*
+* Each counter is opened on its own, user space only, so that a kernel or
+* CPU without one of them (or a container that allows none) still gives the
+* others.  Counters that cannot be opened read as PERF_MISSING.
+*/
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define PERF_COUNTERS 5
+#define PERF_MISSING  UINT64_MAX
+
+typedef struct PerfCounters {
+    int fd[PERF_COUNTERS];
+    bool any;
+} PerfCounters;
+
+typedef struct PerfSample {
+    uint64_t value[PERF_COUNTERS];
+} PerfSample;
+
+void perf_open(PerfCounters *counters);
+void perf_close(PerfCounters *counters);
+void perf_start(PerfCounters *counters);
+void perf_stop(PerfCounters *counters, PerfSample *sample);
+void perf_add(PerfSample *total, const PerfSample *sample);
+void perf_print(FILE *out, const char *prefix, const char *stage, const PerfCounters *counters,
+    const PerfSample *sample, uint64_t bytes);
+
+#endif
@@ -0,0 +1,87 @@
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct Pool Pool;
+
+struct Pool {
+    PoolTask task;
+    void *arg;
+    size_t count;
+    atomic_size_t next;
+};
+
+typedef struct PoolWorker {
+    Pool *pool;
+    unsigned id;
+} PoolWorker;
+
+/*
+Return the number of online CPUs, or 1 if that cannot be found.
+*/
+unsigned pool_default_workers(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (unsigned) n : 1;
+}
+
+static void *pool_run(void *arg) {
+    PoolWorker *worker = (PoolWorker *) arg;
+    Pool *pool = worker->pool;
+
+    size_t index;
+    while ((index = atomic_fetch_add(&pool->next, 1)) < pool->count) {
+        pool->task(pool->arg, index, worker->id);
+    }
+    return NULL;
+}
+
+/*
+Run task for every index in [0, count) on num_workers threads, the calling thread being worker 0.
+Tasks are handed out one at a time in index order. Return false if the threads cannot be started;
+the tasks have all run by then anyway.
+*/
+bool pool_for(unsigned num_workers, size_t count, PoolTask task, void *arg) {
+    if (num_workers == 0) {
+        num_workers = 1;
+    }
+    if (num_workers > count) {
+        num_workers = count > 0 ? (unsigned) count : 1;
+    }
+
+    Pool pool = { task, arg, count, 0 };
+    PoolWorker *workers = (PoolWorker *) malloc(num_workers * sizeof(PoolWorker));
+    pthread_t *threads = (pthread_t *) malloc(num_workers * sizeof(pthread_t));
+    if (workers == NULL || threads == NULL) {
+        free(workers);
+        free(threads);
+        PoolWorker self = { &pool, 0 };
+        pool_run(&self);
+        return false;
+    }
+
+    bool ok = true;
+    unsigned started = 1;
+    for (unsigned w = 0; w < num_workers; w++) {
+        workers[w].pool = &pool;
+        workers[w].id = w;
+    }
+    for (unsigned w = 1; w < num_workers; w++) {
+        if (pthread_create(&threads[w], NULL, pool_run, &workers[w]) != 0) {
+            ok = false;
+            break;
+        }
+        started++;
+    }
+
+    pool_run(&workers[0]);
+    for (unsigned w = 1; w < started; w++) {
+        pthread_join(threads[w], NULL);
+    }
+
+    free(workers);
+    free(threads);
+    return ok;
+}
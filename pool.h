@@ -0,0 +1,23 @@
+#ifndef _POOL_H
+#define _POOL_H
+
+/*
+* File:     pool.h
+* Purpose:  Header file for pool.c, a fixed pool of worker threads that
+*           share out numbered tasks.
+*/
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+* A task is called once for each index in [0, count).  worker is the
+* number of the thread running it, in [0, num_workers), so that tasks can
+* keep per-worker scratch space.
+*/
+typedef void (*PoolTask)(void *arg, size_t index, unsigned worker);
+
+unsigned pool_default_workers(void);
+bool pool_for(unsigned num_workers, size_t count, PoolTask task, void *arg);
+
+#endif
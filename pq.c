@@ -75,6 +75,7 @@ void enqueue(PriorityQueue *q, Node *tree) {
     }
 
     new_element->tree = tree;
+    new_element->next = NULL;
 
     if (q->list == NULL) {
         q->list = new_element;
@@ -0,0 +1,162 @@
+#include "rpc.h"
+
+#include "batch.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*
+Read exactly size bytes. Return false at end of input or on error.
+*/
+bool rpc_read_full(int fd, void *buf, size_t size) {
+    uint8_t *p = (uint8_t *) buf;
+    while (size > 0) {
+        ssize_t n = read(fd, p, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= (size_t) n;
+    }
+    return true;
+}
+
+/*
+Write exactly size bytes. MSG_NOSIGNAL keeps a peer that has gone away from raising SIGPIPE.
+*/
+bool rpc_write_full(int fd, const void *buf, size_t size) {
+    const uint8_t *p = (const uint8_t *) buf;
+    while (size > 0) {
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= (size_t) n;
+    }
+    return true;
+}
+
+static bool rpc_address(const char *path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    strcpy(addr->sun_path, path);
+    return true;
+}
+
+/*
+Connect to the daemon at path. Return the socket, or -1 with errno set.
+*/
+int rpc_connect(const char *path) {
+    struct sockaddr_un addr;
+    if (!rpc_address(path, &addr)) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+/*
+Listen at path. A socket file left by a daemon that is gone is replaced, but one that a daemon is
+still answering on is not: then errno is EADDRINUSE. Return the socket, or -1 with errno set.
+*/
+int rpc_listen(const char *path) {
+    struct sockaddr_un addr;
+    if (!rpc_address(path, &addr)) {
+        return -1;
+    }
+    int live = rpc_connect(path);
+    if (live >= 0) {
+        close(live);
+        errno = EADDRINUSE;
+        return -1;
+    }
+    unlink(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+static void put_le32(uint8_t *p, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (uint8_t) (value >> (8 * i));
+    }
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+bool rpc_send_request(int fd, const RpcRequest *request, const uint8_t *payload) {
+    uint8_t header[RPC_HEADER] = { request->op, request->mode, request->param, 0 };
+    put_le32(header + 4, request->size);
+    return rpc_write_full(fd, header, sizeof(header))
+           && rpc_write_full(fd, payload, request->size);
+}
+
+/*
+Read the next request, its payload into *pbuf, grown as needed under the memory budget. Return
+false when the peer has closed the connection, on error, or if the payload does not fit.
+*/
+bool rpc_read_request(int fd, RpcRequest *request, uint8_t **pbuf, size_t *pcap) {
+    uint8_t header[RPC_HEADER];
+    if (!rpc_read_full(fd, header, sizeof(header))) {
+        return false;
+    }
+    request->op = header[0];
+    request->mode = header[1];
+    request->param = header[2];
+    request->size = get_le32(header + 4);
+    return batch_reserve(pbuf, pcap, request->size)
+           && rpc_read_full(fd, *pbuf, request->size);
+}
+
+bool rpc_send_response(int fd, uint8_t status, const uint8_t *payload, uint32_t size) {
+    uint8_t header[RPC_HEADER] = { status, 0, 0, 0 };
+    put_le32(header + 4, size);
+    return rpc_write_full(fd, header, sizeof(header)) && rpc_write_full(fd, payload, size);
+}
+
+/*
+Read a response, its payload into *pbuf, grown as needed, and its size into *psize.
+*/
+bool rpc_read_response(int fd, uint8_t *status, uint8_t **pbuf, size_t *pcap, uint32_t *psize) {
+    uint8_t header[RPC_HEADER];
+    if (!rpc_read_full(fd, header, sizeof(header))) {
+        return false;
+    }
+    *status = header[0];
+    *psize = get_le32(header + 4);
+    return batch_reserve(pbuf, pcap, *psize) && rpc_read_full(fd, *pbuf, *psize);
+}
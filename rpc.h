@@ -0,0 +1,55 @@
+#ifndef _RPC_H
+#define _RPC_H
+
+/*
+* File:     rpc.h
+* Purpose:  Header file for rpc.c, the framed requests and responses that
+*           huffd and its client huffc exchange over a Unix domain socket.
+*
+* A connection carries any number of requests, each answered in turn.
+*
+* Request:  op, mode, param, a zero byte, the 32-bit payload size, payload.
+* Response: status, three zero bytes, the 32-bit payload size, payload.
+*
+* Sizes are little-endian.  A compress request's mode is the frame type to
+* write: 'C' (or 'D' when the daemon has a dictionary), 'K', 'W', 'L' with the
+* window bits in param (0 for the default), or 'F' with the filters in the
+* high four bits of param and the stride in the low four.  A decompress
+* request's payload is one frame.  A stats request has no payload and is
+* answered with the daemon's counters as text.  An error response carries
+* the message.
+*/
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define RPC_COMPRESS   'C'
+#define RPC_DECOMPRESS 'D'
+#define RPC_STATS      'S'
+
+#define RPC_OK    0
+#define RPC_ERROR 1
+
+#define RPC_HEADER         8
+#define RPC_DEFAULT_SOCKET "/tmp/huffd.sock"
+
+typedef struct RpcRequest {
+    uint8_t op;
+    uint8_t mode;
+    uint8_t param;
+    uint32_t size;
+} RpcRequest;
+
+bool rpc_read_full(int fd, void *buf, size_t size);
+bool rpc_write_full(int fd, const void *buf, size_t size);
+
+int rpc_listen(const char *path);
+int rpc_connect(const char *path);
+
+bool rpc_send_request(int fd, const RpcRequest *request, const uint8_t *payload);
+bool rpc_read_request(int fd, RpcRequest *request, uint8_t **pbuf, size_t *pcap);
+bool rpc_send_response(int fd, uint8_t status, const uint8_t *payload, uint32_t size);
+bool rpc_read_response(int fd, uint8_t *status, uint8_t **pbuf, size_t *pcap, uint32_t *psize);
+
+#endif
@@ -0,0 +1,200 @@
+#include "stream.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+Create a stream decoder for one frame. dict is needed for 'D' frames and must outlive the stream.
+Return NULL if memory cannot be allocated.
+*/
+DehuffStream *dehuff_stream_create(const Dictionary *dict) {
+    DehuffStream *ctx = (DehuffStream *) calloc(1, sizeof(DehuffStream));
+    if (ctx == NULL) {
+        return NULL;
+    }
+    ctx->dict = dict;
+    ctx->status = DEHUFF_STREAM_MORE;
+    ctx->in_header = true;
+    return ctx;
+}
+
+void dehuff_stream_free(DehuffStream **pctx) {
+    if (pctx == NULL || *pctx == NULL) {
+        return;
+    }
+    frame_header_free(&(*pctx)->header);
+    free((*pctx)->buf);
+    free(*pctx);
+    *pctx = NULL;
+}
+
+static void dehuff_stream_fail(DehuffStream *ctx, const char *error) {
+    ctx->status = DEHUFF_STREAM_ERROR;
+    ctx->error = error;
+}
+
+/*
+Add in_len bytes of input. The bytes already consumed are dropped first, so the buffer holds only
+what is left of the header or the bytes after the last code decoded. Return false if the stream has
+failed or memory cannot be allocated, and on input after the end of the frame.
+*/
+bool dehuff_stream_feed(DehuffStream *ctx, const uint8_t *in, size_t in_len) {
+    if (ctx->status == DEHUFF_STREAM_DONE && in_len > 0) {
+        dehuff_stream_fail(ctx, "input has data after its frame");
+    }
+    if (ctx->status != DEHUFF_STREAM_MORE) {
+        return ctx->status == DEHUFF_STREAM_DONE;
+    }
+
+    size_t used = ctx->in_header ? 0 : (size_t) (ctx->src.ptr - ctx->buf);
+    if (used > 0) {
+        memmove(ctx->buf, ctx->buf + used, ctx->len - used);
+        ctx->len -= used;
+    }
+    if (ctx->cap - ctx->len < in_len) {
+        size_t cap = ctx->cap ? 2 * ctx->cap : 1 << 12;
+        while (cap - ctx->len < in_len) {
+            cap *= 2;
+        }
+        uint8_t *buf = (uint8_t *) realloc(ctx->buf, cap);
+        if (buf == NULL) {
+            dehuff_stream_fail(ctx, "unable to allocate memory");
+            return false;
+        }
+        ctx->buf = buf;
+        ctx->cap = cap;
+    }
+    if (in_len > 0) {
+        memcpy(ctx->buf + ctx->len, in, in_len);
+        ctx->len += in_len;
+    }
+    ctx->src.ptr = ctx->buf;
+    ctx->src.end = ctx->buf + ctx->len;
+    return true;
+}
+
+/*
+Take off the zero bits a refill added past the end of the input, which nothing has consumed.
+*/
+static void dehuff_stream_unpad(BitSource *src) {
+    src->nbits -= src->pad;
+    src->pad = 0;
+}
+
+/*
+Read the frame header from the start of the buffer. Running out of bytes anywhere in it, which
+may show up as a damaged tree when the missing bits read as zeros, leaves the stream waiting for
+more; it is read again from the start when they come. Return false if it is not all there yet.
+*/
+static bool dehuff_stream_header(DehuffStream *ctx) {
+    BitSource src;
+    bit_source_init(&src, ctx->buf, ctx->len);
+    const char *error = frame_read_header(&src, ctx->dict, &ctx->header);
+    if (bit_source_overrun(&src)) {
+        return false;
+    }
+    if (error == NULL && ctx->header.type != 'C' && ctx->header.type != 'D'
+        && ctx->header.type != 'K') {
+        error = "only 'C', 'D' and 'K' frames can be decoded as a stream";
+    }
+    if (error != NULL) {
+        dehuff_stream_fail(ctx, error);
+        return false;
+    }
+    dehuff_stream_unpad(&src);
+    ctx->src = src;
+    ctx->remaining = ctx->header.filesize;
+    ctx->in_header = false;
+    return true;
+}
+
+/*
+Decode one symbol from the bits fed so far, a bit at a time past the lookup. Return false, having
+consumed nothing, if the code is not all there.
+*/
+static bool dehuff_stream_symbol(BitSource *src, const DecodeTable *table, uint8_t *symbol) {
+    uint64_t acc = src->acc;
+    uint32_t nbits = src->nbits;
+    const uint8_t *ptr = src->ptr;
+    while (nbits <= 56 && ptr < src->end) {
+        acc |= (uint64_t) *ptr++ << nbits;
+        nbits += 8;
+    }
+
+    uint32_t entry = table->entry[acc & ((1u << DECODE_BITS) - 1)];
+    uint32_t length = entry >> 16;
+    uint16_t ref = (uint16_t) entry;
+    if (length > nbits) {
+        return false;
+    }
+    acc >>= length;
+    nbits -= length;
+    while (!(ref & DECODE_LEAF)) {
+        if (nbits == 0) {
+            return false;
+        }
+        ref = table->child[ref][acc & 1];
+        acc >>= 1;
+        nbits -= 1;
+    }
+
+    src->acc = acc;
+    src->nbits = nbits;
+    src->ptr = ptr;
+    *symbol = (uint8_t) ref;
+    return true;
+}
+
+/*
+Decode into out as many bytes as the input fed so far and out_cap allow, and return how many. A
+run of symbols whose codes cannot be longer than the bits in hand goes through decode_symbols();
+it refills past the end of the buffer with zero bits that the run never reaches, and those are
+taken off again. When the bits left are too few for a run, symbols are taken one at a time until
+one is cut off. Check ctx->status for whether the frame is done or the stream has failed.
+*/
+size_t dehuff_stream_drain(DehuffStream *ctx, uint8_t *out, size_t out_cap) {
+    if (ctx->status != DEHUFF_STREAM_MORE || (ctx->in_header && !dehuff_stream_header(ctx))) {
+        return 0;
+    }
+
+    BitSource *src = &ctx->src;
+    const DecodeTable *table = ctx->header.table;
+    size_t produced = 0;
+    while (produced < out_cap && ctx->remaining > 0) {
+        uint64_t bits = src->nbits + 8 * (uint64_t) (src->end - src->ptr);
+        uint64_t run = table->max_length ? bits / table->max_length : ctx->remaining;
+        run = run < ctx->remaining ? run : ctx->remaining;
+        run = run < out_cap - produced ? run : out_cap - produced;
+        if (run > 0) {
+            decode_symbols(src, table, out + produced, (size_t) run);
+            dehuff_stream_unpad(src);
+        } else if (dehuff_stream_symbol(src, table, out + produced)) {
+            run = 1;
+        } else {
+            break;
+        }
+        produced += (size_t) run;
+        ctx->remaining -= (uint32_t) run;
+    }
+
+    if (ctx->remaining == 0) {
+        ctx->status = DEHUFF_STREAM_DONE;
+        bit_source_align(src);
+        if (src->nbits > 0 || src->ptr < src->end) {
+            dehuff_stream_fail(ctx, "input has data after its frame");
+        }
+    }
+    return produced;
+}
+
+/*
+Say that no more input is coming. Return DEHUFF_STREAM_DONE if the whole frame was decoded, and
+otherwise fail with the input truncated. Drain everything first: a frame whose last bytes are fed
+but not yet drained is not done.
+*/
+DehuffStreamStatus dehuff_stream_finish(DehuffStream *ctx) {
+    if (ctx->status == DEHUFF_STREAM_MORE) {
+        dehuff_stream_fail(ctx, "input is truncated");
+    }
+    return ctx->status;
+}
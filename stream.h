@@ -0,0 +1,61 @@
+#ifndef _STREAM_H
+#define _STREAM_H
+
+/*
+* File:     stream.h
+* Purpose:  Header file for stream.c, a push/pull decoder for receivers
+*           that get a compressed frame in pieces of any size and want to
+*           decode as they arrive.
+*
+* dehuff_stream_feed() hands over the next bytes, which are copied, and
+* dehuff_stream_drain() decodes as much of what it has as fits in out.
+* Either may stop anywhere: in the header, in the tree or table, or in
+* the middle of a code.  The header is read again from its first byte
+* until it is all there; symbols go through decode_symbols() in runs that
+* cannot reach past the bytes fed, and only the last few codes before the
+* end of the input are taken one at a time.  'C', 'D' and 'K' frames can
+* be decoded this way; the stream holds one frame.
+*/
+
+#include "decode.h"
+#include "dict.h"
+#include "frame.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+* What the stream is waiting for.  error says what went wrong.
+*/
+typedef enum DehuffStreamStatus {
+    DEHUFF_STREAM_MORE,
+    DEHUFF_STREAM_DONE,
+    DEHUFF_STREAM_ERROR
+} DehuffStreamStatus;
+
+/*
+* buf holds the bytes fed and not yet consumed: all of them while the
+* header is incomplete, and then those from src.ptr on, with src.acc
+* holding the bits in between.
+*/
+typedef struct DehuffStream {
+    const Dictionary *dict;
+    DehuffStreamStatus status;
+    const char *error;
+    bool in_header;
+    FrameHeader header;
+    uint32_t remaining;
+    uint8_t *buf;
+    size_t cap;
+    size_t len;
+    BitSource src;
+} DehuffStream;
+
+DehuffStream *dehuff_stream_create(const Dictionary *dict);
+void dehuff_stream_free(DehuffStream **pctx);
+bool dehuff_stream_feed(DehuffStream *ctx, const uint8_t *in, size_t in_len);
+size_t dehuff_stream_drain(DehuffStream *ctx, uint8_t *out, size_t out_cap);
+DehuffStreamStatus dehuff_stream_finish(DehuffStream *ctx);
+
+#endif
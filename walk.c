@@ -0,0 +1,158 @@
+#include "walk.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/*
+Return root, '/', path and suffix as one newly allocated string, leaving out the '/' when path is
+empty. Return NULL on error.
+*/
+char *walk_join(const char *root, const char *path, const char *suffix) {
+    size_t a = strlen(root);
+    size_t b = strlen(path);
+    size_t c = strlen(suffix);
+    char *joined = (char *) malloc(a + b + c + 2);
+    if (joined == NULL) {
+        return NULL;
+    }
+    memcpy(joined, root, a);
+    if (b > 0) {
+        joined[a++] = '/';
+        memcpy(joined + a, path, b);
+    }
+    memcpy(joined + a + b, suffix, c + 1);
+    return joined;
+}
+
+static bool walk_add(char ***plist, size_t *count, size_t *cap, char *path) {
+    if (*count == *cap) {
+        size_t bigger = *cap ? 2 * *cap : 64;
+        char **list = (char **) realloc(*plist, bigger * sizeof(char *));
+        if (list == NULL) {
+            return false;
+        }
+        *plist = list;
+        *cap = bigger;
+    }
+    (*plist)[(*count)++] = path;
+    return true;
+}
+
+typedef struct Walk {
+    FileTree *tree;
+    const char *root;
+    size_t file_cap;
+    size_t size_cap;
+    size_t dir_cap;
+} Walk;
+
+/*
+Add the files under the directory path (relative to the root) to the tree, and the directories
+below it, parents before their children. Return false on error.
+*/
+static bool walk_dir(Walk *walk, const char *path) {
+    char *full = walk_join(walk->root, path, "");
+    DIR *dir = full != NULL ? opendir(full) : NULL;
+    free(full);
+    if (dir == NULL) {
+        return false;
+    }
+
+    FileTree *tree = walk->tree;
+    bool ok = true;
+    struct dirent *entry;
+    while (ok && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        char *child = *path ? walk_join(path, entry->d_name, "") : walk_join(entry->d_name, "", "");
+        full = child != NULL ? walk_join(walk->root, child, "") : NULL;
+        struct stat st;
+        if (full == NULL || lstat(full, &st) != 0) {
+            ok = false;
+            free(child);
+        } else if (S_ISDIR(st.st_mode)) {
+            ok = walk_add(&tree->dirs, &tree->dir_count, &walk->dir_cap, child)
+                 && walk_dir(walk, child);
+        } else if (S_ISREG(st.st_mode)) {
+            if (tree->count == walk->size_cap) {
+                size_t bigger = walk->size_cap ? 2 * walk->size_cap : 64;
+                uint64_t *sizes = (uint64_t *) realloc(tree->sizes, bigger * sizeof(uint64_t));
+                ok = sizes != NULL;
+                tree->sizes = ok ? sizes : tree->sizes;
+                walk->size_cap = ok ? bigger : walk->size_cap;
+            }
+            if (ok) {
+                tree->sizes[tree->count] = (uint64_t) st.st_size;
+                ok = walk_add(&tree->paths, &tree->count, &walk->file_cap, child);
+            }
+        } else {
+            tree->skipped++;
+            free(child);
+        }
+        free(full);
+    }
+    closedir(dir);
+    return ok;
+}
+
+/*
+List the regular files under root and the directories between them. Return NULL if root is not a
+directory or cannot all be read.
+*/
+FileTree *walk_tree(const char *root) {
+    FileTree *tree = (FileTree *) calloc(1, sizeof(FileTree));
+    if (tree == NULL) {
+        return NULL;
+    }
+    Walk walk = { tree, root, 0, 0, 0 };
+    if (!walk_dir(&walk, "")) {
+        walk_free(&tree);
+    }
+    return tree;
+}
+
+void walk_free(FileTree **ptree) {
+    FileTree *tree = *ptree;
+    if (tree != NULL) {
+        for (size_t i = 0; i < tree->count; i++) {
+            free(tree->paths[i]);
+        }
+        for (size_t i = 0; i < tree->dir_count; i++) {
+            free(tree->dirs[i]);
+        }
+        free(tree->paths);
+        free(tree->sizes);
+        free(tree->dirs);
+        free(tree);
+        *ptree = NULL;
+    }
+}
+
+static bool walk_mkdir(const char *path) {
+    struct stat st;
+    return mkdir(path, 0777) == 0
+           || (errno == EEXIST && stat(path, &st) == 0 && S_ISDIR(st.st_mode));
+}
+
+/*
+Make root and, under it, every directory of the tree. Directories that already exist are kept.
+Return false on error.
+*/
+bool walk_mirror(const FileTree *tree, const char *root) {
+    if (!walk_mkdir(root)) {
+        return false;
+    }
+    for (size_t i = 0; i < tree->dir_count; i++) {
+        char *dir = walk_join(root, tree->dirs[i], "");
+        bool ok = dir != NULL && walk_mkdir(dir);
+        free(dir);
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
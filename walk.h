@@ -0,0 +1,33 @@
+#ifndef _WALK_H
+#define _WALK_H
+
+/*
+* File:     walk.h
+* Purpose:  Header file for walk.c, which lists the regular files under a
+*           directory for huff -r and makes the directories of the tree
+*           they are compressed into.
+*
+* Paths are kept relative to the root that was walked, so the same path
+* names a file in the input tree and, with ".huff" added, in the output
+* tree.  Symbolic links and special files are skipped.
+*/
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct FileTree {
+    size_t count;
+    char **paths;
+    uint64_t *sizes;
+    size_t dir_count;
+    char **dirs;
+    size_t skipped;
+} FileTree;
+
+FileTree *walk_tree(const char *root);
+void walk_free(FileTree **ptree);
+char *walk_join(const char *root, const char *path, const char *suffix);
+bool walk_mirror(const FileTree *tree, const char *root);
+
+#endif
@@ -0,0 +1,184 @@
+#include "wide.h"
+
+#include "compact.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static inline uint32_t load_symbol(const uint8_t *p) {
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8;
+}
+
+/*
+Code the size / 2 symbols of data, and its odd byte if there is one, with the table before them:
+everything of an 'HW' frame after the file size. The symbols are counted in a dense array, but the
+code is built only over those that occur, so its cost follows the number of distinct symbols.
+*/
+void wide_compress(BitSink *sink, const uint8_t *data, size_t size) {
+    size_t count = size / 2;
+    uint32_t *freq = (uint32_t *) calloc(WIDE_SYMBOLS, sizeof(uint32_t));
+    uint32_t *packed = (uint32_t *) malloc(WIDE_SYMBOLS * sizeof(uint32_t));
+    uint32_t *symbols = (uint32_t *) malloc(WIDE_SYMBOLS * sizeof(uint32_t));
+    uint32_t *used = (uint32_t *) malloc(WIDE_SYMBOLS * sizeof(uint32_t));
+    uint8_t *lengths = (uint8_t *) malloc(WIDE_SYMBOLS);
+    uint32_t *codes = (uint32_t *) malloc(WIDE_SYMBOLS * sizeof(uint32_t));
+    if (freq == NULL || packed == NULL || symbols == NULL || used == NULL || lengths == NULL
+        || codes == NULL) {
+        fprintf(stderr, "huff:  unable to allocate memory\n");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        ++freq[load_symbol(data + 2 * i)];
+    }
+    uint32_t k = 0;
+    for (uint32_t s = 0; s < WIDE_SYMBOLS; s++) {
+        if (freq[s] > 0) {
+            symbols[k] = s;
+            used[k++] = freq[s];
+        }
+    }
+
+    if (k > 0) {
+        canonical_lengths(used, k, WIDE_MAX_LENGTH, lengths);
+        canonical_codes(lengths, k, codes);
+        compact_write_varint(sink, k);
+        uint32_t prev = 0;
+        for (uint32_t i = 0; i < k; i++) {
+            compact_write_varint(sink, symbols[i] - prev);
+            bit_sink_put(sink, lengths[i], 5);
+            prev = symbols[i] + 1;
+            packed[symbols[i]] = codes[i] << 5 | lengths[i];
+        }
+    }
+
+    /* Two codes of at most 20 bits go in each append. */
+    for (size_t i = 0; i < count;) {
+        size_t n = count - i < 4096 ? count - i : 4096;
+        bit_sink_reserve(sink, n * WIDE_MAX_LENGTH / 8 + 16);
+        size_t end = i + n;
+        for (; i + 2 <= end; i += 2) {
+            uint32_t a = packed[load_symbol(data + 2 * i)];
+            uint32_t b = packed[load_symbol(data + 2 * i + 2)];
+            bit_sink_append(sink, (uint64_t) (a >> 5) | (uint64_t) (b >> 5) << (a & 31),
+                (a & 31) + (b & 31));
+        }
+        if (i < end) {
+            uint32_t a = packed[load_symbol(data + 2 * i)];
+            bit_sink_append(sink, a >> 5, a & 31);
+            i++;
+        }
+    }
+    if (size % 2) {
+        bit_sink_put(sink, data[size - 1], 8);
+    }
+
+    free(freq);
+    free(packed);
+    free(symbols);
+    free(used);
+    free(lengths);
+    free(codes);
+}
+
+/*
+Read the table of an 'HW' frame into *ptable, which is replaced, and turn it from the order of the
+symbols sent into their values, so that decoding yields a symbol with no further lookup. Return
+NULL on success or a description of what is wrong.
+*/
+const char *wide_read_table(BitSource *src, CanonicalTable **ptable) {
+    uint64_t k;
+    if (!compact_read_varint(src, &k) || k == 0 || k > WIDE_SYMBOLS) {
+        return "input has a damaged symbol table";
+    }
+
+    uint32_t *symbols = (uint32_t *) malloc(k * sizeof(uint32_t));
+    uint8_t *lengths = (uint8_t *) malloc(k);
+    canonical_table_free(ptable);
+    *ptable = canonical_table_create((uint32_t) k);
+    const char *error = NULL;
+    if (symbols == NULL || lengths == NULL || *ptable == NULL) {
+        error = "unable to allocate memory";
+    }
+
+    uint64_t next = 0;
+    for (uint64_t i = 0; error == NULL && i < k; i++) {
+        uint64_t gap;
+        if (!compact_read_varint(src, &gap) || gap >= WIDE_SYMBOLS - next) {
+            error = "input has a damaged symbol table";
+            break;
+        }
+        symbols[i] = (uint32_t) (next + gap);
+        next = symbols[i] + 1;
+        lengths[i] = (uint8_t) bit_source_get(src, 5);
+        if (lengths[i] == 0 || lengths[i] > WIDE_MAX_LENGTH) {
+            error = "input has a damaged symbol table";
+        }
+    }
+    if (error == NULL && (bit_source_overrun(src) || !canonical_table_build(*ptable, lengths))) {
+        error = "input has a damaged symbol table";
+    }
+
+    if (error == NULL) {
+        CanonicalTable *table = *ptable;
+        for (uint32_t i = 0; i < table->num_symbols; i++) {
+            table->sorted[i] = symbols[table->sorted[i]];
+        }
+        for (uint32_t i = 0; i < (1u << CANONICAL_BITS); i++) {
+            uint32_t entry = table->entry[i];
+            if (entry >> 16 != 0) {
+                table->entry[i] = (entry & 0xffff0000) | symbols[entry & 0xffff];
+            }
+        }
+    }
+    free(symbols);
+    free(lengths);
+    return error;
+}
+
+static inline void store_symbol(uint8_t *p, uint32_t symbol) {
+    p[0] = (uint8_t) symbol;
+    p[1] = (uint8_t) (symbol >> 8);
+}
+
+/*
+Decode count symbols into 2 * count bytes of out. When every code fits in a table lookup, as it does
+when there are few distinct symbols, a refill is good for several symbols and none can take the
+slow path; otherwise each symbol has a refill to itself. Return false on a bit pattern that is not
+a code.
+*/
+bool wide_decode(BitSource *src, const CanonicalTable *table, uint8_t *out, size_t count) {
+    size_t i = 0;
+    uint32_t max_length = table->max_length;
+    if (max_length <= CANONICAL_BITS) {
+        uint32_t per_refill = 56 / max_length;
+        const uint32_t mask = (1u << CANONICAL_BITS) - 1;
+        for (; i + per_refill <= count; i += per_refill) {
+            bit_source_refill(src);
+            if (src->nbits < 56) {
+                break;
+            }
+            for (uint32_t k = 0; k < per_refill; k++) {
+                uint32_t entry = table->entry[src->acc & mask];
+                uint32_t length = entry >> 16;
+                if (length == 0) {
+                    return false;
+                }
+                src->acc >>= length;
+                src->nbits -= length;
+                store_symbol(out + 2 * (i + k), entry);
+            }
+        }
+    }
+    for (; i < count; i++) {
+        bit_source_refill(src);
+        uint32_t symbol = src->nbits >= max_length ? canonical_decode(src, table)
+                                                   : canonical_decode_slow(src, table);
+        if (symbol == CANONICAL_INVALID) {
+            return false;
+        }
+        store_symbol(out + 2 * i, symbol);
+    }
+    return true;
+}
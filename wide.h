@@ -0,0 +1,39 @@
+#ifndef _WIDE_H
+#define _WIDE_H
+
+/*
+* File:     wide.h
+* Purpose:  Header file for wide.c, which codes data as 16-bit symbols for
+*           'HW' frames: 16-bit samples and UTF-16 text, whose structure a
+*           byte code splits in two.
+*
+* Layout:   'H' 'W', the 32-bit file size in bytes, and if it is at least 2
+*           the table: the number of distinct symbols as a varint, then for
+*           each in increasing order the varint gap from the symbol before
+*           it (the first symbol's value) and its 5-bit code length, of a
+*           canonical code of at most WIDE_MAX_LENGTH bits.  Then the codes
+*           of the size / 2 little-endian symbols, and if the size is odd
+*           the last byte in 8 bits.
+*
+* Only the symbols that occur are counted, sent and decoded: the table is
+* built from the sparse list of them, and its decode entries hold the
+* symbol values themselves.
+*/
+
+#include "canonical.h"
+#include "decode.h"
+#include "encode.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define WIDE_SYMBOLS    0x10000
+#define WIDE_MAX_LENGTH 20
+
+void wide_compress(BitSink *sink, const uint8_t *data, size_t size);
+
+const char *wide_read_table(BitSource *src, CanonicalTable **ptable);
+bool wide_decode(BitSource *src, const CanonicalTable *table, uint8_t *out, size_t count);
+
+#endif